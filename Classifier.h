@@ -22,8 +22,8 @@ class Classifier: public drwnTMultiClassLogistic<drwnIdentityJointFeatureMap>
         cout << "number of parameters: "<< nParameters << endl;
         vector< double > tempWeights(nParameters, 0.0);
         */
-        vector< double > tempWeights(3, 0.0);
-        for (int i = 0 ; i < 3; i ++ ) {
+        vector< double > tempWeights(_theta.size(), 0.0);
+        for (int i = 0 ; i < (int)_theta.size(); i ++ ) {
             tempWeights[i] =  _theta[i];
             //cout << _theta[i]  << endl;
         }
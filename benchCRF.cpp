@@ -0,0 +1,475 @@
+/*****************************************************************************
+** DARWIN: A FRAMEWORK FOR MACHINE LEARNING RESEARCH AND DEVELOPMENT
+** Distributed under the terms of the BSD license (see the LICENSE file)
+** Copyright (c) 2007-2013, Stephen Gould
+** All rights reserved.
+**
+******************************************************************************
+** FILENAME:    benchCRF.cpp
+** AUTHOR(S):
+**     Jimmy Lin (u5223173) - linxin@gmail.com
+**     Chris Claoue-Long (u5183532) - u5183532@anu.edu.au
+**
+** Times CRF inference on a set of images and their feature maps. With
+** -scaling the parallel grid backend is run with 1, 2, 4, ... threads up to
+** the -threads limit and the speedup over one thread is reported. With
+** -video the images are treated as consecutive frames and dynamic inference
+** is compared against solving every frame from scratch. With -coarse the
+** coarse-to-fine approximation is compared against full inference, and with
+** -superpixels so is inference on SLIC superpixels. With -neighbourhoods the
+** graph-cut backend is built and solved with 4- and 8-connected pairwise
+** terms and the edge count, build time and solve time of each reported.
+** With -quantized the integer capacity backend is compared against the
+** double precision graph-cut backend. With -mp every image and its unary
+** potentials are resized to the given number of megapixels first, e.g. to
+** check that per-pixel cost stays flat from 1 to 12 MP. With -contrast the
+** native contrast weights are timed and compared against darwin's
+** drwnPixelNeighbourContrasts. With -dense the fully connected mean-field
+** backend is timed against graph-cut with the same unary potentials.
+**
+*****************************************************************************/
+
+// c++ standard headers
+#include <cstdlib>
+#include <cstdio>
+#include <cmath>
+#include <iostream>
+#include <iomanip>
+
+// opencv library headers
+#include "cv.h"
+#include "cxcore.h"
+#include "highgui.h"
+
+// darwin library headers
+#include "drwnBase.h"
+#include "drwnIO.h"
+#include "drwnVision.h"
+
+#include "mexImageCRF.h"
+#include "saliencyUtils.h"
+
+using namespace std;
+
+// usage ---------------------------------------------------------------------
+
+void usage()
+{
+    cerr << DRWN_USAGE_HEADER << endl;
+    cerr << "USAGE: ./benchCRF [OPTIONS] <imgDir> <mscDir> <cshDir> <csdDir> <lambda1> <lambda2> <lambda3> <lambda0>\n";
+    cerr << "OPTIONS:\n"
+         << "  -crf <backend>    :: CRF inference backend to time (default: grid)\n"
+         << "  -n <num>          :: maximum number of images (default: all)\n"
+         << "  -mp <megapixels>  :: resize images to this many megapixels before timing\n"
+         << "  -scaling          :: report thread scaling of the parallel backend\n"
+         << "  -video            :: report per-frame latency of dynamic inference\n"
+         << "  -coarse <f>       :: report coarse-to-fine inference with downsampling f\n"
+         << "  -band <w>         :: width of the refined band for -coarse (default: 4)\n"
+         << "  -connectivity <n> :: 4- or 8-connected (default) pairwise terms\n"
+         << "  -neighbourhoods   :: compare 4- and 8-connected graph construction\n"
+         << "  -contrast         :: compare native and darwin contrast weight computation\n"
+         << "  -quantized        :: report the energy gap of integer capacity inference\n"
+         << "  -resolution <r>   :: capacity units per unit energy for -quantized (default: 1000)\n"
+         << "  -superpixels <s>  :: report superpixel inference with regions of about s-by-s pixels\n"
+         << "  -dense            :: report dense CRF latency against graph-cut\n"
+         << "  -iterations <n>   :: mean-field iterations for -dense (default: 5)\n"
+         << DRWN_STANDARD_OPTIONS_USAGE
+	 << endl;
+}
+
+// main ----------------------------------------------------------------------
+
+int main (int argc, char * argv[]) {
+
+    const char *crfBackendName = "grid";
+    int maxImages = -1;
+    double megapixels = 0.0;
+    bool bScaling = false;
+    bool bVideo = false;
+    int coarseFactor = 1;
+    int bandWidth = 4;
+    int superpixelSize = 0;
+    int connectivity = 8;
+    bool bNeighbourhoods = false;
+    bool bQuantized = false;
+    bool bContrast = false;
+    double resolution = 1000.0;
+    bool bDense = false;
+    int denseIterations = DenseCRFParameters().nIterations;
+
+    DRWN_BEGIN_CMDLINE_PROCESSING(argc, argv)
+        DRWN_CMDLINE_STR_OPTION("-crf", crfBackendName)
+        DRWN_CMDLINE_INT_OPTION("-n", maxImages)
+        DRWN_CMDLINE_REAL_OPTION("-mp", megapixels)
+        DRWN_CMDLINE_BOOL_OPTION("-scaling", bScaling)
+        DRWN_CMDLINE_BOOL_OPTION("-video", bVideo)
+        DRWN_CMDLINE_INT_OPTION("-coarse", coarseFactor)
+        DRWN_CMDLINE_INT_OPTION("-band", bandWidth)
+        DRWN_CMDLINE_INT_OPTION("-superpixels", superpixelSize)
+        DRWN_CMDLINE_INT_OPTION("-connectivity", connectivity)
+        DRWN_CMDLINE_BOOL_OPTION("-neighbourhoods", bNeighbourhoods)
+        DRWN_CMDLINE_BOOL_OPTION("-quantized", bQuantized)
+        DRWN_CMDLINE_BOOL_OPTION("-contrast", bContrast)
+        DRWN_CMDLINE_REAL_OPTION("-resolution", resolution)
+        DRWN_CMDLINE_BOOL_OPTION("-dense", bDense)
+        DRWN_CMDLINE_INT_OPTION("-iterations", denseIterations)
+    DRWN_END_CMDLINE_PROCESSING(usage());
+
+    const CRFBackend crfBackend = parseCRFBackend(crfBackendName);
+    const CRFNeighbourhood neighbourhood = parseCRFNeighbourhood(connectivity);
+
+    // each run produces a single report
+    const int nReports = (bContrast ? 1 : 0) + (bQuantized ? 1 : 0) + (bDense ? 1 : 0) +
+        (bNeighbourhoods ? 1 : 0) + (bVideo ? 1 : 0) + ((coarseFactor > 1) ? 1 : 0) +
+        ((superpixelSize > 0) ? 1 : 0) + (bScaling ? 1 : 0);
+    DRWN_ASSERT_MSG(nReports <= 1, "-contrast, -quantized, -dense, -neighbourhoods, -video, "
+        "-coarse, -superpixels and -scaling cannot be combined");
+
+    if (DRWN_CMDLINE_ARGC != 8) {
+        usage();
+        return -1;
+    }
+
+    const char *imgDir = DRWN_CMDLINE_ARGV[0];
+    const char *mscDir = DRWN_CMDLINE_ARGV[1];
+    const char *cshDir = DRWN_CMDLINE_ARGV[2];
+    const char *csdDir = DRWN_CMDLINE_ARGV[3];
+    const double lambda1 = atof(DRWN_CMDLINE_ARGV[4]);
+    const double lambda2 = atof(DRWN_CMDLINE_ARGV[5]);
+    const double lambda3 = atof(DRWN_CMDLINE_ARGV[6]);
+    const double lambda0 = atof(DRWN_CMDLINE_ARGV[7]);
+
+    DRWN_ASSERT_MSG(drwnDirExists(imgDir), "image directory " << imgDir << " does not exist");
+    DRWN_ASSERT_MSG(drwnDirExists(mscDir), "Multiscale Contrast directory " << mscDir << " does not exist");
+    DRWN_ASSERT_MSG(drwnDirExists(cshDir), "Centre-Surround Histogram directory " << cshDir << " does not exist");
+    DRWN_ASSERT_MSG(drwnDirExists(csdDir), "Colour Spatial Distribution directory " << csdDir << " does not exist");
+
+    vector<string> baseNames = drwnDirectoryListing(imgDir, ".jpg", false, false);
+    if ((maxImages >= 0) && (maxImages < (int)baseNames.size())) {
+        baseNames.resize(maxImages);
+    }
+
+    // load images and compute unary potentials up front so that only
+    // inference is timed
+    DRWN_LOG_MESSAGE("Loading " << baseNames.size() << " images...");
+    vector<cv::Mat> images(baseNames.size());
+    vector<vector<cv::Mat> > unaries(baseNames.size());
+    size_t numPixels = 0;
+    for (unsigned i = 0; i < baseNames.size(); i++) {
+        const string processedImage = baseNames[i] + ".jpg";
+        images[i] = cv::imread(string(imgDir) + DRWN_DIRSEP + processedImage);
+        const cv::Mat msc = cv::imread(string(mscDir) + DRWN_DIRSEP + processedImage);
+        const cv::Mat csh = cv::imread(string(cshDir) + DRWN_DIRSEP + processedImage);
+        const cv::Mat csd = cv::imread(string(csdDir) + DRWN_DIRSEP + processedImage);
+        computeUnary(msc, csh, csd, lambda1, lambda2, lambda3, unaries[i]);
+        if (megapixels > 0.0) {
+            const double s = sqrt(1.0e6 * megapixels / (images[i].rows * images[i].cols));
+            const cv::Size size((int)(s * images[i].cols + 0.5), (int)(s * images[i].rows + 0.5));
+            cv::Mat resized;
+            cv::resize(images[i], resized, size, 0, 0, cv::INTER_LINEAR);
+            images[i] = resized;
+            for (unsigned l = 0; l < unaries[i].size(); l++) {
+                cv::Mat resizedUnary;
+                cv::resize(unaries[i][l], resizedUnary, size, 0, 0, cv::INTER_LINEAR);
+                unaries[i][l] = resizedUnary;
+            }
+        }
+        numPixels += images[i].rows * images[i].cols;
+    }
+    if (baseNames.empty()) {
+        DRWN_LOG_ERROR("no images found in " << imgDir);
+        return -1;
+    }
+
+    CRFContext crf;
+    crf.setNeighbourhood(neighbourhood);
+    crf.setResolution(resolution);
+    if (bContrast) {
+        PixelContrasts contrast;
+        drwnPixelNeighbourContrasts darwinContrast;
+        double nativeTime = 0.0;
+        double darwinTime = 0.0;
+        double maxDifference = 0.0;
+        for (unsigned i = 0; i < images.size(); i++) {
+            double startTime = crfWallTime();
+            contrast.initialize(images[i]);
+            nativeTime += crfWallTime() - startTime;
+
+            startTime = crfWallTime();
+            IplImage image = (IplImage) images[i];
+            darwinContrast.initialize(&image);
+            darwinTime += crfWallTime() - startTime;
+
+            for (int y = 0; y < images[i].rows; y++) {
+                for (int x = 0; x < images[i].cols; x++) {
+                    maxDifference = std::max(maxDifference, (double)fabs(contrast.contrastW(x, y) - darwinContrast.contrastW(x, y)));
+                    maxDifference = std::max(maxDifference, (double)fabs(contrast.contrastN(x, y) - darwinContrast.contrastN(x, y)));
+                    maxDifference = std::max(maxDifference, (double)fabs(contrast.contrastNW(x, y) - darwinContrast.contrastNW(x, y)));
+                    maxDifference = std::max(maxDifference, (double)fabs(contrast.contrastSW(x, y) - darwinContrast.contrastSW(x, y)));
+                }
+            }
+        }
+        DRWN_LOG_MESSAGE("darwin contrast: " << 1000.0 * darwinTime / images.size() << "ms per image");
+        DRWN_LOG_MESSAGE("native contrast: " << 1000.0 * nativeTime / images.size() << "ms per image, "
+            << "largest weight difference " << maxDifference);
+    } else if (bQuantized) {
+        CRFContext quantizedCRF;
+        quantizedCRF.setNeighbourhood(neighbourhood);
+        quantizedCRF.setResolution(resolution);
+        double exactTime = 0.0;
+        double quantizedTime = 0.0;
+        double exactEnergy = 0.0;
+        double quantizedEnergy = 0.0;
+        size_t numDiffering = 0;
+        for (unsigned i = 0; i < images.size(); i++) {
+            double startTime = crfWallTime();
+            const cv::Mat &labels = crf.infer(images[i], unaries[i], lambda0, CRF_GRAPHCUT);
+            exactTime += crfWallTime() - startTime;
+
+            startTime = crfWallTime();
+            const cv::Mat &quantizedLabels = quantizedCRF.infer(images[i], unaries[i], lambda0, CRF_QUANTIZED);
+            quantizedTime += crfWallTime() - startTime;
+
+            exactEnergy += crfEnergy(unaries[i], crf.contrast(), lambda0, labels, neighbourhood);
+            quantizedEnergy += crfEnergy(unaries[i], crf.contrast(), lambda0, quantizedLabels, neighbourhood);
+            for (int y = 0; y < labels.rows; y++) {
+                for (int x = 0; x < labels.cols; x++) {
+                    if (labels.at<short>(y, x) != quantizedLabels.at<short>(y, x))
+                        numDiffering += 1;
+                }
+            }
+        }
+        DRWN_LOG_MESSAGE("graphcut: " << 1000.0 * exactTime / images.size() << "ms per image");
+        DRWN_LOG_MESSAGE("quantized: " << 1000.0 * quantizedTime / images.size() << "ms per image, "
+            << "energy gap " << 100.0 * (quantizedEnergy - exactEnergy) / exactEnergy << "% at resolution "
+            << resolution << ", " << 100.0 * numDiffering / numPixels << "% of pixels differ");
+    } else if (bDense) {
+        CRFContext denseCRF;
+        DenseCRFParameters denseParams;
+        denseParams.nIterations = denseIterations;
+        denseCRF.setDenseParameters(denseParams);
+        double graphCutTime = 0.0;
+        double denseTime = 0.0;
+        size_t numDiffering = 0;
+        for (unsigned i = 0; i < images.size(); i++) {
+            double startTime = crfWallTime();
+            const cv::Mat &labels = crf.infer(images[i], unaries[i], lambda0, CRF_GRAPHCUT);
+            graphCutTime += crfWallTime() - startTime;
+
+            startTime = crfWallTime();
+            const cv::Mat &denseLabels = denseCRF.infer(images[i], unaries[i], lambda0, CRF_DENSE);
+            denseTime += crfWallTime() - startTime;
+
+            for (int y = 0; y < labels.rows; y++) {
+                for (int x = 0; x < labels.cols; x++) {
+                    if (labels.at<short>(y, x) != denseLabels.at<short>(y, x))
+                        numDiffering += 1;
+                }
+            }
+        }
+        DRWN_LOG_MESSAGE("graphcut: " << 1000.0 * graphCutTime / images.size() << "ms per image");
+        DRWN_LOG_MESSAGE("dense: " << 1000.0 * denseTime / images.size() << "ms per image with "
+            << drwnThreadPool::MAX_THREADS << " threads and " << denseIterations << " iterations, "
+            << 100.0 * numDiffering / numPixels << "% of pixels differ from graph-cut");
+    } else if (bNeighbourhoods) {
+        // time construction and max-flow of the graph-cut backend separately
+        const CRFNeighbourhood neighbourhoods[2] = {CRF_4_CONNECTED, CRF_8_CONNECTED};
+        vector<cv::Mat> labels[2];
+        drwnBKMaxFlow g(0);
+        int maxNodes = 0;
+        PixelContrasts contrast;
+        DRWN_LOG_MESSAGE("connectivity       edges   build ms   solve ms");
+        for (int n = 0; n < 2; n++) {
+            size_t numEdges = 0;
+            double buildTime = 0.0;
+            double solveTime = 0.0;
+            labels[n].resize(images.size());
+            for (unsigned i = 0; i < images.size(); i++) {
+                const int H = images[i].rows;
+                const int W = images[i].cols;
+                contrast.initialize(images[i]);
+                if (H * W > maxNodes) {
+                    g.addNodes(H * W - maxNodes);
+                    maxNodes = H * W;
+                }
+                const cv::Mat zeros = cv::Mat::zeros(H, W, CV_16S);
+
+                double startTime = crfWallTime();
+                g.reset();
+                addUnaryTerms(&g, unaries[i], zeros, 1);
+                addPairwiseTerms(&g, contrast, lambda0, neighbourhoods[n]);
+                buildTime += crfWallTime() - startTime;
+                numEdges += crfEdgeCount(W, H, neighbourhoods[n]);
+
+                startTime = crfWallTime();
+                g.solve();
+                solveTime += crfWallTime() - startTime;
+
+                labels[n][i].create(H, W, CV_16S);
+                for (int y = 0; y < H; y++) {
+                    for (int x = 0; x < W; x++) {
+                        labels[n][i].at<short>(y, x) = g.inSetS(W * y + x) ? 1 : 0;
+                    }
+                }
+            }
+            DRWN_LOG_MESSAGE(setw(12) << (int)neighbourhoods[n] << setw(12) << numEdges / images.size()
+                << setw(11) << fixed << setprecision(1) << 1000.0 * buildTime / images.size()
+                << setw(11) << 1000.0 * solveTime / images.size());
+        }
+
+        size_t numDiffering = 0;
+        for (unsigned i = 0; i < images.size(); i++) {
+            for (int y = 0; y < labels[0][i].rows; y++) {
+                for (int x = 0; x < labels[0][i].cols; x++) {
+                    if (labels[0][i].at<short>(y, x) != labels[1][i].at<short>(y, x))
+                        numDiffering += 1;
+                }
+            }
+        }
+        DRWN_LOG_MESSAGE(100.0 * numDiffering / numPixels << "% of pixels differ between 4- and 8-connected labels");
+    } else if (bVideo) {
+        // frames are taken in directory order; the first frame is always
+        // solved from scratch so it is left out of both averages
+        CRFContext dynamicCRF;
+        dynamicCRF.setNeighbourhood(neighbourhood);
+        double scratchTime = 0.0;
+        double dynamicTime = 0.0;
+        size_t numDiffering = 0;
+        for (unsigned i = 0; i < images.size(); i++) {
+            double startTime = crfWallTime();
+            const cv::Mat &labels = crf.infer(images[i], unaries[i], lambda0, CRF_GRID);
+            if (i > 0) scratchTime += crfWallTime() - startTime;
+
+            startTime = crfWallTime();
+            const cv::Mat &dynamicLabels = dynamicCRF.inferNextFrame(images[i], unaries[i], lambda0);
+            if (i > 0) dynamicTime += crfWallTime() - startTime;
+
+            for (int y = 0; y < labels.rows; y++) {
+                for (int x = 0; x < labels.cols; x++) {
+                    if (labels.at<short>(y, x) != dynamicLabels.at<short>(y, x))
+                        numDiffering += 1;
+                }
+            }
+        }
+        if (images.size() > 1) {
+            DRWN_LOG_MESSAGE("from scratch: " << 1000.0 * scratchTime / (images.size() - 1) << "ms per frame");
+            DRWN_LOG_MESSAGE("dynamic: " << 1000.0 * dynamicTime / (images.size() - 1) << "ms per frame ("
+                << 100.0 * dynamicTime / scratchTime << "% of from scratch), "
+                << numDiffering << " differing pixels");
+        }
+    } else if (coarseFactor > 1) {
+        CRFContext bandedCRF;
+        bandedCRF.setNeighbourhood(neighbourhood);
+        double fullTime = 0.0;
+        double bandedTime = 0.0;
+        double fullEnergy = 0.0;
+        double bandedEnergy = 0.0;
+        size_t numDiffering = 0;
+        size_t numBand = 0;
+        for (unsigned i = 0; i < images.size(); i++) {
+            double startTime = crfWallTime();
+            const cv::Mat &labels = crf.infer(images[i], unaries[i], lambda0, crfBackend);
+            fullTime += crfWallTime() - startTime;
+
+            startTime = crfWallTime();
+            const cv::Mat &bandedLabels = bandedCRF.inferBanded(images[i], unaries[i], lambda0,
+                coarseFactor, bandWidth);
+            bandedTime += crfWallTime() - startTime;
+            numBand += bandedCRF.bandSize();
+
+            fullEnergy += crfEnergy(unaries[i], crf.contrast(), lambda0, labels, neighbourhood);
+            bandedEnergy += crfEnergy(unaries[i], crf.contrast(), lambda0, bandedLabels, neighbourhood);
+            for (int y = 0; y < labels.rows; y++) {
+                for (int x = 0; x < labels.cols; x++) {
+                    if (labels.at<short>(y, x) != bandedLabels.at<short>(y, x))
+                        numDiffering += 1;
+                }
+            }
+        }
+        DRWN_LOG_MESSAGE(crfBackendName << ": " << 1000.0 * fullTime / images.size() << "ms per image");
+        DRWN_LOG_MESSAGE("coarse-to-fine: " << 1000.0 * bandedTime / images.size() << "ms per image, "
+            << "energy gap " << 100.0 * (bandedEnergy - fullEnergy) / fullEnergy << "%, "
+            << 100.0 * numDiffering / numPixels << "% of pixels differ, full resolution graph "
+            << (double)numPixels / std::max(numBand, (size_t)1) << " times smaller");
+    } else if (superpixelSize > 0) {
+        CRFContext regionCRF;
+        regionCRF.setNeighbourhood(neighbourhood);
+        double fullTime = 0.0;
+        double regionTime = 0.0;
+        double fullEnergy = 0.0;
+        double regionEnergy = 0.0;
+        size_t numDiffering = 0;
+        size_t numRegions = 0;
+        for (unsigned i = 0; i < images.size(); i++) {
+            double startTime = crfWallTime();
+            const cv::Mat &labels = crf.infer(images[i], unaries[i], lambda0, crfBackend);
+            fullTime += crfWallTime() - startTime;
+
+            startTime = crfWallTime();
+            const cv::Mat &regionLabels = regionCRF.inferSuperpixels(images[i], unaries[i], lambda0,
+                superpixelSize);
+            regionTime += crfWallTime() - startTime;
+            numRegions += regionCRF.regionCount();
+
+            fullEnergy += crfEnergy(unaries[i], crf.contrast(), lambda0, labels, neighbourhood);
+            regionEnergy += crfEnergy(unaries[i], crf.contrast(), lambda0, regionLabels, neighbourhood);
+            for (int y = 0; y < labels.rows; y++) {
+                for (int x = 0; x < labels.cols; x++) {
+                    if (labels.at<short>(y, x) != regionLabels.at<short>(y, x))
+                        numDiffering += 1;
+                }
+            }
+        }
+        DRWN_LOG_MESSAGE(crfBackendName << ": " << 1000.0 * fullTime / images.size() << "ms per image");
+        DRWN_LOG_MESSAGE("superpixels: " << 1000.0 * regionTime / images.size() << "ms per image, "
+            << "energy gap " << 100.0 * (regionEnergy - fullEnergy) / fullEnergy << "%, "
+            << 100.0 * numDiffering / numPixels << "% of pixels differ, graph "
+            << (double)numPixels / std::max(numRegions, (size_t)1) << " times smaller");
+    } else if (!bScaling) {
+        const double startTime = crfWallTime();
+        for (unsigned i = 0; i < images.size(); i++) {
+            crf.infer(images[i], unaries[i], lambda0, crfBackend);
+        }
+        const double totalTime = crfWallTime() - startTime;
+        DRWN_LOG_MESSAGE(crfBackendName << ": " << 1000.0 * totalTime / images.size() << "ms per image, "
+            << 1.0e9 * totalTime / numPixels << "ns per pixel");
+    } else {
+        // reference labels from a single thread
+        const unsigned savedMaxThreads = drwnThreadPool::MAX_THREADS;
+        const unsigned maxThreads = std::max(savedMaxThreads, 1u);
+        vector<cv::Mat> reference(images.size());
+        double baseTime = 0.0;
+
+        DRWN_LOG_MESSAGE("threads    ms/image     speedup   differing pixels");
+        for (unsigned nThreads = 1; ; nThreads = std::min(2 * nThreads, maxThreads)) {
+            drwnThreadPool::MAX_THREADS = nThreads;
+            size_t numDiffering = 0;
+            const double startTime = crfWallTime();
+            for (unsigned i = 0; i < images.size(); i++) {
+                const cv::Mat &labels = crf.infer(images[i], unaries[i], lambda0, CRF_PARALLEL);
+                if (nThreads == 1) {
+                    labels.copyTo(reference[i]);
+                } else {
+                    for (int y = 0; y < labels.rows; y++) {
+                        for (int x = 0; x < labels.cols; x++) {
+                            if (labels.at<short>(y, x) != reference[i].at<short>(y, x))
+                                numDiffering += 1;
+                        }
+                    }
+                }
+            }
+            const double totalTime = crfWallTime() - startTime;
+            if (nThreads == 1) baseTime = totalTime;
+
+            DRWN_LOG_MESSAGE(setw(7) << nThreads << setw(12) << fixed << setprecision(1)
+                << 1000.0 * totalTime / images.size() << setw(12) << setprecision(2)
+                << baseTime / totalTime << setw(19) << numDiffering);
+
+            if (nThreads == maxThreads) break;
+        }
+        drwnThreadPool::MAX_THREADS = savedMaxThreads;
+    }
+
+    drwnCodeProfiler::print();
+    return 0;
+}
@@ -0,0 +1,369 @@
+/*****************************************************************************
+** DARWIN: A FRAMEWORK FOR MACHINE LEARNING RESEARCH AND DEVELOPMENT
+** Distributed under the terms of the BSD license (see the LICENSE file)
+** Copyright (c) 2007-2013, Stephen Gould
+** All rights reserved.
+**
+******************************************************************************
+** FILENAME:    datasetPack.h
+** AUTHOR(S):
+**              Jimmy Lin <u5223173@anu.edu.au>
+**              Chris Claoue-Long <u5183532@anu.edu.au>
+**
+** A whole dataset in one file, as written by packDataset: for every image
+** its name, the image itself (the JPEG bytes or the decoded BGR pixels),
+** its feature maps (the contents of a .fmap file) and its ground truth
+** rectangle. The payloads are followed by an index of fixed-size records,
+** so that a reader maps the file once and reaches every record without
+** opening or seeking any other file.
+**
+*****************************************************************************/
+
+#pragma once
+
+// c++ standard headers
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <map>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// opencv library headers
+#include "cv.h"
+#include "cxcore.h"
+#include "highgui.h"
+
+// darwin library headers
+#include "drwnBase.h"
+
+#include "featureMapStore.h"
+
+using namespace std;
+
+// file layout ---------------------------------------------------------------
+
+static const char DATASET_PACK_MAGIC[4] = {'S', 'D', 'P', 'K'};
+static const uint32_t DATASET_PACK_VERSION = 1;
+static const uint32_t DATASET_PACK_BYTE_ORDER = 0x01020304;
+static const int DATASET_PACK_NAME_LENGTH = 64;
+
+typedef enum {
+    PACK_IMAGE_NONE = 0,
+    PACK_IMAGE_ENCODED = 1,     // the bytes of the image file
+    PACK_IMAGE_BGR = 2          // decoded CV_8UC3 rows
+} DatasetImageFormat;
+
+struct DatasetPackHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t byteOrder;         // DATASET_PACK_BYTE_ORDER as written
+    uint32_t nRecords;
+    uint64_t indexOffset;       // of DatasetPackRecord[nRecords]
+    uint64_t fileSize;
+};
+
+struct DatasetPackRecord {
+    char name[DATASET_PACK_NAME_LENGTH]; // base name, without ".jpg"
+    int32_t width;
+    int32_t height;
+    int32_t imageFormat;        // DatasetImageFormat
+    int32_t hasBox;
+    int32_t box[4];             // left, top, right, bottom
+    uint64_t imageOffset;
+    uint64_t imageBytes;
+    uint64_t featureOffset;     // .fmap contents, if featureBytes > 0
+    uint64_t featureBytes;
+};
+
+// DatasetPackWriter ---------------------------------------------------------
+// Appends records to a new pack file; the index is written by close().
+
+class DatasetPackWriter {
+ protected:
+    FILE *_file;
+    uint64_t _offset;
+    vector<DatasetPackRecord> _records;
+
+ public:
+    DatasetPackWriter() : _file(NULL), _offset(0) { }
+    ~DatasetPackWriter() { if (_file != NULL) fclose(_file); }
+
+    bool open(const char *filename);
+    // returns false if the file could not be completed
+    bool close();
+
+    // Adds an image. The image payload is image bytes in the given format,
+    // the features the contents of a .fmap file and box the ground truth
+    // rectangle; any of them may be empty or NULL.
+    bool add(const string &baseName, int width, int height, DatasetImageFormat format,
+        const vector<unsigned char> &image, const vector<unsigned char> &features,
+        const vector<int> *box);
+
+    unsigned size() const { return (unsigned)_records.size(); }
+
+ protected:
+    bool append(const vector<unsigned char> &data, uint64_t &offset);
+};
+
+// DatasetPack ---------------------------------------------------------------
+// A pack mapped read-only into memory. The accessors copy or decode from
+// the mapping and may be called from several threads at once.
+
+class DatasetPack {
+ protected:
+    void *_data;
+    size_t _size;
+    const DatasetPackHeader *_header;
+    const DatasetPackRecord *_records;
+    map<string, unsigned> _index;
+
+ public:
+    DatasetPack() : _data(NULL), _size(0), _header(NULL), _records(NULL) { }
+    ~DatasetPack() { close(); }
+
+    // maps the file and checks its header and index
+    bool open(const char *filename);
+    void close();
+    bool isOpen() const { return _data != NULL; }
+
+    unsigned size() const { return (_header == NULL) ? 0 : _header->nRecords; }
+    const DatasetPackRecord &record(unsigned i) const { return _records[i]; }
+    string name(unsigned i) const { return string(_records[i].name); }
+    // index of the image with the given base name, or -1
+    int find(const string &baseName) const;
+
+    // the base names in pack order, and the ground truth rectangles keyed
+    // by file name as parseLabel returns them
+    vector<string> baseNames() const;
+    map<string, vector<int> > labels() const;
+    bool hasBox(unsigned i) const { return _records[i].hasBox != 0; }
+
+    // the decoded image, or an empty matrix if the pack has none
+    cv::Mat image(unsigned i) const;
+    // the feature maps packed as by loadFeatureMaps
+    cv::Mat features(unsigned i) const;
+    // as above, but returns false instead of failing if they are not valid
+    bool readFeatures(unsigned i, cv::Mat &features) const;
+    bool hasFeatures(unsigned i) const { return _records[i].featureBytes > 0; }
+};
+
+// DatasetPackWriter implementation ------------------------------------------
+
+bool DatasetPackWriter::open(const char *filename)
+{
+    _records.clear();
+    _file = fopen(filename, "wb");
+    if (_file == NULL) return false;
+
+    // the header is rewritten once the index is known
+    DatasetPackHeader header;
+    memset(&header, 0, sizeof(header));
+    _offset = sizeof(DatasetPackHeader);
+    return fwrite(&header, sizeof(header), 1, _file) == 1;
+}
+
+bool DatasetPackWriter::append(const vector<unsigned char> &data, uint64_t &offset)
+{
+    // payloads start 8-byte aligned
+    static const char padding[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+    const size_t nPadding = (size_t)((8 - _offset % 8) % 8);
+    if ((nPadding > 0) && (fwrite(padding, 1, nPadding, _file) != nPadding)) return false;
+    _offset += nPadding;
+
+    offset = _offset;
+    if (!data.empty() && (fwrite(&data[0], 1, data.size(), _file) != data.size())) return false;
+    _offset += data.size();
+    return true;
+}
+
+bool DatasetPackWriter::add(const string &baseName, int width, int height, DatasetImageFormat format,
+    const vector<unsigned char> &image, const vector<unsigned char> &features,
+    const vector<int> *box)
+{
+    DRWN_ASSERT_MSG(_file != NULL, "dataset pack is not open");
+    DRWN_ASSERT_MSG(baseName.size() < (size_t)DATASET_PACK_NAME_LENGTH,
+        "image name " << baseName << " is too long for a dataset pack");
+
+    DatasetPackRecord r;
+    memset(&r, 0, sizeof(r));
+    strncpy(r.name, baseName.c_str(), DATASET_PACK_NAME_LENGTH - 1);
+    r.width = width;
+    r.height = height;
+    r.imageFormat = image.empty() ? PACK_IMAGE_NONE : format;
+    r.hasBox = (box != NULL) ? 1 : 0;
+    for (int k = 0; (box != NULL) && (k < 4); k++) {
+        r.box[k] = (*box)[k];
+    }
+    r.imageBytes = image.size();
+    r.featureBytes = features.size();
+    if (!append(image, r.imageOffset) || !append(features, r.featureOffset)) {
+        return false;
+    }
+
+    _records.push_back(r);
+    return true;
+}
+
+bool DatasetPackWriter::close()
+{
+    if (_file == NULL) return false;
+    DatasetPackHeader header;
+    memcpy(header.magic, DATASET_PACK_MAGIC, 4);
+    header.version = DATASET_PACK_VERSION;
+    header.byteOrder = DATASET_PACK_BYTE_ORDER;
+    header.nRecords = (uint32_t)_records.size();
+
+    vector<unsigned char> index(_records.size() * sizeof(DatasetPackRecord));
+    if (!index.empty()) {
+        memcpy(&index[0], &_records[0], index.size());
+    }
+    bool bWritten = append(index, header.indexOffset);
+    header.fileSize = _offset;
+    bWritten = bWritten && (fseek(_file, 0, SEEK_SET) == 0) &&
+        (fwrite(&header, sizeof(header), 1, _file) == 1);
+    bWritten = (fclose(_file) == 0) && bWritten;
+    _file = NULL;
+    return bWritten;
+}
+
+// DatasetPack implementation ------------------------------------------------
+
+bool DatasetPack::open(const char *filename)
+{
+    close();
+    const int fd = ::open(filename, O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if ((fstat(fd, &st) != 0) || ((size_t)st.st_size < sizeof(DatasetPackHeader))) {
+        ::close(fd);
+        DRWN_LOG_ERROR(filename << " is not a dataset pack");
+        return false;
+    }
+    _size = (size_t)st.st_size;
+    _data = mmap(NULL, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (_data == MAP_FAILED) {
+        _data = NULL;
+        _size = 0;
+        return false;
+    }
+    // the applications read the records in order
+    madvise(_data, _size, MADV_SEQUENTIAL);
+
+    _header = (const DatasetPackHeader *)_data;
+    if ((memcmp(_header->magic, DATASET_PACK_MAGIC, 4) != 0) ||
+        (_header->byteOrder != DATASET_PACK_BYTE_ORDER) || (_header->fileSize != _size)) {
+        DRWN_LOG_ERROR(filename << " is not a dataset pack or was written on another platform");
+        close();
+        return false;
+    }
+    if (_header->version != DATASET_PACK_VERSION) {
+        DRWN_LOG_ERROR(filename << " is a version " << _header->version
+            << " dataset pack; version " << DATASET_PACK_VERSION << " is supported");
+        close();
+        return false;
+    }
+    if ((_header->indexOffset % 8 != 0) || (_header->indexOffset > _size) ||
+        (_header->nRecords > (_size - _header->indexOffset) / sizeof(DatasetPackRecord))) {
+        DRWN_LOG_ERROR(filename << " has a corrupt index");
+        close();
+        return false;
+    }
+
+    _records = (const DatasetPackRecord *)((const char *)_data + _header->indexOffset);
+    for (uint32_t i = 0; i < _header->nRecords; i++) {
+        const DatasetPackRecord &r = _records[i];
+        if ((r.imageOffset > _size) || (r.imageBytes > _size - r.imageOffset) ||
+            (r.featureOffset > _size) || (r.featureBytes > _size - r.featureOffset) ||
+            (r.name[DATASET_PACK_NAME_LENGTH - 1] != '\0') ||
+            ((r.imageFormat == PACK_IMAGE_BGR) && (r.imageBytes != 3 * (uint64_t)r.width * r.height))) {
+            DRWN_LOG_ERROR(filename << " has a corrupt index");
+            close();
+            return false;
+        }
+        _index[string(r.name)] = i;
+    }
+    return true;
+}
+
+void DatasetPack::close()
+{
+    if (_data != NULL) {
+        munmap(_data, _size);
+    }
+    _data = NULL;
+    _size = 0;
+    _header = NULL;
+    _records = NULL;
+    _index.clear();
+}
+
+int DatasetPack::find(const string &baseName) const
+{
+    map<string, unsigned>::const_iterator it = _index.find(baseName);
+    return (it == _index.end()) ? -1 : (int)it->second;
+}
+
+vector<string> DatasetPack::baseNames() const
+{
+    vector<string> names(size());
+    for (unsigned i = 0; i < names.size(); i++) {
+        names[i] = name(i);
+    }
+    return names;
+}
+
+map<string, vector<int> > DatasetPack::labels() const
+{
+    map<string, vector<int> > fileLabelPairs;
+    for (unsigned i = 0; i < size(); i++) {
+        if (_records[i].hasBox) {
+            fileLabelPairs[name(i) + ".jpg"] = vector<int>(_records[i].box, _records[i].box + 4);
+        }
+    }
+    return fileLabelPairs;
+}
+
+cv::Mat DatasetPack::image(unsigned i) const
+{
+    const DatasetPackRecord &r = _records[i];
+    const unsigned char *data = (const unsigned char *)_data + r.imageOffset;
+    if (r.imageFormat == PACK_IMAGE_BGR) {
+        cv::Mat img(r.height, r.width, CV_8UC3);
+        for (int y = 0; y < r.height; y++) {
+            memcpy(img.ptr<unsigned char>(y), data + 3 * (size_t)y * r.width, 3 * (size_t)r.width);
+        }
+        return img;
+    }
+    if (r.imageFormat == PACK_IMAGE_ENCODED) {
+        const cv::Mat buffer(1, (int)r.imageBytes, CV_8UC1, (void *)data);
+        return cv::imdecode(buffer, 1);
+    }
+    return cv::Mat();
+}
+
+cv::Mat DatasetPack::features(unsigned i) const
+{
+    cv::Mat features;
+    DRWN_ASSERT_MSG(readFeatures(i, features), "dataset pack has no valid feature maps for "
+        << _records[i].name);
+    return features;
+}
+
+bool DatasetPack::readFeatures(unsigned i, cv::Mat &features) const
+{
+    const DatasetPackRecord &r = _records[i];
+    FeatureMapFile file;
+    if (!file.parse((const unsigned char *)_data + r.featureOffset, (size_t)r.featureBytes, r.name) ||
+        !file.complete()) {
+        return false;
+    }
+    features = file.packed();
+    return true;
+}
@@ -0,0 +1,600 @@
+/*****************************************************************************
+** DARWIN: A FRAMEWORK FOR MACHINE LEARNING RESEARCH AND DEVELOPMENT
+** Distributed under the terms of the BSD license (see the LICENSE file)
+** Copyright (c) 2007-2013, Stephen Gould
+** All rights reserved.
+**
+******************************************************************************
+** FILENAME:    denseCRF.h
+** AUTHOR(S):
+**              Jimmy Lin <u5223173@anu.edu.au>
+**              Chris Claoue-Long <u5183532@anu.edu.au>
+**
+** Fully connected CRF with Gaussian edge potentials (Kraehenbuehl and Koltun,
+** 2011). Every pair of pixels is joined by a Potts term weighted by an
+** appearance kernel over position and colour plus a smoothness kernel over
+** position. Mean-field inference evaluates the message passing step as
+** Gaussian filtering on a permutohedral lattice (Adams et al., 2010), which
+** is linear in the number of pixels. Splatting, blurring and slicing are
+** written as gathers so that every stage runs on several threads without
+** locking, and the result does not depend on the number of threads.
+**
+*****************************************************************************/
+
+#pragma once
+
+// c++ standard headers
+#include <cstdlib>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include <limits>
+
+// opencv library headers
+#include "cv.h"
+#include "cxcore.h"
+
+// darwin library headers
+#include "drwnBase.h"
+
+using namespace std;
+
+// DenseCRFParameters ---------------------------------------------------------
+
+struct DenseCRFParameters {
+    int nIterations;            // mean-field iterations
+    double bilateralXY;         // spatial std. dev. of the appearance kernel (pixels)
+    double bilateralRGB;        // colour std. dev. of the appearance kernel
+    double gaussianXY;          // std. dev. of the smoothness kernel (pixels)
+    double gaussianWeight;      // smoothness kernel weight relative to lambda
+
+    DenseCRFParameters() : nIterations(5), bilateralXY(60.0), bilateralRGB(20.0),
+        gaussianXY(3.0), gaussianWeight(0.5) { }
+};
+
+// denseParallelFor -----------------------------------------------------------
+// calls fcn(begin, end) on nThreads contiguous ranges covering [0, n) on
+// threadPool; small ranges, or a NULL pool, run on the calling thread
+
+template <class Fcn>
+class DenseRangeJob : public drwnThreadJob {
+ public:
+    Fcn *fcn;
+    int begin, end;
+
+    DenseRangeJob() : fcn(NULL), begin(0), end(0) { }
+    void operator()() { (*fcn)(begin, end); }
+};
+
+template <class Fcn>
+void denseParallelFor(int n, drwnThreadPool *threadPool, unsigned nThreads, Fcn &fcn)
+{
+    if ((threadPool == NULL) || (nThreads < 2) || (n < 4096)) {
+        fcn(0, n);
+        return;
+    }
+
+    vector<DenseRangeJob<Fcn> > jobs(nThreads);
+    threadPool->start();
+    for (unsigned t = 0; t < nThreads; t++) {
+        jobs[t].fcn = &fcn;
+        jobs[t].begin = (int)(((long long)n * t) / nThreads);
+        jobs[t].end = (int)(((long long)n * (t + 1)) / nThreads);
+        threadPool->addJob(&jobs[t]);
+    }
+    threadPool->finish();
+}
+
+// The pool given, or else one of nThreads threads kept for the lifetime of
+// this object, so that a whole initialize() or inference() call shares one.
+class DenseThreadPool {
+ protected:
+    drwnThreadPool *_pool;
+    drwnThreadPool *_ownPool;
+
+ public:
+    DenseThreadPool(drwnThreadPool *threadPool, unsigned nThreads) :
+        _pool(threadPool), _ownPool(NULL) {
+        if ((_pool == NULL) && (nThreads > 1)) {
+            _pool = _ownPool = new drwnThreadPool(nThreads);
+        }
+    }
+    ~DenseThreadPool() { if (_ownPool != NULL) delete _ownPool; }
+
+    drwnThreadPool *get() const { return _pool; }
+};
+
+// PermutohedralLattice -------------------------------------------------------
+
+class PermutohedralLattice {
+ protected:
+    int _d;                     // feature dimension
+    int _nPoints;               // number of input points
+    int _nVertices;             // number of lattice vertices
+    vector<int> _offset;        // (d + 1) enclosing vertices of each point
+    vector<float> _barycentric; // and their barycentric weights
+    vector<int> _vertexStart;   // points splatting to each vertex (CSR)
+    vector<int> _vertexEntries; // entries of _offset, by vertex
+    vector<int> _blurNeighbours; // two neighbours per vertex and direction, or -1
+
+    // hash table from vertex keys (d coordinates) to vertex index
+    vector<short> _keys;
+    vector<int> _table;
+
+    // filtering buffers
+    vector<float> _values;
+    vector<float> _blurred;
+
+    struct SplatFcn {
+        PermutohedralLattice *lattice;
+        const float *in;
+        int vs;
+        void operator()(int begin, int end);
+    };
+    struct BlurFcn {
+        PermutohedralLattice *lattice;
+        int direction;
+        int vs;
+        void operator()(int begin, int end);
+    };
+    struct SliceFcn {
+        const PermutohedralLattice *lattice;
+        float *out;
+        int vs;
+        void operator()(int begin, int end);
+    };
+
+ public:
+    PermutohedralLattice() : _d(0), _nPoints(0), _nVertices(0) { }
+
+    // Builds the lattice for nPoints points with d features each, stored
+    // row-major in features. Features should already be divided by the
+    // kernel standard deviations.
+    void initialize(const vector<float> &features, int d, int nPoints);
+
+    int numVertices() const { return _nVertices; }
+
+    // out = K in, where K is the Gaussian kernel (approximately) and in and
+    // out hold vs values per point, computed by nThreads jobs on threadPool
+    void compute(const float *in, float *out, int vs, drwnThreadPool *threadPool,
+        unsigned nThreads);
+
+ protected:
+    int findVertex(const short *key, bool bCreate);
+    void growTable();
+};
+
+// DenseCRF -------------------------------------------------------------------
+
+class DenseCRF {
+ protected:
+    int _width;
+    int _height;
+    PermutohedralLattice _bilateral;
+    PermutohedralLattice _gaussian;
+    vector<float> _bilateralNorm;   // 1 / (K 1) of each pixel
+    vector<float> _gaussianNorm;
+
+    vector<float> _unary;           // per pixel, label-major
+    vector<float> _q;               // marginals
+    vector<float> _bilateralMessage;
+    vector<float> _gaussianMessage;
+
+    struct UpdateFcn {
+        DenseCRF *crf;
+        int nLabels;
+        float bilateralWeight;
+        float gaussianWeight;
+        void operator()(int begin, int end);
+    };
+
+ public:
+    DenseCRF() : _width(0), _height(0) { }
+
+    // Builds the kernels of a CV_8UC3 image. Both calls use nThreads
+    // threads of threadPool, or of a pool of their own if it is NULL.
+    void initialize(const cv::Mat &img, const DenseCRFParameters &params, unsigned nThreads = 1,
+        drwnThreadPool *threadPool = NULL);
+
+    // Runs mean-field inference with H-by-W CV_64F unary energies (one plane
+    // per label) and Potts terms of weight lambda (appearance kernel) and
+    // lambda * gaussianWeight (smoothness kernel). Kernels are normalized so
+    // that each pixel's messages sum to at most one. Writes the label of
+    // maximum marginal to the CV_16S labels.
+    void inference(const vector<cv::Mat> &unary, double lambda,
+        const DenseCRFParameters &params, cv::Mat &labels, unsigned nThreads = 1,
+        drwnThreadPool *threadPool = NULL);
+
+ protected:
+    static void softmax(const float *energy, float *q, int nLabels);
+};
+
+// PermutohedralLattice implementation ----------------------------------------
+
+void PermutohedralLattice::initialize(const vector<float> &features, int d, int nPoints)
+{
+    DRWN_FCN_TIC;
+    DRWN_ASSERT_MSG((d > 0) && ((int)features.size() == d * nPoints), "invalid lattice features");
+
+    _d = d;
+    _nPoints = nPoints;
+    _nVertices = 0;
+    _keys.clear();
+    _table.assign(2 * 1024, -1);
+    _offset.resize(nPoints * (d + 1));
+    _barycentric.resize(nPoints * (d + 1));
+
+    // canonical simplex and scaling of the elevated features
+    vector<int> canonical((d + 1) * (d + 1));
+    for (int i = 0; i <= d; i++) {
+        for (int j = 0; j <= d - i; j++) {
+            canonical[i * (d + 1) + j] = i;
+        }
+        for (int j = d - i + 1; j <= d; j++) {
+            canonical[i * (d + 1) + j] = i - (d + 1);
+        }
+    }
+    vector<float> scale(d);
+    for (int i = 0; i < d; i++) {
+        scale[i] = (float)((d + 1) * sqrt(2.0 / 3.0) / sqrt((double)(i + 1) * (i + 2)));
+    }
+
+    vector<float> elevated(d + 1);
+    vector<int> rem0(d + 1);
+    vector<int> rank(d + 1);
+    vector<float> barycentric(d + 2);
+    vector<short> key(d);
+    const float downFactor = 1.0f / (d + 1);
+
+    for (int k = 0; k < nPoints; k++) {
+        const float *f = &features[k * d];
+
+        // elevate onto the hyperplane
+        float sm = 0.0f;
+        for (int j = d; j > 0; j--) {
+            const float cf = f[j - 1] * scale[j - 1];
+            elevated[j] = sm - j * cf;
+            sm += cf;
+        }
+        elevated[0] = sm;
+
+        // closest remainder-0 point
+        int sum = 0;
+        for (int i = 0; i <= d; i++) {
+            const float v = downFactor * elevated[i];
+            const int up = (int)ceil(v) * (d + 1);
+            const int down = (int)floor(v) * (d + 1);
+            rem0[i] = (up - elevated[i] < elevated[i] - down) ? up : down;
+            sum += rem0[i];
+        }
+        sum /= d + 1;
+
+        // rank the differential to find the enclosing simplex
+        std::fill(rank.begin(), rank.end(), 0);
+        for (int i = 0; i < d; i++) {
+            const float di = elevated[i] - rem0[i];
+            for (int j = i + 1; j <= d; j++) {
+                if (di < elevated[j] - rem0[j]) {
+                    rank[i] += 1;
+                } else {
+                    rank[j] += 1;
+                }
+            }
+        }
+        for (int i = 0; i <= d; i++) {
+            rank[i] += sum;
+            if (rank[i] < 0) {
+                rank[i] += d + 1;
+                rem0[i] += d + 1;
+            } else if (rank[i] > d) {
+                rank[i] -= d + 1;
+                rem0[i] -= d + 1;
+            }
+        }
+
+        // barycentric coordinates
+        std::fill(barycentric.begin(), barycentric.end(), 0.0f);
+        for (int i = 0; i <= d; i++) {
+            const float v = (elevated[i] - rem0[i]) * downFactor;
+            barycentric[d - rank[i]] += v;
+            barycentric[d - rank[i] + 1] -= v;
+        }
+        barycentric[0] += 1.0f + barycentric[d + 1];
+
+        // enclosing vertices
+        for (int r = 0; r <= d; r++) {
+            for (int i = 0; i < d; i++) {
+                key[i] = (short)(rem0[i] + canonical[r * (d + 1) + rank[i]]);
+            }
+            _offset[k * (d + 1) + r] = findVertex(&key[0], true);
+            _barycentric[k * (d + 1) + r] = barycentric[r];
+        }
+    }
+
+    // invert the point-to-vertex map so that splatting is a gather
+    _vertexStart.assign(_nVertices + 1, 0);
+    for (size_t e = 0; e < _offset.size(); e++) {
+        _vertexStart[_offset[e] + 1] += 1;
+    }
+    for (int v = 0; v < _nVertices; v++) {
+        _vertexStart[v + 1] += _vertexStart[v];
+    }
+    _vertexEntries.resize(_offset.size());
+    vector<int> fill(_vertexStart.begin(), _vertexStart.end() - 1);
+    for (size_t e = 0; e < _offset.size(); e++) {
+        _vertexEntries[fill[_offset[e]]++] = (int)e;
+    }
+
+    // neighbours along each lattice direction
+    _blurNeighbours.resize(2 * (d + 1) * _nVertices);
+    vector<short> n1(d), n2(d);
+    for (int j = 0; j <= d; j++) {
+        for (int v = 0; v < _nVertices; v++) {
+            const short *k = &_keys[v * d];
+            for (int i = 0; i < d; i++) {
+                n1[i] = k[i] - 1;
+                n2[i] = k[i] + 1;
+            }
+            if (j < d) {
+                n1[j] = k[j] + d;
+                n2[j] = k[j] - d;
+            }
+            _blurNeighbours[2 * (j * _nVertices + v)] = findVertex(&n1[0], false);
+            _blurNeighbours[2 * (j * _nVertices + v) + 1] = findVertex(&n2[0], false);
+        }
+    }
+
+    DRWN_LOG_DEBUG("...permutohedral lattice has " << _nVertices << " vertices for "
+        << nPoints << " points");
+    DRWN_FCN_TOC;
+}
+
+int PermutohedralLattice::findVertex(const short *key, bool bCreate)
+{
+    size_t h = 0;
+    for (int i = 0; i < _d; i++) {
+        h = (h + (unsigned short)key[i]) * 2531011;
+    }
+
+    const size_t mask = _table.size() - 1;
+    for (size_t i = h & mask; ; i = (i + 1) & mask) {
+        const int v = _table[i];
+        if (v < 0) {
+            if (!bCreate) return -1;
+            _keys.insert(_keys.end(), key, key + _d);
+            _table[i] = _nVertices++;
+            if (2 * _nVertices > (int)_table.size()) {
+                growTable();
+            }
+            return _nVertices - 1;
+        }
+        if (std::equal(key, key + _d, &_keys[v * _d])) {
+            return v;
+        }
+    }
+}
+
+void PermutohedralLattice::growTable()
+{
+    _table.assign(2 * _table.size(), -1);
+    const size_t mask = _table.size() - 1;
+    for (int v = 0; v < _nVertices; v++) {
+        size_t h = 0;
+        for (int i = 0; i < _d; i++) {
+            h = (h + (unsigned short)_keys[v * _d + i]) * 2531011;
+        }
+        size_t i = h & mask;
+        while (_table[i] >= 0) {
+            i = (i + 1) & mask;
+        }
+        _table[i] = v;
+    }
+}
+
+void PermutohedralLattice::SplatFcn::operator()(int begin, int end)
+{
+    const int d1 = lattice->_d + 1;
+    for (int v = begin; v < end; v++) {
+        float *value = &lattice->_values[v * vs];
+        std::fill(value, value + vs, 0.0f);
+        for (int i = lattice->_vertexStart[v]; i < lattice->_vertexStart[v + 1]; i++) {
+            const int e = lattice->_vertexEntries[i];
+            const float w = lattice->_barycentric[e];
+            const float *p = in + (e / d1) * vs;
+            for (int c = 0; c < vs; c++) {
+                value[c] += w * p[c];
+            }
+        }
+    }
+}
+
+void PermutohedralLattice::BlurFcn::operator()(int begin, int end)
+{
+    const int nVertices = lattice->_nVertices;
+    const float *values = &lattice->_values[0];
+    float *blurred = &lattice->_blurred[0];
+    for (int v = begin; v < end; v++) {
+        const int n1 = lattice->_blurNeighbours[2 * (direction * nVertices + v)];
+        const int n2 = lattice->_blurNeighbours[2 * (direction * nVertices + v) + 1];
+        for (int c = 0; c < vs; c++) {
+            float b = values[v * vs + c];
+            if (n1 >= 0) b += 0.5f * values[n1 * vs + c];
+            if (n2 >= 0) b += 0.5f * values[n2 * vs + c];
+            blurred[v * vs + c] = b;
+        }
+    }
+}
+
+void PermutohedralLattice::SliceFcn::operator()(int begin, int end)
+{
+    const int d1 = lattice->_d + 1;
+    const float alpha = 1.0f / (1.0f + powf(2.0f, -(float)lattice->_d));
+    for (int k = begin; k < end; k++) {
+        float *o = out + k * vs;
+        std::fill(o, o + vs, 0.0f);
+        for (int r = 0; r < d1; r++) {
+            const float w = alpha * lattice->_barycentric[k * d1 + r];
+            const float *value = &lattice->_values[lattice->_offset[k * d1 + r] * vs];
+            for (int c = 0; c < vs; c++) {
+                o[c] += w * value[c];
+            }
+        }
+    }
+}
+
+void PermutohedralLattice::compute(const float *in, float *out, int vs,
+    drwnThreadPool *threadPool, unsigned nThreads)
+{
+    _values.resize(_nVertices * vs);
+    _blurred.resize(_nVertices * vs);
+
+    SplatFcn splat = {this, in, vs};
+    denseParallelFor(_nVertices, threadPool, nThreads, splat);
+
+    for (int j = 0; j <= _d; j++) {
+        BlurFcn blur = {this, j, vs};
+        denseParallelFor(_nVertices, threadPool, nThreads, blur);
+        _values.swap(_blurred);
+    }
+
+    SliceFcn slice = {this, out, vs};
+    denseParallelFor(_nPoints, threadPool, nThreads, slice);
+}
+
+// DenseCRF implementation ----------------------------------------------------
+
+void DenseCRF::initialize(const cv::Mat &img, const DenseCRFParameters &params, unsigned nThreads,
+    drwnThreadPool *threadPool)
+{
+    DRWN_FCN_TIC;
+    DRWN_ASSERT_MSG(img.type() == CV_8UC3, "dense CRF needs an 8-bit colour image");
+
+    _width = img.cols;
+    _height = img.rows;
+    const int N = _width * _height;
+
+    // appearance kernel over (x, y, b, g, r) and smoothness kernel over (x, y)
+    vector<float> features(5 * N);
+    for (int y = 0; y < _height; y++) {
+        const unsigned char *p = img.ptr<unsigned char>(y);
+        for (int x = 0; x < _width; x++) {
+            float *f = &features[5 * (y * _width + x)];
+            f[0] = (float)(x / params.bilateralXY);
+            f[1] = (float)(y / params.bilateralXY);
+            f[2] = (float)(p[3 * x] / params.bilateralRGB);
+            f[3] = (float)(p[3 * x + 1] / params.bilateralRGB);
+            f[4] = (float)(p[3 * x + 2] / params.bilateralRGB);
+        }
+    }
+    _bilateral.initialize(features, 5, N);
+
+    features.resize(2 * N);
+    for (int y = 0; y < _height; y++) {
+        for (int x = 0; x < _width; x++) {
+            features[2 * (y * _width + x)] = (float)(x / params.gaussianXY);
+            features[2 * (y * _width + x) + 1] = (float)(y / params.gaussianXY);
+        }
+    }
+    _gaussian.initialize(features, 2, N);
+
+    // normalization by the filtered constant image
+    DenseThreadPool pool(threadPool, nThreads);
+    vector<float> ones(N, 1.0f);
+    _bilateralNorm.resize(N);
+    _gaussianNorm.resize(N);
+    _bilateral.compute(&ones[0], &_bilateralNorm[0], 1, pool.get(), nThreads);
+    _gaussian.compute(&ones[0], &_gaussianNorm[0], 1, pool.get(), nThreads);
+    for (int i = 0; i < N; i++) {
+        _bilateralNorm[i] = 1.0f / (_bilateralNorm[i] + 1.0e-20f);
+        _gaussianNorm[i] = 1.0f / (_gaussianNorm[i] + 1.0e-20f);
+    }
+
+    DRWN_FCN_TOC;
+}
+
+void DenseCRF::softmax(const float *energy, float *q, int nLabels)
+{
+    float minEnergy = energy[0];
+    for (int l = 1; l < nLabels; l++) {
+        minEnergy = std::min(minEnergy, energy[l]);
+    }
+    float total = 0.0f;
+    for (int l = 0; l < nLabels; l++) {
+        q[l] = expf(minEnergy - energy[l]);
+        total += q[l];
+    }
+    for (int l = 0; l < nLabels; l++) {
+        q[l] /= total;
+    }
+}
+
+void DenseCRF::UpdateFcn::operator()(int begin, int end)
+{
+    vector<float> energy(nLabels);
+    for (int i = begin; i < end; i++) {
+        const float nb = bilateralWeight * crf->_bilateralNorm[i];
+        const float ng = gaussianWeight * crf->_gaussianNorm[i];
+        for (int l = 0; l < nLabels; l++) {
+            energy[l] = crf->_unary[i * nLabels + l] -
+                nb * crf->_bilateralMessage[i * nLabels + l] -
+                ng * crf->_gaussianMessage[i * nLabels + l];
+        }
+        softmax(&energy[0], &crf->_q[i * nLabels], nLabels);
+    }
+}
+
+void DenseCRF::inference(const vector<cv::Mat> &unary, double lambda,
+    const DenseCRFParameters &params, cv::Mat &labels, unsigned nThreads,
+    drwnThreadPool *threadPool)
+{
+    DRWN_FCN_TIC;
+
+    const int L = (int)unary.size();
+    const int N = _width * _height;
+    for (int l = 0; l < L; l++) {
+        DRWN_ASSERT_MSG((unary[l].rows == _height) && (unary[l].cols == _width),
+            "unary potentials must match image size " << _height << "-by-" << _width);
+    }
+
+    // interleave the unary planes and initialize the marginals
+    _unary.resize(N * L);
+    _q.resize(N * L);
+    _bilateralMessage.resize(N * L);
+    _gaussianMessage.resize(N * L);
+    for (int y = 0; y < _height; y++) {
+        for (int l = 0; l < L; l++) {
+            const double *u = unary[l].ptr<double>(y);
+            for (int x = 0; x < _width; x++) {
+                _unary[(y * _width + x) * L + l] = (float)u[x];
+            }
+        }
+    }
+    for (int i = 0; i < N; i++) {
+        softmax(&_unary[i * L], &_q[i * L], L);
+    }
+
+    // mean-field updates, all on one thread pool
+    DenseThreadPool pool(threadPool, nThreads);
+    UpdateFcn update = {this, L, (float)lambda, (float)(lambda * params.gaussianWeight)};
+    for (int n = 0; n < params.nIterations; n++) {
+        _bilateral.compute(&_q[0], &_bilateralMessage[0], L, pool.get(), nThreads);
+        _gaussian.compute(&_q[0], &_gaussianMessage[0], L, pool.get(), nThreads);
+        denseParallelFor(N, pool.get(), nThreads, update);
+    }
+
+    // label of maximum marginal
+    labels.create(_height, _width, CV_16S);
+    for (int y = 0; y < _height; y++) {
+        short *lbl = labels.ptr<short>(y);
+        for (int x = 0; x < _width; x++) {
+            const float *q = &_q[(y * _width + x) * L];
+            int best = 0;
+            for (int l = 1; l < L; l++) {
+                if (q[l] > q[best]) best = l;
+            }
+            lbl[x] = (short)best;
+        }
+    }
+
+    DRWN_FCN_TOC;
+}
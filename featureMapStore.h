@@ -0,0 +1,404 @@
+/*****************************************************************************
+** DARWIN: A FRAMEWORK FOR MACHINE LEARNING RESEARCH AND DEVELOPMENT
+** Distributed under the terms of the BSD license (see the LICENSE file)
+** Copyright (c) 2007-2013, Stephen Gould
+** All rights reserved.
+**
+******************************************************************************
+** FILENAME:    featureMapStore.h
+** AUTHOR(S):
+**              Jimmy Lin <u5223173@anu.edu.au>
+**              Chris Claoue-Long <u5183532@anu.edu.au>
+**
+** Binary store of the feature maps of one image, in place of one 3-channel
+** JPEG per map. A .fmap file holds a header with the image size and the
+** feature parameters followed by single-channel planes of the MSC, CSH and
+** CSD maps, either as 8-bit values or as lossless-enough half precision
+** floats, and is read back with a single read. The maps are handed to the
+** applications packed into the channels of one image (MSC, CSH, CSD), as
+** CV_8UC3 for 8-bit planes and CV_32FC3 in [0, 1] for half floats.
+**
+*****************************************************************************/
+
+#pragma once
+
+// c++ standard headers
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// opencv library headers
+#include "cv.h"
+#include "cxcore.h"
+#include "highgui.h"
+
+// darwin library headers
+#include "drwnBase.h"
+
+#include "modelBundle.h"
+
+using namespace std;
+
+// file layout ---------------------------------------------------------------
+
+static const char FEATURE_MAP_MAGIC[4] = {'S', 'F', 'M', 'P'};
+static const uint32_t FEATURE_MAP_VERSION = 1;
+
+typedef enum {
+    FEATURE_MAP_UINT8 = 1,      // value * 255, truncated
+    FEATURE_MAP_FLOAT16 = 2     // IEEE half precision
+} FeatureMapType;
+
+typedef enum {
+    FEATURE_MSC = 0, FEATURE_CSH, FEATURE_CSD, FEATURE_NUM_MAPS
+} FeatureMapKind;
+
+// followed by the planes present, in FeatureMapKind order, each padded to
+// a multiple of 8 bytes
+struct FeatureMapHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t width;
+    uint32_t height;
+    uint32_t type;              // FeatureMapType of every plane
+    uint32_t planes;            // bit k set if map k is present
+    ModelFeatureConfig params;  // parameters the maps were computed with
+};
+
+// half precision conversion -------------------------------------------------
+
+inline uint16_t floatToHalf(float value)
+{
+    uint32_t f;
+    memcpy(&f, &value, sizeof(f));
+    const uint32_t sign = (f >> 16) & 0x8000;
+    const int exponent = (int)((f >> 23) & 0xff) - 127 + 15;
+    uint32_t mantissa = f & 0x7fffff;
+
+    if (exponent >= 31) {
+        // overflow to infinity, keeping NaN
+        return (uint16_t)(sign | 0x7c00 | ((((f >> 23) & 0xff) == 0xff) && mantissa ? 0x200 : 0));
+    }
+    if (exponent <= 0) {
+        // subnormal or zero, rounded to nearest even
+        if (exponent < -10) return (uint16_t)sign;
+        mantissa |= 0x800000;
+        const int shift = 14 - exponent;
+        uint32_t half = mantissa >> shift;
+        const uint32_t rest = mantissa & ((1u << shift) - 1);
+        const uint32_t midpoint = 1u << (shift - 1);
+        if ((rest > midpoint) || ((rest == midpoint) && (half & 1))) half += 1;
+        return (uint16_t)(sign | half);
+    }
+    uint32_t half = ((uint32_t)exponent << 10) | (mantissa >> 13);
+    const uint32_t rest = mantissa & 0x1fff;
+    if ((rest > 0x1000) || ((rest == 0x1000) && (half & 1))) half += 1;
+    return (uint16_t)(sign | half);
+}
+
+inline float halfToFloat(uint16_t value)
+{
+    const uint32_t sign = (uint32_t)(value & 0x8000) << 16;
+    const uint32_t exponent = (value >> 10) & 0x1f;
+    const uint32_t mantissa = value & 0x3ff;
+    uint32_t f;
+    if (exponent == 0) {
+        if (mantissa == 0) {
+            f = sign;
+        } else {
+            // subnormal: normalize
+            int e = -1;
+            uint32_t m = mantissa;
+            do {
+                e += 1;
+                m <<= 1;
+            } while ((m & 0x400) == 0);
+            f = sign | ((uint32_t)(127 - 15 - e) << 23) | ((m & 0x3ff) << 13);
+        }
+    } else if (exponent == 31) {
+        f = sign | 0x7f800000 | (mantissa << 13);
+    } else {
+        f = sign | ((exponent + 127 - 15) << 23) | (mantissa << 13);
+    }
+    float result;
+    memcpy(&result, &f, sizeof(result));
+    return result;
+}
+
+// FeatureMapFile ------------------------------------------------------------
+
+class FeatureMapFile {
+ protected:
+    FeatureMapHeader _header;
+    vector<unsigned char> _planes[FEATURE_NUM_MAPS];
+
+ public:
+    FeatureMapFile() { clear(); }
+
+    void clear();
+    // reads a whole file, returning false if it is missing or invalid
+    bool read(const char *filename);
+    bool write(const char *filename) const;
+    // the same from and to the contents of a file held in memory; source
+    // names them in error messages
+    bool parse(const unsigned char *data, size_t size, const char *source);
+    void serialize(vector<unsigned char> &buffer) const;
+
+    int width() const { return (int)_header.width; }
+    int height() const { return (int)_header.height; }
+    FeatureMapType type() const { return (FeatureMapType)_header.type; }
+    const ModelFeatureConfig &params() const { return _header.params; }
+    bool hasPlane(FeatureMapKind kind) const { return (_header.planes & (1u << kind)) != 0; }
+    bool complete() const { return _header.planes == (1u << FEATURE_NUM_MAPS) - 1; }
+
+    // Stores a CV_64F map with values in [0, 1], or a CV_8U map of 8-bit
+    // features. A map of another size or type than those already stored
+    // replaces them.
+    void setPlane(FeatureMapKind kind, const cv::Mat &map, FeatureMapType type);
+
+    // the three maps packed into CV_8UC3 or CV_32FC3, as described above
+    cv::Mat packed() const;
+
+ protected:
+    static size_t paddedSize(size_t bytes) { return (bytes + 7) & ~(size_t)7; }
+    size_t planeBytes() const {
+        return (size_t)_header.width * _header.height * ((_header.type == FEATURE_MAP_FLOAT16) ? 2 : 1);
+    }
+};
+
+// prototypes ----------------------------------------------------------------
+
+// Loads the packed feature maps of an image: from <fmapDir>/<baseName>.fmap
+// if fmapDir is not NULL, or else from the first channel of the JPEG maps
+// <mscDir>/<baseName>.jpg and so on, packed into a CV_8UC3 image.
+cv::Mat loadFeatureMaps(const char *fmapDir, const char *mscDir, const char *cshDir,
+    const char *csdDir, const string &baseName);
+// As above, but returns false with the reason in error instead of failing,
+// for callers on threads other than the main one.
+bool readFeatureMaps(const char *fmapDir, const char *mscDir, const char *cshDir,
+    const char *csdDir, const string &baseName, cv::Mat &features, string &error);
+
+// value of map k at (x, y) of packed feature maps, in [0, 1]
+inline float packedFeature(const cv::Mat &features, int y, int x, int k)
+{
+    return (features.depth() == CV_8U) ? features.ptr<cv::Vec3b>(y)[x].val[k] / 255.0f :
+        features.ptr<cv::Vec3f>(y)[x].val[k];
+}
+
+// the same value as an 8-bit feature, as getFeatureMaps writes it
+inline unsigned char packedFeatureByte(const cv::Mat &features, int y, int x, int k)
+{
+    return (features.depth() == CV_8U) ? features.ptr<cv::Vec3b>(y)[x].val[k] :
+        (unsigned char)std::min(255.0f, std::max(0.0f, features.ptr<cv::Vec3f>(y)[x].val[k] * 255.0f));
+}
+
+// FeatureMapFile implementation ---------------------------------------------
+
+void FeatureMapFile::clear()
+{
+    memset(&_header, 0, sizeof(_header));
+    memcpy(_header.magic, FEATURE_MAP_MAGIC, 4);
+    _header.version = FEATURE_MAP_VERSION;
+    _header.type = FEATURE_MAP_UINT8;
+    _header.params = modelFeatureConfig();
+    for (int k = 0; k < FEATURE_NUM_MAPS; k++) {
+        _planes[k].clear();
+    }
+}
+
+bool FeatureMapFile::read(const char *filename)
+{
+    clear();
+    const int fd = open(filename, O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    vector<unsigned char> buffer;
+    if (fstat(fd, &st) == 0) {
+        buffer.resize((size_t)st.st_size);
+    }
+    const bool bRead = !buffer.empty() &&
+        (::read(fd, &buffer[0], buffer.size()) == (ssize_t)buffer.size());
+    close(fd);
+
+    return parse(bRead ? &buffer[0] : NULL, bRead ? buffer.size() : 0, filename);
+}
+
+bool FeatureMapFile::write(const char *filename) const
+{
+    vector<unsigned char> buffer;
+    serialize(buffer);
+
+    FILE *file = fopen(filename, "wb");
+    if (file == NULL) return false;
+    const bool bWritten = (fwrite(&buffer[0], 1, buffer.size(), file) == buffer.size());
+    return (fclose(file) == 0) && bWritten;
+}
+
+bool FeatureMapFile::parse(const unsigned char *data, size_t size, const char *source)
+{
+    clear();
+    if ((data == NULL) || (size < sizeof(FeatureMapHeader))) {
+        DRWN_LOG_ERROR(source << " is not a feature map file");
+        return false;
+    }
+    memcpy(&_header, data, sizeof(FeatureMapHeader));
+    if ((memcmp(_header.magic, FEATURE_MAP_MAGIC, 4) != 0) || (_header.version != FEATURE_MAP_VERSION) ||
+        ((_header.type != FEATURE_MAP_UINT8) && (_header.type != FEATURE_MAP_FLOAT16))) {
+        DRWN_LOG_ERROR(source << " is not a version " << FEATURE_MAP_VERSION << " feature map file");
+        clear();
+        return false;
+    }
+
+    size_t offset = sizeof(FeatureMapHeader);
+    const size_t bytes = planeBytes();
+    for (int k = 0; k < FEATURE_NUM_MAPS; k++) {
+        if (!hasPlane((FeatureMapKind)k)) continue;
+        if (offset + bytes > size) {
+            DRWN_LOG_ERROR(source << " is truncated");
+            clear();
+            return false;
+        }
+        _planes[k].assign(data + offset, data + offset + bytes);
+        offset += paddedSize(bytes);
+    }
+    return true;
+}
+
+void FeatureMapFile::serialize(vector<unsigned char> &buffer) const
+{
+    const size_t bytes = planeBytes();
+    buffer.assign(sizeof(FeatureMapHeader), 0);
+    memcpy(&buffer[0], &_header, sizeof(FeatureMapHeader));
+    for (int k = 0; k < FEATURE_NUM_MAPS; k++) {
+        if (!hasPlane((FeatureMapKind)k)) continue;
+        buffer.insert(buffer.end(), _planes[k].begin(), _planes[k].end());
+        buffer.resize(buffer.size() + paddedSize(bytes) - bytes, 0);
+    }
+}
+
+void FeatureMapFile::setPlane(FeatureMapKind kind, const cv::Mat &map, FeatureMapType type)
+{
+    DRWN_ASSERT_MSG((map.type() == CV_64FC1) || (map.type() == CV_8UC1),
+        "feature maps are stored from CV_64F or CV_8U images");
+    DRWN_ASSERT_MSG(!map.empty(), "feature map is empty");
+    if (((int)_header.width != map.cols) || ((int)_header.height != map.rows) ||
+        (_header.type != (uint32_t)type)) {
+        clear();
+        _header.width = map.cols;
+        _header.height = map.rows;
+        _header.type = type;
+    }
+
+    _planes[kind].resize(planeBytes());
+    const bool bBytes = (map.depth() == CV_8U);
+    for (int y = 0; y < map.rows; y++) {
+        const double *m = map.ptr<double>(y);
+        const unsigned char *b = map.ptr<unsigned char>(y);
+        if (type == FEATURE_MAP_FLOAT16) {
+            uint16_t *p = (uint16_t *)&_planes[kind][0] + y * map.cols;
+            for (int x = 0; x < map.cols; x++) {
+                p[x] = floatToHalf(bBytes ? b[x] / 255.0f : (float)m[x]);
+            }
+        } else {
+            unsigned char *p = &_planes[kind][0] + y * map.cols;
+            for (int x = 0; x < map.cols; x++) {
+                p[x] = bBytes ? b[x] : (unsigned char)std::min(255.0, std::max(0.0, m[x] * 255));
+            }
+        }
+    }
+    _header.planes |= 1u << kind;
+}
+
+cv::Mat FeatureMapFile::packed() const
+{
+    DRWN_ASSERT_MSG(complete(), "feature map file lacks some of the MSC, CSH and CSD maps");
+    const int W = width();
+    const int H = height();
+    if (type() == FEATURE_MAP_FLOAT16) {
+        cv::Mat features(H, W, CV_32FC3);
+        for (int y = 0; y < H; y++) {
+            cv::Vec3f *f = features.ptr<cv::Vec3f>(y);
+            for (int k = 0; k < FEATURE_NUM_MAPS; k++) {
+                const uint16_t *p = (const uint16_t *)&_planes[k][0] + y * W;
+                for (int x = 0; x < W; x++) {
+                    f[x].val[k] = halfToFloat(p[x]);
+                }
+            }
+        }
+        return features;
+    }
+
+    cv::Mat features(H, W, CV_8UC3);
+    for (int y = 0; y < H; y++) {
+        cv::Vec3b *f = features.ptr<cv::Vec3b>(y);
+        for (int k = 0; k < FEATURE_NUM_MAPS; k++) {
+            const unsigned char *p = &_planes[k][0] + y * W;
+            for (int x = 0; x < W; x++) {
+                f[x].val[k] = p[x];
+            }
+        }
+    }
+    return features;
+}
+
+// implementation ------------------------------------------------------------
+
+cv::Mat loadFeatureMaps(const char *fmapDir, const char *mscDir, const char *cshDir,
+    const char *csdDir, const string &baseName)
+{
+    cv::Mat features;
+    string error;
+    DRWN_ASSERT_MSG(readFeatureMaps(fmapDir, mscDir, cshDir, csdDir, baseName, features, error),
+        error);
+    return features;
+}
+
+bool readFeatureMaps(const char *fmapDir, const char *mscDir, const char *cshDir,
+    const char *csdDir, const string &baseName, cv::Mat &features, string &error)
+{
+    if (fmapDir != NULL) {
+        const string filename = string(fmapDir) + DRWN_DIRSEP + baseName + ".fmap";
+        FeatureMapFile file;
+        if (!file.read(filename.c_str())) {
+            error = "could not read feature maps " + filename;
+            return false;
+        }
+        if (!file.complete()) {
+            error = filename + " lacks some of the MSC, CSH and CSD maps";
+            return false;
+        }
+        const ModelFeatureConfig expected = modelFeatureConfig();
+        if (memcmp(&file.params(), &expected, sizeof(ModelFeatureConfig)) != 0) {
+            DRWN_LOG_WARNING(filename << " was computed with other feature parameters");
+        }
+        features = file.packed();
+        return true;
+    }
+
+    const string processedImage = baseName + ".jpg";
+    const cv::Mat msc = cv::imread(string(mscDir) + DRWN_DIRSEP + processedImage);
+    const cv::Mat csh = cv::imread(string(cshDir) + DRWN_DIRSEP + processedImage);
+    const cv::Mat csd = cv::imread(string(csdDir) + DRWN_DIRSEP + processedImage);
+    if (msc.empty() || (csh.rows != msc.rows) || (csh.cols != msc.cols) ||
+        (csd.rows != msc.rows) || (csd.cols != msc.cols)) {
+        error = "feature maps of " + baseName + " are missing or differ in size";
+        return false;
+    }
+    features.create(msc.rows, msc.cols, CV_8UC3);
+    for (int y = 0; y < msc.rows; y++) {
+        const cv::Vec3b *m = msc.ptr<cv::Vec3b>(y);
+        const cv::Vec3b *h = csh.ptr<cv::Vec3b>(y);
+        const cv::Vec3b *d = csd.ptr<cv::Vec3b>(y);
+        cv::Vec3b *f = features.ptr<cv::Vec3b>(y);
+        for (int x = 0; x < msc.cols; x++) {
+            f[x] = cv::Vec3b(m[x].val[0], h[x].val[0], d[x].val[0]);
+        }
+    }
+    return true;
+}
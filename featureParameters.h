@@ -0,0 +1,35 @@
+/*****************************************************************************
+** DARWIN: A FRAMEWORK FOR MACHINE LEARNING RESEARCH AND DEVELOPMENT
+** Distributed under the terms of the BSD license (see the LICENSE file)
+** Copyright (c) 2007-2013, Stephen Gould
+** All rights reserved.
+**
+******************************************************************************
+** FILENAME:    featureParameters.h
+** AUTHOR(S):
+**              Jimmy Lin <u5223173@anu.edu.au>
+**              Chris Claoue-Long <u5183532@anu.edu.au>
+**
+** Parameters of the multi-scale contrast, centre-surround histogram and
+** colour spatial distribution feature maps, shared by the code computing
+** them and the model bundle recording them.
+**
+*****************************************************************************/
+
+#pragma once
+
+// multi-scale contrast: half window size and pyramid levels
+const int MSC_HALF_WINDOW = 5;
+const int MSC_PYRAMID_LEVELS = 6;
+
+// centre-surround histogram: histogram bins per colour channel, and the
+// aspect ratios (height / width) and widths (as a fraction of the shorter
+// image side) of the candidate surround rectangles
+const int CSH_BINS_PER_DIM = 4;
+const int CSH_ASPECT_RATIOS = 5;
+const double CSH_ASPECT_RATIO[CSH_ASPECT_RATIOS] = {0.5, 0.75, 1.0, 1.5, 2.0};
+const int CSH_SIZES = 12;
+const double CSH_SIZE_RANGE[CSH_SIZES] = {0.18, 0.2, 0.25, 0.3, 0.35, 0.4, 0.45, 0.5, 0.55, 0.6, 0.65, 0.7};
+
+// colour spatial distribution: components of the colour mixture model
+const int CSD_COMPONENTS = 5;
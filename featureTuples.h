@@ -0,0 +1,157 @@
+/*****************************************************************************
+** DARWIN: A FRAMEWORK FOR MACHINE LEARNING RESEARCH AND DEVELOPMENT
+** Distributed under the terms of the BSD license (see the LICENSE file)
+** Copyright (c) 2007-2013, Stephen Gould
+** All rights reserved.
+**
+******************************************************************************
+** FILENAME:    featureTuples.h
+** AUTHOR(S):
+**              Jimmy Lin <u5223173@anu.edu.au>
+**              Chris Claoue-Long <u5183532@anu.edu.au>
+**
+** Deduplicated training set of the pixel saliency model. The MSC, CSH and
+** CSD maps are 8-bit, so a pixel's features are one of at most 256^3
+** tuples and its label is binary. FeatureTupleCounts folds any number of
+** pixels into positive and negative counts per distinct tuple, after which
+** the classifier can be trained on the weighted tuples instead of the
+** pixels.
+**
+*****************************************************************************/
+
+#pragma once
+
+// c++ standard headers
+#include <cstdlib>
+#include <vector>
+
+// eigen matrix library headers
+#include "Eigen/Core"
+
+// darwin library headers
+#include "drwnBase.h"
+
+#include "pixelLogistic.h"
+
+using namespace std;
+
+// FeatureTupleCounts ---------------------------------------------------------
+
+class FeatureTupleCounts {
+ protected:
+    // open addressing hash table on the packed tuple plus one (zero marks
+    // an empty slot), with linear probing
+    vector<unsigned> _keys;
+    vector<unsigned> _positive;
+    vector<unsigned> _negative;
+    size_t _size;               // distinct tuples
+    unsigned long long _total;  // pixels added
+
+ public:
+    FeatureTupleCounts() : _size(0), _total(0) { clear(); }
+
+    void clear();
+    // counts one pixel with features (msc, csh, csd) and the given label
+    void add(unsigned char msc, unsigned char csh, unsigned char csd, bool bPositive);
+
+    size_t size() const { return _size; }
+    unsigned long long total() const { return _total; }
+
+    // Writes one training sample per tuple and label seen with it: the
+    // features scaled to [0, 1] followed by a constant 1, the label, and
+    // the number of pixels as the sample weight.
+    void samples(PixelFeatureMatrix &features, Eigen::VectorXf &targets,
+        Eigen::VectorXf &weights) const;
+
+ protected:
+    static size_t hash(unsigned key) { return (size_t)(key * 2654435761u); }
+    void grow();
+};
+
+// FeatureTupleCounts implementation ------------------------------------------
+
+void FeatureTupleCounts::clear()
+{
+    _keys.assign(1 << 16, 0);
+    _positive.assign(_keys.size(), 0);
+    _negative.assign(_keys.size(), 0);
+    _size = 0;
+    _total = 0;
+}
+
+void FeatureTupleCounts::add(unsigned char msc, unsigned char csh, unsigned char csd, bool bPositive)
+{
+    const unsigned key = (((unsigned)msc << 16) | ((unsigned)csh << 8) | csd) + 1;
+    const size_t mask = _keys.size() - 1;
+    size_t i = hash(key) & mask;
+    while ((_keys[i] != key) && (_keys[i] != 0)) {
+        i = (i + 1) & mask;
+    }
+    if (_keys[i] == 0) {
+        _keys[i] = key;
+        _size += 1;
+    }
+    if (bPositive) {
+        _positive[i] += 1;
+    } else {
+        _negative[i] += 1;
+    }
+    _total += 1;
+
+    if (2 * _size > _keys.size()) {
+        grow();
+    }
+}
+
+void FeatureTupleCounts::grow()
+{
+    vector<unsigned> keys(2 * _keys.size(), 0);
+    vector<unsigned> positive(keys.size(), 0);
+    vector<unsigned> negative(keys.size(), 0);
+    const size_t mask = keys.size() - 1;
+    for (size_t j = 0; j < _keys.size(); j++) {
+        if (_keys[j] == 0) continue;
+        size_t i = hash(_keys[j]) & mask;
+        while (keys[i] != 0) {
+            i = (i + 1) & mask;
+        }
+        keys[i] = _keys[j];
+        positive[i] = _positive[j];
+        negative[i] = _negative[j];
+    }
+    _keys.swap(keys);
+    _positive.swap(positive);
+    _negative.swap(negative);
+}
+
+void FeatureTupleCounts::samples(PixelFeatureMatrix &features, Eigen::VectorXf &targets,
+    Eigen::VectorXf &weights) const
+{
+    int n = 0;
+    for (size_t i = 0; i < _keys.size(); i++) {
+        n += (_positive[i] > 0 ? 1 : 0) + (_negative[i] > 0 ? 1 : 0);
+    }
+    features.resize(n, 4);
+    targets.resize(n);
+    weights.resize(n);
+
+    n = 0;
+    for (size_t i = 0; i < _keys.size(); i++) {
+        if (_keys[i] == 0) continue;
+        const unsigned key = _keys[i] - 1;
+        const float x0 = ((key >> 16) & 0xff) / 255.0f;
+        const float x1 = ((key >> 8) & 0xff) / 255.0f;
+        const float x2 = (key & 0xff) / 255.0f;
+        for (int label = 1; label >= 0; label--) {
+            const unsigned count = label ? _positive[i] : _negative[i];
+            if (count == 0) continue;
+            features(n, 0) = x0;
+            features(n, 1) = x1;
+            features(n, 2) = x2;
+            features(n, 3) = 1.0f;
+            targets[n] = (float)label;
+            weights[n] = (float)count;
+            n += 1;
+        }
+    }
+}
@@ -19,6 +19,8 @@
 #include <set>
 #include <math.h> 
 
+#include "featureParameters.h"
+
 using namespace std;
 using namespace Eigen;
 
@@ -214,11 +216,11 @@ CSRectangle getMostDistinctCSRectangle(const int ordinate, const int abscissa, c
 /*{{{*/
     const int imageHeight = histImage.rows;
     const int imageWidth = histImage.cols;
-    const int nAspectRatio = 5;
-    const int nSizeChoice = 12;
+    const int nAspectRatio = CSH_ASPECT_RATIOS;
+    const int nSizeChoice = CSH_SIZES;
     const int minOfSide = (imageWidth>imageHeight)?imageHeight:imageWidth;
-    double aspectRatio [] = {0.5, 0.75, 1.0, 1.5, 2.0};
-    double sizeRange [] = {0.18, 0.2, 0.25, 0.3, 0.35, 0.4, 0.45, 0.5, 0.55, 0.6, 0.65, 0.7, 0.75};
+    const double *aspectRatio = CSH_ASPECT_RATIO;
+    const double *sizeRange = CSH_SIZE_RANGE;
     std::list<CSRectangle> CSRs;
 
     int tempSWidth, tempSHeight, tempSLeft, tempSTop;
@@ -271,7 +273,7 @@ CSRectangle getMostDistinctCSRectangle(const int ordinate, const int abscissa, c
 cv::Mat getCenterSurround(const cv::Mat img){
 /*{{{*/
     // parameters
-    int nBinsPerDim = 4;
+    int nBinsPerDim = CSH_BINS_PER_DIM;
     // local variable storage for convenient invocation
     const int imageWidth = img.cols;
     const int imageHeight = img.rows;
@@ -352,7 +354,7 @@ cv::Mat getCenterSurround(const cv::Mat img){
 cv::Mat getSpatialDistribution(cv::Mat img){
     /*{{{*/
     // constant declaration
-    const int nComponents = 5;
+    const int nComponents = CSD_COMPONENTS;
     const int nDimensions = 3;
     const int imageWidth = img.cols;
     const int imageHeight = img.rows;
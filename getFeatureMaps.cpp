@@ -36,6 +36,7 @@
 #include "drwnML.h"
 #include "drwnVision.h"
 #include "features.h"
+#include "featureMapStore.h"
 
 using namespace std;
 using namespace Eigen;
@@ -46,7 +47,10 @@ using namespace Eigen;
 void usage() {
     cerr << DRWN_USAGE_HEADER << endl;
     cerr << "USAGE: ./getFeatureMap <mode> <imgDir> <outputDir>\n";
+    cerr << "  <mode> is msc, csh, csd or all (all three, for -fmap)\n";
     cerr << "OPTIONS:\n"
+         << "  -fmap             :: store the maps in <outputDir>/<image>.fmap instead of JPEGs\n"
+         << "  -float16          :: store half precision instead of 8-bit maps (with -fmap)\n"
          << "  -x                :: visualize\n"
          << DRWN_STANDARD_OPTIONS_USAGE
 	 << endl;
@@ -59,11 +63,15 @@ int main (int argc, char * argv[]) {
     const char *modelFile = NULL;
     bool bVisualize = false;
     bool pyramidDisplay = false;
+    bool bStore = false;
+    bool bFloat16 = false;
 
     DRWN_BEGIN_CMDLINE_PROCESSING(argc, argv)
         DRWN_CMDLINE_STR_OPTION("-o", modelFile)
         DRWN_CMDLINE_BOOL_OPTION("-x", bVisualize)
         DRWN_CMDLINE_BOOL_OPTION("-p", pyramidDisplay)
+        DRWN_CMDLINE_BOOL_OPTION("-fmap", bStore)
+        DRWN_CMDLINE_BOOL_OPTION("-float16", bFloat16)
     DRWN_END_CMDLINE_PROCESSING(usage());
 
     // Check for the correct number of required arguments
@@ -83,14 +91,18 @@ int main (int argc, char * argv[]) {
     const char *outputDir = DRWN_CMDLINE_ARGV[2];
 
     // intepret which feature to extract
-    string mode;
-    if (string(modeSwitch).compare("msc") == 0 ) {
-        mode = "Multiscale Contrast";
-    } else if (string(modeSwitch).compare("csh") == 0 ) {
-        mode = "Center Surround Histogram";
-    } else if (string(modeSwitch).compare("csd") == 0 ) {
-        mode = "Color Spatial Distribution";
+    vector<string> modeSwitches;
+    if (string(modeSwitch).compare("all") == 0) {
+        DRWN_ASSERT_MSG(bStore, "mode all needs -fmap");
+        modeSwitches.push_back("msc");
+        modeSwitches.push_back("csh");
+        modeSwitches.push_back("csd");
+    } else {
+        DRWN_ASSERT_MSG((string(modeSwitch).compare("msc") == 0) || (string(modeSwitch).compare("csh") == 0) ||
+            (string(modeSwitch).compare("csd") == 0), "unknown mode " << modeSwitch << " (msc, csh, csd or all)");
+        modeSwitches.push_back(modeSwitch);
     }
+    const FeatureMapType storeType = bFloat16 ? FEATURE_MAP_FLOAT16 : FEATURE_MAP_UINT8;
 
     // Check the existence of the given directory
     DRWN_ASSERT_MSG(drwnDirExists(imgDir), "image directory " << imgDir << " does not exist");
@@ -121,37 +133,74 @@ int main (int argc, char * argv[]) {
             drwnShowDebuggingImage(canvas, "image", false);
             cvReleaseImage(&canvas);
         }
-        // get processed by feature.h
-        cv::Mat cdi;   
-        if (string(modeSwitch).compare("msc") == 0 ) {
-            // halfwindowSize:5 , pyramid level: 6
-            MultiScaleContrast mscObj = getMultiScaleContrast(img, 5, 6);
-            cdi = mscObj.featureMap;  
-            // output the pyramid
-            if (pyramidDisplay) {
-                for (int p = 0; p < mscObj.nPyLevel; p ++) {
-                    cv::imwrite(string(outputDir) + baseNames[i] + "_p" + toString(p) + ".jpg", mscObj.PyContrastMaps[p]);
-                }
+        // a single map is merged into the maps already stored for the image
+        FeatureMapFile store;
+        const string storeName = string(outputDir) + baseNames[i] + ".fmap";
+        if (bStore && (modeSwitches.size() < (unsigned)FEATURE_NUM_MAPS) &&
+            store.read(storeName.c_str())) {
+            // maps computed with other feature parameters are not kept
+            const ModelFeatureConfig expected = modelFeatureConfig();
+            if (memcmp(&store.params(), &expected, sizeof(ModelFeatureConfig)) != 0) {
+                DRWN_LOG_WARNING(storeName << " was computed with other feature parameters; "
+                    "its other maps are dropped and must be computed again");
+                store.clear();
             }
-        } else if (string(modeSwitch).compare("csh") == 0 ) {
-            cdi = getCenterSurround(img); 
-        } else if (string(modeSwitch).compare("csd") == 0 ) {
-            cdi = getSpatialDistribution(img);
         }
-        cv::Mat pres (img.rows, img.cols, CV_8UC3);
-        double grayscale;
-        for (int y = 0 ; y < cdi.rows; y ++) {
-            for (int x = 0 ; x < cdi.cols; x ++) {
-                grayscale = cdi.at<double>(y,x);
-                pres.at<Vec3b>(y,x) = Vec3b(grayscale*255, grayscale*255, grayscale*255);
+
+        for (unsigned m = 0; m < modeSwitches.size(); m++) {
+            const char *modeSwitch = modeSwitches[m].c_str();
+            string mode;
+            FeatureMapKind kind = FEATURE_MSC;
+            if (string(modeSwitch).compare("msc") == 0 ) {
+                mode = "Multiscale Contrast";
+            } else if (string(modeSwitch).compare("csh") == 0 ) {
+                mode = "Center Surround Histogram";
+                kind = FEATURE_CSH;
+            } else if (string(modeSwitch).compare("csd") == 0 ) {
+                mode = "Color Spatial Distribution";
+                kind = FEATURE_CSD;
+            }
+
+            // get processed by feature.h
+            cv::Mat cdi;   
+            if (string(modeSwitch).compare("msc") == 0 ) {
+                MultiScaleContrast mscObj = getMultiScaleContrast(img, MSC_HALF_WINDOW, MSC_PYRAMID_LEVELS);
+                cdi = mscObj.featureMap;  
+                // output the pyramid
+                if (pyramidDisplay) {
+                    for (int p = 0; p < mscObj.nPyLevel; p ++) {
+                        cv::imwrite(string(outputDir) + baseNames[i] + "_p" + toString(p) + ".jpg", mscObj.PyContrastMaps[p]);
+                    }
+                }
+            } else if (string(modeSwitch).compare("csh") == 0 ) {
+                cdi = getCenterSurround(img); 
+            } else if (string(modeSwitch).compare("csd") == 0 ) {
+                cdi = getSpatialDistribution(img);
+            }
+            DRWN_ASSERT_MSG(!cdi.empty(), "no " << mode << " map for image " << baseNames[i]);
+            if (bStore) {
+                store.setPlane(kind, cdi, storeType);
+                continue;
+            }
+            cv::Mat pres (img.rows, img.cols, CV_8UC3);
+            double grayscale;
+            for (int y = 0 ; y < cdi.rows; y ++) {
+                for (int x = 0 ; x < cdi.cols; x ++) {
+                    grayscale = cdi.at<double>(y,x);
+                    pres.at<Vec3b>(y,x) = Vec3b(grayscale*255, grayscale*255, grayscale*255);
+                }
+            }
+            IplImage pcvimg = (IplImage) pres;
+            IplImage *present = cvCloneImage(&pcvimg);
+            cv::imwrite(string(outputDir) + baseNames[i] + ".jpg", pres);
+            if (bVisualize) { // draw the processed feature map and display it on the screen
+                drwnShowDebuggingImage(present, mode.c_str(), false);
+                cvReleaseImage(&present);
             }
         }
-        IplImage pcvimg = (IplImage) pres;
-        IplImage *present = cvCloneImage(&pcvimg);
-        cv::imwrite(string(outputDir) + baseNames[i] + ".jpg", pres);
-        if (bVisualize) { // draw the processed feature map and display it on the screen
-            drwnShowDebuggingImage(present, mode.c_str(), false);
-            cvReleaseImage(&present);
+
+        if (bStore) {
+            DRWN_ASSERT_MSG(store.write(storeName.c_str()), "could not write " << storeName);
         }
     }
 
@@ -0,0 +1,941 @@
+/*****************************************************************************
+** DARWIN: A FRAMEWORK FOR MACHINE LEARNING RESEARCH AND DEVELOPMENT
+** Distributed under the terms of the BSD license (see the LICENSE file)
+** Copyright (c) 2007-2013, Stephen Gould
+** All rights reserved.
+**
+******************************************************************************
+** FILENAME:    gridMaxFlow.h
+** AUTHOR(S):
+**              Jimmy Lin <u5223173@anu.edu.au>
+**              Chris Claoue-Long <u5183532@anu.edu.au>
+**
+** Boykov-Kolmogorov max-flow specialised to 8-connected H-by-W grids. The
+** graph topology is implicit: a node's neighbours are found from its
+** position, so no adjacency lists are stored. Residual capacities live in
+** one dense plane per direction and nodes are laid out in 8-by-8 blocks so
+** that a node and its neighbours usually share cache lines. Capacities may
+** be floating point or integer; flow values are accumulated in double so
+** that integer capacities cannot overflow the total.
+**
+*****************************************************************************/
+
+#pragma once
+
+// c++ standard headers
+#include <cstdlib>
+#include <vector>
+#include <algorithm>
+#include <limits>
+
+// darwin library headers
+#include "drwnBase.h"
+
+using namespace std;
+
+// grid directions --------------------------------------------------------------
+// opposite directions differ only in the lowest bit, i.e. opposite(d) = d ^ 1
+
+typedef enum {
+    GRID_W = 0, GRID_E,
+    GRID_N, GRID_S,
+    GRID_NW, GRID_SE,
+    GRID_SW, GRID_NE,
+    GRID_NUM_DIRECTIONS
+} GridDirection;
+
+static const int GRID_DX[GRID_NUM_DIRECTIONS] = {-1, 1, 0, 0, -1, 1, -1, 1};
+static const int GRID_DY[GRID_NUM_DIRECTIONS] = {0, 0, -1, 1, -1, 1, 1, -1};
+
+// GridMaxFlow ------------------------------------------------------------------
+
+template <typename T>
+class GridMaxFlow {
+ public:
+    typedef T cap_type;
+
+ protected:
+    // block layout (8-by-8 nodes per block, row-major inside the block)
+    static const int BLOCK_BITS = 3;
+    static const int BLOCK_WIDTH = 1 << BLOCK_BITS;
+    static const int BLOCK_MASK = BLOCK_WIDTH - 1;
+    static const int BLOCK_SIZE = BLOCK_WIDTH * BLOCK_WIDTH;
+
+    // special values of _parent
+    static const unsigned char TERMINAL = GRID_NUM_DIRECTIONS;
+    static const unsigned char ORPHAN = GRID_NUM_DIRECTIONS + 1;
+    static const unsigned char NONE = GRID_NUM_DIRECTIONS + 2;
+
+    // values of _tree
+    static const unsigned char FREE = 0;
+    static const unsigned char SOURCE = 1;
+    static const unsigned char SINK = 2;
+
+    int _width;                 // grid width (real nodes)
+    int _height;                // grid height (real nodes)
+    int _blocksX;               // padded width in blocks
+    int _numNodes;              // padded number of nodes in use
+
+    // index offset to the neighbour in each direction for each position
+    // within a block
+    int _offsets[GRID_NUM_DIRECTIONS][BLOCK_SIZE];
+
+    vector<T> _cap[GRID_NUM_DIRECTIONS]; // residual capacity to neighbour
+    vector<T> _tcap;            // residual terminal capacity (> 0 source, < 0 sink)
+    vector<unsigned char> _parent; // direction to parent in search tree
+    vector<unsigned char> _tree;   // search tree membership
+    vector<int> _next;          // active queue linkage (-1 when not active)
+    vector<int> _timestamp;     // time the distance to terminal was computed
+    vector<int> _dist;          // distance to terminal
+    vector<unsigned char> _marked; // capacity changed since the last solve
+    vector<int> _changed;       // nodes with _marked set
+
+    // search state for one region of the grid; the serial solver searches a
+    // single region covering the whole grid
+    struct SearchState {
+        int queueFirst;         // active queue
+        int queueLast;
+        vector<int> orphans;    // orphan queue
+        size_t orphanHead;
+        int time;
+        double flow;            // flow pushed by this search
+        int augmentations;      // augmenting paths found by this search
+        int adoptions;          // orphans processed by this search
+
+        SearchState() : queueFirst(-1), queueLast(-1), orphanHead(0), time(0), flow(0),
+            augmentations(0), adoptions(0) {}
+    };
+
+    // edge capacity withheld while its end points lie in different regions
+    struct StashedEdge {
+        int x, y, d;
+        T cap;
+    };
+
+    // thread job solving one region with the edges leaving it withheld
+    class RegionJob : public drwnThreadJob {
+    public:
+        GridMaxFlow<T> *graph;
+        int x0, y0, x1, y1;
+        SearchState search;
+
+        RegionJob() : graph(NULL), x0(0), y0(0), x1(0), y1(0) { }
+        void operator()() {
+            graph->initialize(search, x0, y0, x1, y1);
+            graph->maxflow(search);
+        }
+    };
+    friend class RegionJob;
+
+    SearchState _search;
+    double _flowValue;
+    long _augmentations;        // augmenting paths since reset()
+    long _adoptions;            // orphans processed since reset()
+
+ public:
+    GridMaxFlow();
+    ~GridMaxFlow() { /* do nothing */ }
+
+    int width() const { return _width; }
+    int height() const { return _height; }
+    // bytes of node storage currently allocated
+    size_t memoryUsage() const;
+
+    // Resizes the grid to width-by-height and clears all capacities.
+    // Storage is only reallocated when the grid grows beyond anything seen
+    // before, so repeated calls with equal sizes do not allocate.
+    void reset(int width, int height);
+
+    // add terminal capacities to node (x, y); both must be non-negative
+    void addTerminalEdges(int x, int y, T source, T sink);
+    // add capacity from node (x, y) to its neighbour in direction d and back;
+    // the neighbour must lie inside the grid and both must be non-negative
+    void addEdge(int x, int y, int d, T cap, T revCap);
+
+    // computes the maximum flow and returns its value
+    double solve();
+    // computes the maximum flow using up to nThreads threads by solving
+    // regions of the grid independently and merging them bottom-up; the
+    // minimum cut found is identical to that of solve(). The regions run on
+    // threadPool if given, which can then be kept across solves, or else on
+    // a pool of nThreads threads created for this call.
+    double solveParallel(unsigned nThreads, drwnThreadPool *threadPool = NULL);
+
+    // Dynamic graph cuts (Kohli and Torr, 2005). After a solve, capacities
+    // can be changed in place, by negative amounts too, and resolve()
+    // continues from the current flow and search trees instead of starting
+    // again. Flow exceeding a reduced capacity is moved onto the terminal
+    // edges, which adds a constant to every cut, so the value returned by
+    // resolve() is the flow of this reparameterised graph.
+    void updateTerminalEdges(int x, int y, T deltaSource, T deltaSink);
+    void updateEdge(int x, int y, int d, T delta, T revDelta);
+    double resolve();
+
+    // search statistics accumulated over all solves since reset()
+    long numAugmentations() const { return _augmentations; }
+    long numAdoptions() const { return _adoptions; }
+
+    // true if node (x, y) is on the source side of the minimum cut
+    bool inSetS(int x, int y) const { return _tree[index(x, y)] == SOURCE; }
+
+ protected:
+    int index(int x, int y) const {
+        const int px = x + 1;
+        const int py = y + 1;
+        return (((py >> BLOCK_BITS) * _blocksX + (px >> BLOCK_BITS)) << (2 * BLOCK_BITS)) |
+            ((py & BLOCK_MASK) << BLOCK_BITS) | (px & BLOCK_MASK);
+    }
+    int neighbour(int u, int d) const {
+        return u + _offsets[d][u & (BLOCK_SIZE - 1)];
+    }
+
+    void setActive(SearchState &s, int u);
+    int nextActive(SearchState &s);
+    void setOrphan(SearchState &s, int u);
+
+    void initialize(SearchState &s, int x0, int y0, int x1, int y1);
+    void augment(SearchState &s, int u, int d);
+    void adoptSourceOrphan(SearchState &s, int u);
+    void adoptSinkOrphan(SearchState &s, int u);
+    void maxflow(SearchState &s);
+
+    void markNode(int u);
+    void reuseTrees(SearchState &s);
+};
+
+// GridMaxFlow implementation ---------------------------------------------------
+
+template <typename T> const int GridMaxFlow<T>::BLOCK_BITS;
+template <typename T> const int GridMaxFlow<T>::BLOCK_WIDTH;
+template <typename T> const int GridMaxFlow<T>::BLOCK_MASK;
+template <typename T> const int GridMaxFlow<T>::BLOCK_SIZE;
+template <typename T> const unsigned char GridMaxFlow<T>::TERMINAL;
+template <typename T> const unsigned char GridMaxFlow<T>::ORPHAN;
+template <typename T> const unsigned char GridMaxFlow<T>::NONE;
+template <typename T> const unsigned char GridMaxFlow<T>::FREE;
+template <typename T> const unsigned char GridMaxFlow<T>::SOURCE;
+template <typename T> const unsigned char GridMaxFlow<T>::SINK;
+
+template <typename T>
+GridMaxFlow<T>::GridMaxFlow() :
+    _width(0), _height(0), _blocksX(0), _numNodes(0),
+    _flowValue(0), _augmentations(0), _adoptions(0)
+{
+    // do nothing
+}
+
+template <typename T>
+size_t GridMaxFlow<T>::memoryUsage() const
+{
+    return _tcap.capacity() * ((GRID_NUM_DIRECTIONS + 1) * sizeof(T) +
+        3 * sizeof(unsigned char) + 3 * sizeof(int));
+}
+
+template <typename T>
+void GridMaxFlow<T>::reset(int width, int height)
+{
+    DRWN_ASSERT((width > 0) && (height > 0));
+
+    // pad by one node on every side so that all real nodes have eight
+    // neighbours in storage, then round up to whole blocks
+    const int paddedWidth = ((width + 2 + BLOCK_MASK) >> BLOCK_BITS) << BLOCK_BITS;
+    const int paddedHeight = ((height + 2 + BLOCK_MASK) >> BLOCK_BITS) << BLOCK_BITS;
+
+    _width = width;
+    _height = height;
+    _blocksX = paddedWidth >> BLOCK_BITS;
+    _numNodes = paddedWidth * paddedHeight;
+
+    for (int q = 0; q < BLOCK_SIZE; q++) {
+        for (int d = 0; d < GRID_NUM_DIRECTIONS; d++) {
+            int nx = (q & BLOCK_MASK) + GRID_DX[d];
+            int ny = (q >> BLOCK_BITS) + GRID_DY[d];
+            int bx = 0, by = 0;
+            if (nx < 0) { nx += BLOCK_WIDTH; bx = -1; }
+            if (nx >= BLOCK_WIDTH) { nx -= BLOCK_WIDTH; bx = 1; }
+            if (ny < 0) { ny += BLOCK_WIDTH; by = -1; }
+            if (ny >= BLOCK_WIDTH) { ny -= BLOCK_WIDTH; by = 1; }
+            _offsets[d][q] = ((by * _blocksX + bx) << (2 * BLOCK_BITS)) +
+                ((ny << BLOCK_BITS) | nx) - q;
+        }
+    }
+
+    // assign() only reallocates when growing beyond the current capacity
+    for (int d = 0; d < GRID_NUM_DIRECTIONS; d++) {
+        _cap[d].assign(_numNodes, T(0));
+    }
+    _tcap.assign(_numNodes, T(0));
+    _parent.assign(_numNodes, NONE);
+    _tree.assign(_numNodes, FREE);
+    _next.assign(_numNodes, -1);
+    _timestamp.assign(_numNodes, 0);
+    _dist.assign(_numNodes, 0);
+    _marked.assign(_numNodes, 0);
+    _changed.clear();
+    _search.orphans.reserve(_numNodes);
+
+    _flowValue = 0.0;
+    _augmentations = 0;
+    _adoptions = 0;
+}
+
+template <typename T>
+void GridMaxFlow<T>::addTerminalEdges(int x, int y, T source, T sink)
+{
+    // fold the existing residual capacity into the new pair before
+    // cancelling the common part
+    const int u = index(x, y);
+    if (_tcap[u] > 0) {
+        source += _tcap[u];
+    } else {
+        sink -= _tcap[u];
+    }
+    _flowValue += std::min(source, sink);
+    _tcap[u] = source - sink;
+}
+
+template <typename T>
+void GridMaxFlow<T>::addEdge(int x, int y, int d, T cap, T revCap)
+{
+    const int u = index(x, y);
+    _cap[d][u] += cap;
+    _cap[d ^ 1][neighbour(u, d)] += revCap;
+}
+
+template <typename T>
+double GridMaxFlow<T>::solve()
+{
+    for (size_t i = 0; i < _changed.size(); i++) {
+        _marked[_changed[i]] = 0;
+    }
+    _changed.clear();
+
+    initialize(_search, 0, 0, _width, _height);
+    maxflow(_search);
+    _flowValue += _search.flow;
+    _augmentations += _search.augmentations;
+    _adoptions += _search.adoptions;
+    return _flowValue;
+}
+
+template <typename T>
+double GridMaxFlow<T>::solveParallel(unsigned nThreads, drwnThreadPool *threadPool)
+{
+    if ((nThreads < 2) || (_width < 2) || (_height < 2)) {
+        return solve();
+    }
+
+    // split the grid into 2^levelsX by 2^levelsY regions, at least one per
+    // thread, then merge neighbouring regions pairwise until one remains
+    int levelsX = 0;
+    int levelsY = 0;
+    while ((1u << (levelsX + levelsY)) < nThreads) {
+        if ((levelsX <= levelsY) && ((2 << levelsX) <= _width)) {
+            levelsX += 1;
+        } else if ((2 << levelsY) <= _height) {
+            levelsY += 1;
+        } else {
+            break;
+        }
+    }
+
+    vector<int> regionX(_width);
+    vector<int> regionY(_height);
+    vector<StashedEdge> stash;
+    drwnThreadPool *ownPool = (threadPool == NULL) ? new drwnThreadPool(nThreads) : NULL;
+    if (threadPool == NULL) threadPool = ownPool;
+
+    for (bool bFirst = true; true; bFirst = false) {
+        const int tilesX = 1 << levelsX;
+        const int tilesY = 1 << levelsY;
+        for (int x = 0; x < _width; x++) {
+            regionX[x] = (x * tilesX) / _width;
+        }
+        for (int y = 0; y < _height; y++) {
+            regionY[y] = (y * tilesY) / _height;
+        }
+
+        if (bFirst) {
+            // withhold capacity on all edges between different regions
+            for (int y = 0; y < _height; y++) {
+                for (int x = 0; x < _width; x++) {
+                    const int u = index(x, y);
+                    for (int d = 0; d < GRID_NUM_DIRECTIONS; d++) {
+                        if (_cap[d][u] == T(0)) continue;
+                        const int nx = x + GRID_DX[d];
+                        const int ny = y + GRID_DY[d];
+                        if ((regionX[nx] == regionX[x]) && (regionY[ny] == regionY[y]))
+                            continue;
+                        StashedEdge e;
+                        e.x = x; e.y = y; e.d = d; e.cap = _cap[d][u];
+                        stash.push_back(e);
+                        _cap[d][u] = T(0);
+                    }
+                }
+            }
+        } else {
+            // restore capacity on edges now inside a region; no flow was
+            // pushed along them so the saved capacity is still residual
+            size_t n = 0;
+            for (size_t i = 0; i < stash.size(); i++) {
+                const StashedEdge &e = stash[i];
+                const int nx = e.x + GRID_DX[e.d];
+                const int ny = e.y + GRID_DY[e.d];
+                if ((regionX[nx] == regionX[e.x]) && (regionY[ny] == regionY[e.y])) {
+                    _cap[e.d][index(e.x, e.y)] = e.cap;
+                } else {
+                    stash[n++] = e;
+                }
+            }
+            stash.resize(n);
+        }
+
+        if (tilesX * tilesY == 1) break;
+
+        // solve regions concurrently; a region only touches its own nodes
+        // because every edge leaving it has zero capacity
+        vector<RegionJob> jobs(tilesX * tilesY);
+        threadPool->start();
+        for (int ty = 0; ty < tilesY; ty++) {
+            for (int tx = 0; tx < tilesX; tx++) {
+                RegionJob &job = jobs[ty * tilesX + tx];
+                job.graph = this;
+                job.x0 = (tx * _width + tilesX - 1) / tilesX;
+                job.x1 = ((tx + 1) * _width + tilesX - 1) / tilesX;
+                job.y0 = (ty * _height + tilesY - 1) / tilesY;
+                job.y1 = ((ty + 1) * _height + tilesY - 1) / tilesY;
+                threadPool->addJob(&job);
+            }
+        }
+        threadPool->finish();
+
+        for (size_t i = 0; i < jobs.size(); i++) {
+            _flowValue += jobs[i].search.flow;
+            _augmentations += jobs[i].search.augmentations;
+            _adoptions += jobs[i].search.adoptions;
+        }
+
+        // merge along the axis with more regions
+        if (levelsX >= levelsY) {
+            levelsX -= 1;
+        } else {
+            levelsY -= 1;
+        }
+    }
+
+    if (ownPool != NULL) delete ownPool;
+
+    // finish on the whole grid, starting from the flow found so far
+    return solve();
+}
+
+template <typename T>
+void GridMaxFlow<T>::updateTerminalEdges(int x, int y, T deltaSource, T deltaSink)
+{
+    // the residual terminal capacity is stored net of the flow through the
+    // node, so any change keeps the flow feasible
+    const int u = index(x, y);
+    _tcap[u] += deltaSource - deltaSink;
+    markNode(u);
+}
+
+template <typename T>
+void GridMaxFlow<T>::updateEdge(int x, int y, int d, T delta, T revDelta)
+{
+    const int u = index(x, y);
+    const int v = neighbour(u, d);
+    _cap[d][u] += delta;
+    _cap[d ^ 1][v] += revDelta;
+
+    // cancel flow above the new capacity; the excess e this leaves at the
+    // tail is sent to the sink and the deficit at the head drawn from the
+    // source along new terminal edges of capacity e in both directions, so
+    // every cut grows by the same constant and the tail gains e residual
+    // source capacity and the head e residual sink capacity
+    if (_cap[d][u] < T(0)) {
+        const T e = -_cap[d][u];
+        _cap[d ^ 1][v] -= e;
+        _cap[d][u] = T(0);
+        _tcap[u] += e;
+        _tcap[v] -= e;
+    } else if (_cap[d ^ 1][v] < T(0)) {
+        const T e = -_cap[d ^ 1][v];
+        _cap[d][u] -= e;
+        _cap[d ^ 1][v] = T(0);
+        _tcap[v] += e;
+        _tcap[u] -= e;
+    }
+
+    markNode(u);
+    markNode(v);
+}
+
+template <typename T>
+double GridMaxFlow<T>::resolve()
+{
+    reuseTrees(_search);
+    maxflow(_search);
+    _flowValue += _search.flow;
+    _augmentations += _search.augmentations;
+    _adoptions += _search.adoptions;
+    return _flowValue;
+}
+
+template <typename T>
+void GridMaxFlow<T>::markNode(int u)
+{
+    if (_marked[u]) return;
+    _marked[u] = 1;
+    _changed.push_back(u);
+}
+
+// repairs the search trees of the last solve around the changed nodes: each
+// changed node becomes a root if it has terminal capacity and an orphan
+// otherwise, and is made active so that growth revisits its edges
+template <typename T>
+void GridMaxFlow<T>::reuseTrees(SearchState &s)
+{
+    s.queueFirst = s.queueLast = -1;
+    s.orphans.clear();
+    s.orphanHead = 0;
+    s.time += 1;
+    s.flow = 0.0;
+    s.augmentations = 0;
+    s.adoptions = 0;
+
+    for (size_t i = 0; i < _changed.size(); i++) {
+        const int u = _changed[i];
+        _marked[u] = 0;
+        setActive(s, u);
+
+        if (_tcap[u] == T(0)) {
+            if (_parent[u] != NONE) {
+                setOrphan(s, u);
+            }
+            continue;
+        }
+
+        const unsigned char tree = (_tcap[u] > T(0)) ? SOURCE : SINK;
+        if ((_parent[u] == NONE) || (_tree[u] != tree)) {
+            // u changes tree, so its children lose their parent and
+            // neighbours in the other tree with residual capacity towards
+            // u may now have paths through it (changed nodes not yet
+            // visited are handled in their own turn)
+            for (int d = 0; d < GRID_NUM_DIRECTIONS; d++) {
+                const int j = neighbour(u, d);
+                if (_marked[j]) continue;
+                if (_parent[j] == (d ^ 1)) {
+                    setOrphan(s, j);
+                }
+                if ((_parent[j] != NONE) && (_tree[j] != tree) &&
+                    (((tree == SOURCE) ? _cap[d][u] : _cap[d ^ 1][j]) > T(0))) {
+                    setActive(s, j);
+                }
+            }
+            _tree[u] = tree;
+        }
+        _parent[u] = TERMINAL;
+        _timestamp[u] = s.time;
+        _dist[u] = 1;
+    }
+    _changed.clear();
+
+    // adopt orphans
+    while (s.orphanHead < s.orphans.size()) {
+        const int v = s.orphans[s.orphanHead++];
+        if (_tree[v] == SOURCE) {
+            adoptSourceOrphan(s, v);
+        } else {
+            adoptSinkOrphan(s, v);
+        }
+    }
+    s.adoptions += (int)s.orphans.size();
+    s.orphans.clear();
+    s.orphanHead = 0;
+}
+
+// active node queue (first in, first out); a node is active when it has a
+// non-negative _next and the last node points to itself
+
+template <typename T>
+void GridMaxFlow<T>::setActive(SearchState &s, int u)
+{
+    if (_next[u] >= 0) return;
+    if (s.queueLast >= 0) {
+        _next[s.queueLast] = u;
+    } else {
+        s.queueFirst = u;
+    }
+    s.queueLast = u;
+    _next[u] = u;
+}
+
+template <typename T>
+int GridMaxFlow<T>::nextActive(SearchState &s)
+{
+    while (s.queueFirst >= 0) {
+        const int u = s.queueFirst;
+        if (_next[u] == u) {
+            s.queueFirst = s.queueLast = -1;
+        } else {
+            s.queueFirst = _next[u];
+        }
+        _next[u] = -1;
+
+        // skip nodes that left the search trees while queued
+        if (_parent[u] != NONE) return u;
+    }
+
+    return -1;
+}
+
+template <typename T>
+void GridMaxFlow<T>::setOrphan(SearchState &s, int u)
+{
+    _parent[u] = ORPHAN;
+    s.orphans.push_back(u);
+}
+
+template <typename T>
+void GridMaxFlow<T>::initialize(SearchState &s, int x0, int y0, int x1, int y1)
+{
+    s.queueFirst = s.queueLast = -1;
+    s.orphans.clear();
+    s.orphanHead = 0;
+    s.time = 0;
+
+    s.flow = 0.0;
+    s.augmentations = 0;
+    s.adoptions = 0;
+
+    // padding nodes are never touched after reset() so only nodes inside
+    // the region need initializing
+    for (int y = y0; y < y1; y++) {
+        for (int x = x0; x < x1; x++) {
+            const int u = index(x, y);
+            _next[u] = -1;
+            _timestamp[u] = 0;
+            if (_tcap[u] > T(0)) {
+                _tree[u] = SOURCE;
+                _parent[u] = TERMINAL;
+                _dist[u] = 1;
+                setActive(s, u);
+            } else if (_tcap[u] < T(0)) {
+                _tree[u] = SINK;
+                _parent[u] = TERMINAL;
+                _dist[u] = 1;
+                setActive(s, u);
+            } else {
+                _tree[u] = FREE;
+                _parent[u] = NONE;
+            }
+        }
+    }
+}
+
+// pushes flow along the path through the edge from u (source tree) to its
+// neighbour in direction d (sink tree)
+template <typename T>
+void GridMaxFlow<T>::augment(SearchState &s, int u, int d)
+{
+    const int v = neighbour(u, d);
+
+    // find bottleneck capacity
+    T bottleneck = _cap[d][u];
+    int i = u;
+    while (_parent[i] != TERMINAL) {
+        const int pd = _parent[i];
+        const int p = neighbour(i, pd);
+        bottleneck = std::min(bottleneck, _cap[pd ^ 1][p]);
+        i = p;
+    }
+    bottleneck = std::min(bottleneck, _tcap[i]);
+
+    i = v;
+    while (_parent[i] != TERMINAL) {
+        const int pd = _parent[i];
+        bottleneck = std::min(bottleneck, _cap[pd][i]);
+        i = neighbour(i, pd);
+    }
+    bottleneck = std::min(bottleneck, -_tcap[i]);
+
+    // push flow
+    _cap[d][u] -= bottleneck;
+    _cap[d ^ 1][v] += bottleneck;
+
+    i = u;
+    while (_parent[i] != TERMINAL) {
+        const int pd = _parent[i];
+        const int p = neighbour(i, pd);
+        _cap[pd][i] += bottleneck;
+        _cap[pd ^ 1][p] -= bottleneck;
+        if (_cap[pd ^ 1][p] == T(0)) {
+            setOrphan(s, i);
+        }
+        i = p;
+    }
+    _tcap[i] -= bottleneck;
+    if (_tcap[i] == T(0)) {
+        setOrphan(s, i);
+    }
+
+    i = v;
+    while (_parent[i] != TERMINAL) {
+        const int pd = _parent[i];
+        const int p = neighbour(i, pd);
+        _cap[pd ^ 1][p] += bottleneck;
+        _cap[pd][i] -= bottleneck;
+        if (_cap[pd][i] == T(0)) {
+            setOrphan(s, i);
+        }
+        i = p;
+    }
+    _tcap[i] += bottleneck;
+    if (_tcap[i] == T(0)) {
+        setOrphan(s, i);
+    }
+
+    s.flow += bottleneck;
+}
+
+template <typename T>
+void GridMaxFlow<T>::adoptSourceOrphan(SearchState &s, int u)
+{
+    const int INFINITE_DIST = numeric_limits<int>::max();
+    int bestDir = NONE;
+    int minDist = INFINITE_DIST;
+
+    // look for a new parent with a valid path to the source
+    for (int d = 0; d < GRID_NUM_DIRECTIONS; d++) {
+        const int j = neighbour(u, d);
+        if ((_cap[d ^ 1][j] <= T(0)) || (_tree[j] != SOURCE))
+            continue;
+
+        int k = j;
+        int dist = 0;
+        while (true) {
+            if (_timestamp[k] == s.time) {
+                dist += _dist[k];
+                break;
+            }
+            dist += 1;
+            if (_parent[k] == TERMINAL) {
+                _timestamp[k] = s.time;
+                _dist[k] = 1;
+                break;
+            }
+            if (_parent[k] == ORPHAN) {
+                dist = INFINITE_DIST;
+                break;
+            }
+            k = neighbour(k, _parent[k]);
+        }
+
+        if (dist == INFINITE_DIST)
+            continue;
+
+        if (dist < minDist) {
+            bestDir = d;
+            minDist = dist;
+        }
+
+        // cache distances along the path
+        for (k = j; _timestamp[k] != s.time; k = neighbour(k, _parent[k])) {
+            _timestamp[k] = s.time;
+            _dist[k] = dist;
+            dist -= 1;
+        }
+    }
+
+    if (bestDir != NONE) {
+        _parent[u] = (unsigned char)bestDir;
+        _timestamp[u] = s.time;
+        _dist[u] = minDist + 1;
+        return;
+    }
+
+    // no parent found: free the node and orphan its children
+    // (children always have residual capacity from their parent, so nodes
+    // joined to u by saturated edges in both directions can be skipped)
+    for (int d = 0; d < GRID_NUM_DIRECTIONS; d++) {
+        const int j = neighbour(u, d);
+        if ((_cap[d][u] <= T(0)) && (_cap[d ^ 1][j] <= T(0)))
+            continue;
+        if (_tree[j] != SOURCE)
+            continue;
+        if (_cap[d ^ 1][j] > T(0)) {
+            setActive(s, j);
+        }
+        if (_parent[j] == (d ^ 1)) {
+            setOrphan(s, j);
+        }
+    }
+    _tree[u] = FREE;
+    _parent[u] = NONE;
+}
+
+template <typename T>
+void GridMaxFlow<T>::adoptSinkOrphan(SearchState &s, int u)
+{
+    const int INFINITE_DIST = numeric_limits<int>::max();
+    int bestDir = NONE;
+    int minDist = INFINITE_DIST;
+
+    // look for a new parent with a valid path to the sink
+    for (int d = 0; d < GRID_NUM_DIRECTIONS; d++) {
+        const int j = neighbour(u, d);
+        if ((_cap[d][u] <= T(0)) || (_tree[j] != SINK))
+            continue;
+
+        int k = j;
+        int dist = 0;
+        while (true) {
+            if (_timestamp[k] == s.time) {
+                dist += _dist[k];
+                break;
+            }
+            dist += 1;
+            if (_parent[k] == TERMINAL) {
+                _timestamp[k] = s.time;
+                _dist[k] = 1;
+                break;
+            }
+            if (_parent[k] == ORPHAN) {
+                dist = INFINITE_DIST;
+                break;
+            }
+            k = neighbour(k, _parent[k]);
+        }
+
+        if (dist == INFINITE_DIST)
+            continue;
+
+        if (dist < minDist) {
+            bestDir = d;
+            minDist = dist;
+        }
+
+        for (k = j; _timestamp[k] != s.time; k = neighbour(k, _parent[k])) {
+            _timestamp[k] = s.time;
+            _dist[k] = dist;
+            dist -= 1;
+        }
+    }
+
+    if (bestDir != NONE) {
+        _parent[u] = (unsigned char)bestDir;
+        _timestamp[u] = s.time;
+        _dist[u] = minDist + 1;
+        return;
+    }
+
+    // no parent found: free the node and orphan its children
+    for (int d = 0; d < GRID_NUM_DIRECTIONS; d++) {
+        const int j = neighbour(u, d);
+        if ((_cap[d][u] <= T(0)) && (_cap[d ^ 1][j] <= T(0)))
+            continue;
+        if (_tree[j] != SINK)
+            continue;
+        if (_cap[d][u] > T(0)) {
+            setActive(s, j);
+        }
+        if (_parent[j] == (d ^ 1)) {
+            setOrphan(s, j);
+        }
+    }
+    _tree[u] = FREE;
+    _parent[u] = NONE;
+}
+
+template <typename T>
+void GridMaxFlow<T>::maxflow(SearchState &s)
+{
+    int current = -1;
+    while (true) {
+        // keep growing from the node that found the last path
+        int u = current;
+        if (u >= 0) {
+            _next[u] = -1;
+            if (_parent[u] == NONE) u = -1;
+        }
+        if (u < 0) {
+            u = nextActive(s);
+            if (u < 0) break;
+        }
+
+        // grow search tree
+        int pathDir = -1;
+        if (_tree[u] == SOURCE) {
+            for (int d = 0; d < GRID_NUM_DIRECTIONS; d++) {
+                if (_cap[d][u] <= T(0))
+                    continue;
+                const int j = neighbour(u, d);
+                if (_tree[j] == FREE) {
+                    _tree[j] = SOURCE;
+                    _parent[j] = (unsigned char)(d ^ 1);
+                    _timestamp[j] = _timestamp[u];
+                    _dist[j] = _dist[u] + 1;
+                    setActive(s, j);
+                } else if (_tree[j] == SINK) {
+                    pathDir = d;
+                    break;
+                } else if ((_timestamp[j] <= _timestamp[u]) && (_dist[j] > _dist[u])) {
+                    _parent[j] = (unsigned char)(d ^ 1);
+                    _timestamp[j] = _timestamp[u];
+                    _dist[j] = _dist[u] + 1;
+                }
+            }
+        } else {
+            for (int d = 0; d < GRID_NUM_DIRECTIONS; d++) {
+                const int j = neighbour(u, d);
+                if (_cap[d ^ 1][j] <= T(0))
+                    continue;
+                if (_tree[j] == FREE) {
+                    _tree[j] = SINK;
+                    _parent[j] = (unsigned char)(d ^ 1);
+                    _timestamp[j] = _timestamp[u];
+                    _dist[j] = _dist[u] + 1;
+                    setActive(s, j);
+                } else if (_tree[j] == SOURCE) {
+                    pathDir = d;
+                    break;
+                } else if ((_timestamp[j] <= _timestamp[u]) && (_dist[j] > _dist[u])) {
+                    _parent[j] = (unsigned char)(d ^ 1);
+                    _timestamp[j] = _timestamp[u];
+                    _dist[j] = _dist[u] + 1;
+                }
+            }
+        }
+
+        s.time += 1;
+
+        if (pathDir < 0) {
+            current = -1;
+            continue;
+        }
+
+        // mark u as active so that adoption does not queue it again
+        _next[u] = u;
+        current = u;
+
+        if (_tree[u] == SOURCE) {
+            augment(s, u, pathDir);
+        } else {
+            augment(s, neighbour(u, pathDir), pathDir ^ 1);
+        }
+        s.augmentations += 1;
+
+        // adopt orphans
+        while (s.orphanHead < s.orphans.size()) {
+            const int v = s.orphans[s.orphanHead++];
+            if (_tree[v] == SOURCE) {
+                adoptSourceOrphan(s, v);
+            } else {
+                adoptSinkOrphan(s, v);
+            }
+        }
+        s.adoptions += (int)s.orphans.size();
+        s.orphans.clear();
+        s.orphanHead = 0;
+    }
+}
@@ -16,11 +16,14 @@
 #include <iostream>
 #include <fstream>
 #include <iomanip>
+#include <map>
+#include <sys/time.h>
 
 // eigen matrix library headers
 #include "Eigen/Core"
 
 // openCV headers
+#include "cv.h"
 #include "cxcore.h"
 
 // darwin library headers
@@ -30,19 +33,317 @@
 #include "drwnPGM.h"
 #include "drwnVision.h"
 
+#include "gridMaxFlow.h"
+#include "pixelContrasts.h"
+#include "slicSuperpixels.h"
+#include "denseCRF.h"
+
 using namespace std;
 using namespace Eigen;
 
-// function prototypes --------------------------------------------------------
+// inference backends ---------------------------------------------------------
+
+// CRF_GRAPHCUT runs graph-cut inference directly on a max-flow graph and is
+// the production path. Two-label problems are solved exactly with a single
+// s-t min cut; more labels use alpha-expansion. CRF_EXPANSION forces
+// alpha-expansion even for two labels (useful for timing comparisons).
+// CRF_VERIFY additionally rebuilds the problem as a darwin factor graph,
+// runs generic alpha-expansion on it and reports any disagreement with the
+// graph-cut labelling. It is several times slower and should only be used
+// for testing. CRF_GRID solves the same problems as CRF_GRAPHCUT with
+// GridMaxFlow, which exploits the regular 8-connected structure of the graph
+// and stores capacities in single precision. CRF_PARALLEL is CRF_GRID using
+// drwnThreadPool::MAX_THREADS threads (set with -threads); it finds the same
+// labelling, but its speedup over CRF_GRID has only been measured on a
+// single core, where it is slower, so it is experimental rather than a
+// performance option (see benchCRF -scaling). CRF_QUANTIZED is
+// CRF_GRID with integer capacities: energies are rounded to multiples of
+// 1 / resolution (see CRFContext::setResolution), so the labelling is
+// optimal for the rounded problem only. CRF_DENSE is not a graph-cut: it
+// replaces the pairwise terms by a fully connected CRF with Gaussian edge
+// potentials (see denseCRF.h) and runs mean-field inference on
+// drwnThreadPool::MAX_THREADS threads. It needs the image itself rather
+// than its contrast weights, and its labelling is approximate.
+typedef enum {
+    CRF_GRAPHCUT = 0,
+    CRF_EXPANSION,
+    CRF_VERIFY,
+    CRF_GRID,
+    CRF_PARALLEL,
+    CRF_QUANTIZED,
+    CRF_DENSE
+} CRFBackend;
+
+CRFBackend parseCRFBackend(const char *name)
+{
+    if (string(name).compare("graphcut") == 0) return CRF_GRAPHCUT;
+    if (string(name).compare("expansion") == 0) return CRF_EXPANSION;
+    if (string(name).compare("verify") == 0) return CRF_VERIFY;
+    if (string(name).compare("grid") == 0) return CRF_GRID;
+    if (string(name).compare("parallel") == 0) return CRF_PARALLEL;
+    if (string(name).compare("quantized") == 0) return CRF_QUANTIZED;
+    if (string(name).compare("dense") == 0) return CRF_DENSE;
+    DRWN_LOG_FATAL("unknown CRF backend " << name);
+    return CRF_GRAPHCUT;
+}
+
+const char *crfBackendName(CRFBackend backend)
+{
+    switch (backend) {
+    case CRF_GRAPHCUT: return "graphcut";
+    case CRF_EXPANSION: return "expansion";
+    case CRF_VERIFY: return "verify";
+    case CRF_GRID: return "grid";
+    case CRF_PARALLEL: return "parallel";
+    case CRF_QUANTIZED: return "quantized";
+    case CRF_DENSE: return "dense";
+    }
+    return "unknown";
+}
+
+// wall-clock time in seconds, for timing individual CRF calls
+double crfWallTime()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (double)tv.tv_sec + 1.0e-6 * (double)tv.tv_usec;
+}
+
+// telemetry ------------------------------------------------------------------
+
+// Metrics of one CRFContext inference call. The inference functions only
+// fill a record when passed a non-NULL pointer, so disabled telemetry costs
+// a pointer test per graph build and solve. Counts that darwin's max-flow
+// solver does not expose are -1. The energy is that of the grid CRF
+// (crfEnergy) for every backend, including CRF_DENSE. The backend field
+// names the mode of the approximate and incremental calls ("banded",
+// "superpixels", "sweep" and "video"), whose node and edge counts are those
+// of the graphs they actually solve. Moves whose solver does not give the
+// energy of the full labelling are recorded with the final energy.
+struct CRFTelemetry {
+    string tag;                 // image identifier supplied by the caller
+    string backend;
+    int width, height, labels, connectivity;
+    double lambda;
+    int nodes;                  // nodes of the max-flow graph
+    int edges;                  // pairwise edges of the max-flow graph
+    int moves;                  // max-flow solves or mean-field iterations
+    double buildTime;           // graph construction (seconds)
+    double solveTime;           // max-flow or mean-field (seconds)
+    double totalTime;           // whole call without telemetry (seconds)
+    long augmentations;         // augmenting paths over all solves
+    long adoptions;             // orphans processed over all solves
+    vector<double> energies;    // energy after each move, or the final one
+    double energy;              // energy of the final labelling
+    int changed;                // pixels not labelled with their unary argmin
+
+    CRFTelemetry() { clear(); }
+
+    void clear();
+    // adds the time since mark to the build or solve time and resets mark
+    void addBuild(double &mark) { buildTime += lap(mark); }
+    void addSolve(double &mark, double e) {
+        solveTime += lap(mark);
+        moves += 1;
+        energies.push_back(e);
+    }
+    // writes the record as one line of JSON
+    void write(ostream &os) const;
+
+    static double lap(double &mark) {
+        const double now = crfWallTime();
+        const double elapsed = now - mark;
+        mark = now;
+        return elapsed;
+    }
+};
+
+void CRFTelemetry::clear()
+{
+    backend.clear();
+    width = height = labels = connectivity = 0;
+    lambda = 0.0;
+    nodes = edges = moves = 0;
+    buildTime = solveTime = totalTime = 0.0;
+    augmentations = adoptions = 0;
+    energies.clear();
+    energy = 0.0;
+    changed = 0;
+}
+
+void CRFTelemetry::write(ostream &os) const
+{
+    const streamsize savedPrecision = os.precision(10);
+    os << "{\"tag\":\"";
+    for (size_t i = 0; i < tag.size(); i++) {
+        if ((tag[i] == '"') || (tag[i] == '\\')) os << '\\';
+        os << tag[i];
+    }
+    os << "\",\"backend\":\"" << backend << "\""
+       << ",\"width\":" << width << ",\"height\":" << height
+       << ",\"labels\":" << labels << ",\"connectivity\":" << connectivity
+       << ",\"lambda\":" << lambda
+       << ",\"nodes\":" << nodes << ",\"edges\":" << edges << ",\"moves\":" << moves
+       << ",\"build_ms\":" << 1000.0 * buildTime << ",\"solve_ms\":" << 1000.0 * solveTime
+       << ",\"total_ms\":" << 1000.0 * totalTime
+       << ",\"augmentations\":" << augmentations << ",\"adoptions\":" << adoptions
+       << ",\"energy\":" << energy << ",\"changed\":" << changed
+       << ",\"energies\":[";
+    for (size_t i = 0; i < energies.size(); i++) {
+        os << (i == 0 ? "" : ",") << energies[i];
+    }
+    os << "]}" << endl;
+    os.precision(savedPrecision);
+}
+
+// pairwise neighbourhoods ----------------------------------------------------
+
+// Each pixel (x, y) is joined to the earlier neighbours (x + CRF_NEIGHBOUR_DX[k],
+// y + CRF_NEIGHBOUR_DY[k]) for k < SIZE of the neighbourhood descriptor, in the
+// order W, N, NW, SW, so every edge is visited exactly once. The edge to
+// neighbour k has weight lambda * crfContrast(contrast, k, x, y).
+typedef enum {
+    CRF_4_CONNECTED = 4,
+    CRF_8_CONNECTED = 8
+} CRFNeighbourhood;
+
+struct CRFFourConnected { enum { SIZE = 2 }; };
+struct CRFEightConnected { enum { SIZE = 4 }; };
+
+static const int CRF_NEIGHBOUR_DX[4] = {-1, 0, -1, -1};
+static const int CRF_NEIGHBOUR_DY[4] = {0, -1, -1, 1};
+static const int CRF_NEIGHBOUR_GRID[4] = {GRID_W, GRID_N, GRID_NW, GRID_SW};
+
+CRFNeighbourhood parseCRFNeighbourhood(int connectivity)
+{
+    if (connectivity == 4) return CRF_4_CONNECTED;
+    if (connectivity == 8) return CRF_8_CONNECTED;
+    DRWN_LOG_FATAL("unsupported pixel connectivity " << connectivity);
+    return CRF_8_CONNECTED;
+}
 
-void addUnaryTerms(drwnMaxFlow *g, const vector< cv::Mat > unary,
-    const cv::Mat labels, int alpha);
+inline double crfContrast(const PixelContrasts &contrast, int k, int x, int y)
+{
+    switch (k) {
+    case 0: return contrast.contrastW(x, y);
+    case 1: return contrast.contrastN(x, y);
+    case 2: return contrast.contrastNW(x, y);
+    default: return contrast.contrastSW(x, y);
+    }
+}
+
+// converts an energy to a max-flow capacity of type T; integer capacities
+// are rounded to the nearest multiple of 1 / scale
+template <typename T>
+inline T crfCapacity(double v, double scale)
+{
+    if (!numeric_limits<T>::is_integer) return (T)(v * scale);
+    const double c = floor(v * scale + 0.5);
+    DRWN_ASSERT_MSG(c <= (double)(numeric_limits<T>::max() / 16),
+        "energy " << v << " overflows integer capacities at resolution " << scale);
+    return (T)c;
+}
 
-void addPairwiseTerms(drwnMaxFlow *g, const drwnPixelNeighbourContrasts contrast,
-    double lambda, const cv::Mat labels, int alpha);
+// number of pairwise edges of an H-by-W image
+int crfEdgeCount(int W, int H, CRFNeighbourhood neighbourhood)
+{
+    const int n = (W - 1) * H + W * (H - 1);
+    return (neighbourhood == CRF_4_CONNECTED) ? n : n + 2 * (W - 1) * (H - 1);
+}
 
-cv::Mat alphaExpansionTest( vector< cv::Mat > unary,
-    const drwnPixelNeighbourContrasts &contrast, double lambda);
+// Calls builder(x, y, xx, yy, k, w) for every pairwise edge of the
+// neighbourhood, visiting pixels in row-major (cv::Mat memory) order.
+template <class Neighbourhood, class EdgeBuilder>
+void buildPairwiseTerms(const PixelContrasts &contrast, double lambda,
+    EdgeBuilder &builder)
+{
+    const int H = contrast.height();
+    const int W = contrast.width();
+
+    for (int y = 0; y < H; y++) {
+        for (int x = 0; x < W; x++) {
+            for (int k = 0; k < (int)Neighbourhood::SIZE; k++) {
+                const int xx = x + CRF_NEIGHBOUR_DX[k];
+                const int yy = y + CRF_NEIGHBOUR_DY[k];
+                if ((xx < 0) || (yy < 0) || (yy >= H)) continue;
+                builder(x, y, xx, yy, k, lambda * crfContrast(contrast, k, x, y));
+            }
+        }
+    }
+}
+
+template <class EdgeBuilder>
+void buildPairwiseTerms(const PixelContrasts &contrast, double lambda,
+    CRFNeighbourhood neighbourhood, EdgeBuilder &builder)
+{
+    if (neighbourhood == CRF_4_CONNECTED) {
+        buildPairwiseTerms<CRFFourConnected>(contrast, lambda, builder);
+    } else {
+        buildPairwiseTerms<CRFEightConnected>(contrast, lambda, builder);
+    }
+}
+
+// function prototypes --------------------------------------------------------
+
+void addUnaryTerms(drwnMaxFlow *g, const vector< cv::Mat > &unary,
+    const cv::Mat &labels, int alpha);
+
+void addPairwiseTerms(drwnMaxFlow *g, const PixelContrasts &contrast,
+    double lambda, CRFNeighbourhood neighbourhood = CRF_8_CONNECTED);
+
+void addPairwiseTerms(drwnMaxFlow *g, const PixelContrasts &contrast,
+    double lambda, const cv::Mat &labels, int alpha,
+    CRFNeighbourhood neighbourhood = CRF_8_CONNECTED);
+
+void binaryGraphCut(drwnMaxFlow *g, const vector< cv::Mat > &unary,
+    const PixelContrasts &contrast, double lambda, cv::Mat &labels,
+    CRFNeighbourhood neighbourhood = CRF_8_CONNECTED, CRFTelemetry *telemetry = NULL);
+
+void alphaExpansion(drwnMaxFlow *g, const vector< cv::Mat > &unary,
+    const PixelContrasts &contrast, double lambda, cv::Mat &labels,
+    CRFNeighbourhood neighbourhood = CRF_8_CONNECTED, CRFTelemetry *telemetry = NULL);
+
+// Grid max-flow versions. Energies are multiplied by scale and converted to
+// capacities with crfCapacity<T>(), so with integer T they are quantized to
+// multiples of 1 / scale. With nThreads > 1 the graph is solved with
+// GridMaxFlow::solveParallel() on threadPool, if given.
+template <typename T>
+void binaryGraphCut(GridMaxFlow<T> &g, const vector< cv::Mat > &unary,
+    const PixelContrasts &contrast, double lambda, cv::Mat &labels,
+    unsigned nThreads = 1, CRFNeighbourhood neighbourhood = CRF_8_CONNECTED,
+    double scale = 1.0, CRFTelemetry *telemetry = NULL,
+    drwnThreadPool *threadPool = NULL);
+
+template <typename T>
+void alphaExpansion(GridMaxFlow<T> &g, const vector< cv::Mat > &unary,
+    const PixelContrasts &contrast, double lambda, cv::Mat &labels,
+    unsigned nThreads = 1, CRFNeighbourhood neighbourhood = CRF_8_CONNECTED,
+    double scale = 1.0, CRFTelemetry *telemetry = NULL,
+    drwnThreadPool *threadPool = NULL);
+
+template <typename T>
+void addPairwiseTerms(GridMaxFlow<T> &g, const PixelContrasts &contrast,
+    double lambda, CRFNeighbourhood neighbourhood = CRF_8_CONNECTED, double scale = 1.0);
+
+// Solves the two-label CRF for each pairwise weight in lambdas (ascending).
+// Raising lambda only adds capacity to the pairwise edges, so the flow of
+// one solve remains feasible for the next and the search continues from its
+// residual graph instead of starting again. The weight scales both sides of
+// every pairwise edge, which is not a monotone parametric problem, so the
+// labellings need not be nested; breakpoints lists the weights at which the
+// labelling differs from that of the previous weight.
+void parametricGraphCut(GridMaxFlow<float> &g, const vector< cv::Mat > &unary,
+    const PixelContrasts &contrast, const vector<double> &lambdas,
+    vector<cv::Mat> &labels, vector<double> &breakpoints,
+    CRFNeighbourhood neighbourhood = CRF_8_CONNECTED, CRFTelemetry *telemetry = NULL);
+
+cv::Mat alphaExpansionTest(const vector< cv::Mat > &unary,
+    const PixelContrasts &contrast, double lambda,
+    CRFNeighbourhood neighbourhood = CRF_8_CONNECTED);
+
+double crfEnergy(const vector< cv::Mat > &unary,
+    const PixelContrasts &contrast, double lambda, const cv::Mat &labels,
+    CRFNeighbourhood neighbourhood = CRF_8_CONNECTED);
 
 // main -----------------------------------------------------------------------
 
@@ -62,31 +363,876 @@ void usage()
 }
 */
 
-cv::Mat mexFunction(cv::Mat img, vector< cv::Mat > unary, const double lambda)
+// CRFContext holds everything needed to run the CRF on a sequence of images:
+// the max-flow graph, the pairwise contrast weights and the label buffer. The
+// graph is sized for the largest image seen so far and reset between images,
+// so a batch of equally sized images does no allocation of its own after the
+// first call. Inputs are taken by reference and the image pixels are read in
+// place.
+class CRFContext {
+ protected:
+    drwnMaxFlow *_graph;                    // max-flow graph (owned)
+    int _maxNodes;                          // number of nodes in _graph
+    GridMaxFlow<float> _grid;               // grid max-flow graph
+    GridMaxFlow<int> _intGrid;              // grid graph of CRF_QUANTIZED
+    double _resolution;                     // capacity units per unit energy
+    PixelContrasts _imageContrast;          // contrast weights of last image
+    const PixelContrasts *_contrast;        // contrast weights in use
+    cv::Mat _labels;                        // labelling of last image
+    DenseCRF _dense;                        // kernels of CRF_DENSE
+    DenseCRFParameters _denseParams;        // kernel widths and iterations
+    drwnThreadPool *_threadPool;            // workers of CRF_PARALLEL and CRF_DENSE (owned)
+    unsigned _poolThreads;                  // number of threads in _threadPool
+
+    // terminal and pairwise capacities of the last video frame held in
+    // _grid (empty when _grid holds no frame)
+    vector<float> _frameUnary;
+    vector<float> _frameWeights;
+
+    // coarse problem and band of coarse-to-fine inference
+    cv::Mat _coarseImage;
+    vector<cv::Mat> _coarseUnary;
+    PixelContrasts _coarseContrast;
+    cv::Mat _coarseLabels;
+    cv::Mat _band;                          // CV_8U, non-zero inside the band
+    cv::Mat _bandIndex;                     // CV_32S, graph node or -1
+    vector<double> _bandUnary;              // unary terms of band nodes
+    int _bandSize;                          // number of pixels in the band
+
+    // superpixel problem
+    cv::Mat _segments;                      // CV_32S, region of each pixel
+    vector<double> _regionUnary;            // unary terms of region nodes
+    int _nRegions;                          // number of regions
+
+    CRFNeighbourhood _neighbourhood;        // pixel connectivity
+
+    ostream *_telemetryStream;              // telemetry output or NULL
+    string _telemetryTag;                   // image identifier for telemetry
+    CRFTelemetry _telemetry;                // record of last inference call
+
+    // edge builders for the band and region graphs
+    struct BandEdgeBuilder {
+        CRFContext *crf;
+        int nEdges;                         // edges joining two band nodes
+        void operator()(int x, int y, int xx, int yy, int /*k*/, double w) {
+            if (crf->addBandEdge(x, y, xx, yy, w)) nEdges += 1;
+        }
+    };
+    struct RegionEdgeBuilder {
+        const CRFContext *crf;
+        map<long long, double> *edges;
+        void operator()(int x, int y, int xx, int yy, int /*k*/, double w) {
+            crf->addRegionEdge(*edges, x, y, xx, yy, w);
+        }
+    };
+
+ public:
+    CRFContext();
+    ~CRFContext();
+
+    // Runs inference on an image with H-by-W-by-L unary potentials (one
+    // CV_64F plane per label) and returns an H-by-W CV_16S labelling. The
+    // result shares the context's label buffer and is overwritten by the
+    // next call; clone it to keep it.
+    const cv::Mat& infer(const cv::Mat& img, const vector< cv::Mat >& unary,
+        double lambda, CRFBackend backend = CRF_GRAPHCUT);
+    // As above with the contrast weights of the image computed beforehand,
+    // so that they can be reused across pairwise weights and backends. The
+    // weights must outlive any later use of contrast().
+    const cv::Mat& infer(const PixelContrasts& contrast, const vector< cv::Mat >& unary,
+        double lambda, CRFBackend backend = CRF_GRAPHCUT);
+
+    // Mean-field inference in the fully connected CRF of CRF_DENSE. lambda
+    // weights the appearance kernel.
+    const cv::Mat& inferDense(const cv::Mat& img, const vector< cv::Mat >& unary,
+        double lambda);
+
+    // Runs two-label inference on the next frame of a video. The residual
+    // graph and search trees of the previous frame are kept and only the
+    // capacities that changed are updated before re-solving (dynamic graph
+    // cuts, Kohli and Torr, 2005). The first frame, a change of frame size
+    // or any other call to infer() starts again from scratch.
+    const cv::Mat& inferNextFrame(const cv::Mat& img, const vector< cv::Mat >& unary,
+        double lambda);
+
+    // Coarse-to-fine two-label inference. The CRF is first solved on the
+    // image and unary potentials downsampled by factor (with the pairwise
+    // weight divided by factor to keep its balance with the averaged
+    // unaries). The upsampled labelling is then refined at full resolution
+    // only within bandWidth pixels of its boundary, with pixels outside the
+    // band keeping their coarse label. The result is approximate.
+    const cv::Mat& inferBanded(const cv::Mat& img, const vector< cv::Mat >& unary,
+        double lambda, int factor, int bandWidth);
+
+    // Solves a two-label CRF for every pairwise weight in lambdas (sorted
+    // ascending) in one pass, see parametricGraphCut(). Returns the
+    // labelling for each weight and the weights at which it changed.
+    void inferSweep(const cv::Mat& img, const vector< cv::Mat >& unary,
+        const vector<double>& lambdas, vector<cv::Mat>& labels,
+        vector<double>& breakpoints);
+    void inferSweep(const PixelContrasts& contrast, const vector< cv::Mat >& unary,
+        const vector<double>& lambdas, vector<cv::Mat>& labels,
+        vector<double>& breakpoints);
+
+    // Two-label inference on SLIC superpixels of about regionSize-by-
+    // regionSize pixels. Each region takes the summed unary potentials of
+    // its pixels, and adjacent regions are joined by the summed pairwise
+    // weights of the pixel edges along their shared boundary, so that a
+    // region labelling has the same energy as the corresponding pixel
+    // labelling. The result is approximate since regions cannot be split.
+    const cv::Mat& inferSuperpixels(const cv::Mat& img, const vector< cv::Mat >& unary,
+        double lambda, int regionSize, double compactness = 10.0);
+
+    // Selects 4- or 8-connected (default) pairwise terms for all inference
+    // modes.
+    void setNeighbourhood(CRFNeighbourhood neighbourhood) { _neighbourhood = neighbourhood; }
+    CRFNeighbourhood neighbourhood() const { return _neighbourhood; }
+
+    // Sets the number of integer capacity units per unit of energy used by
+    // CRF_QUANTIZED (default 1000). Larger values give a smaller energy gap
+    // to the exact solution but must keep every capacity well inside the
+    // int range.
+    void setResolution(double resolution) { _resolution = resolution; }
+    double resolution() const { return _resolution; }
+
+    // Sets the kernel widths and number of mean-field iterations of
+    // CRF_DENSE.
+    void setDenseParameters(const DenseCRFParameters& params) { _denseParams = params; }
+    const DenseCRFParameters& denseParameters() const { return _denseParams; }
+
+    // Writes a CRFTelemetry record of every inference call to os as one
+    // line of JSON, or stops when os is NULL. The tag identifies the image
+    // in the following records.
+    void setTelemetry(ostream *os) { _telemetryStream = os; }
+    void setTelemetryTag(const string& tag) { _telemetryTag = tag; }
+    // record of the last inference call made with telemetry enabled
+    const CRFTelemetry& telemetry() const { return _telemetry; }
+
+    const PixelContrasts& contrast() const { return *_contrast; }
+    // size of the full resolution graph of the last inferBanded() call
+    int bandSize() const { return _bandSize; }
+    // number of regions of the last inferSuperpixels() call
+    int regionCount() const { return _nRegions; }
+
+ protected:
+    void prepare(const cv::Mat& img, const vector< cv::Mat >& unary);
+    void prepare(const PixelContrasts& contrast, const vector< cv::Mat >& unary);
+    bool addBandEdge(int xp, int yp, int xq, int yq, double w);
+    void addRegionEdge(map<long long, double>& edges, int xp, int yp,
+        int xq, int yq, double w) const;
+    void reserve(int nNodes);
+    // the thread pool of CRF_PARALLEL and CRF_DENSE, sized by
+    // drwnThreadPool::MAX_THREADS
+    drwnThreadPool *threadPool();
+    CRFTelemetry *beginTelemetry(const char *backend, int width, int height,
+        const vector< cv::Mat >& unary, double lambda);
+    void endTelemetry(const vector< cv::Mat >& unary, double lambda, const cv::Mat& labels,
+        double startTime);
+};
+
+CRFContext::CRFContext() : _graph(NULL), _maxNodes(0), _resolution(1000.0), _threadPool(NULL),
+    _poolThreads(0), _bandSize(0), _nRegions(0), _neighbourhood(CRF_8_CONNECTED),
+    _telemetryStream(NULL)
+{
+    _contrast = &_imageContrast;
+    // do nothing
+}
+
+CRFContext::~CRFContext()
+{
+    if (_graph != NULL) {
+        delete _graph;
+    }
+    if (_threadPool != NULL) {
+        delete _threadPool;
+    }
+}
+
+drwnThreadPool *CRFContext::threadPool()
 {
-    // parse image
-    IplImage temp  = (IplImage) img;
-    IplImage *image = cvCloneImage( & temp );
-    const int H = image->height;
-    const int W = image->width;
+    // kept across images, and only replaced when -threads changes
+    if ((_threadPool == NULL) || (_poolThreads != drwnThreadPool::MAX_THREADS)) {
+        if (_threadPool != NULL) delete _threadPool;
+        _poolThreads = drwnThreadPool::MAX_THREADS;
+        _threadPool = new drwnThreadPool(_poolThreads);
+    }
+    return _threadPool;
+}
 
-    drwnPixelNeighbourContrasts contrast;
-    contrast.initialize(image);
+const cv::Mat& CRFContext::infer(const cv::Mat& img, const vector< cv::Mat >& unary,
+    double lambda, CRFBackend backend)
+{
+    if (backend == CRF_DENSE) {
+        return inferDense(img, unary, lambda);
+    }
+    _imageContrast.initialize(img);
+    return infer(_imageContrast, unary, lambda, backend);
+}
 
-    // parse unary potentials
+const cv::Mat& CRFContext::infer(const PixelContrasts& contrast, const vector< cv::Mat >& unary,
+    double lambda, CRFBackend backend)
+{
+    DRWN_FCN_TIC;
+
+    prepare(contrast, unary);
+    const int H = contrast.height();
+    const int W = contrast.width();
     const int L = (int) unary.size();
-    DRWN_ASSERT_MSG(L > 1, "invalid number of labels");
-    DRWN_ASSERT_MSG((unary[0].rows == H) && (unary[0].cols == W),
-        "unary potentials must match image size " << H << "-by-" << W);
 
     // parse pairwise contrast weight
-    //const double lambda = mxGetScalar(prhs[2]);
     DRWN_ASSERT_MSG(lambda >= 0.0, "lambda must be non-negative");
+    DRWN_ASSERT_MSG(backend != CRF_DENSE, "dense CRF inference needs the image");
 
-    // initialize labeling
-    cv::Mat labels = cv::Mat::zeros(H, W, CV_16S);
-    for (int x = 0; x < W; x++) {
+    const double startTime = (_telemetryStream != NULL) ? crfWallTime() : 0.0;
+    CRFTelemetry *telemetry = beginTelemetry(crfBackendName(backend), W, H, unary, lambda);
+
+    // run inference
+    _frameUnary.clear();
+    _labels.create(H, W, CV_16S);
+    if ((backend == CRF_GRID) || (backend == CRF_PARALLEL)) {
+        const unsigned nThreads = (backend == CRF_PARALLEL) ? drwnThreadPool::MAX_THREADS : 1;
+        drwnThreadPool *pool = (nThreads > 1) ? threadPool() : NULL;
+        if (L == 2) {
+            binaryGraphCut(_grid, unary, *_contrast, lambda, _labels, nThreads, _neighbourhood,
+                1.0, telemetry, pool);
+        } else {
+            alphaExpansion(_grid, unary, *_contrast, lambda, _labels, nThreads, _neighbourhood,
+                1.0, telemetry, pool);
+        }
+    } else if (backend == CRF_QUANTIZED) {
+        DRWN_ASSERT_MSG(_resolution > 0.0, "invalid quantization resolution");
+        if (L == 2) {
+            binaryGraphCut(_intGrid, unary, *_contrast, lambda, _labels, 1, _neighbourhood,
+                _resolution, telemetry);
+        } else {
+            alphaExpansion(_intGrid, unary, *_contrast, lambda, _labels, 1, _neighbourhood,
+                _resolution, telemetry);
+        }
+    } else {
+        reserve(H * W);
+        if (telemetry != NULL) {
+            // darwin's max-flow does not report its search
+            telemetry->augmentations = telemetry->adoptions = -1;
+        }
+        if ((L == 2) && (backend != CRF_EXPANSION)) {
+            binaryGraphCut(_graph, unary, *_contrast, lambda, _labels, _neighbourhood, telemetry);
+        } else {
+            alphaExpansion(_graph, unary, *_contrast, lambda, _labels, _neighbourhood, telemetry);
+        }
+    }
+
+    if (telemetry != NULL) {
+        endTelemetry(unary, lambda, _labels, startTime);
+    }
+
+    // cross-check against darwin's factor graph inference
+    if (backend == CRF_VERIFY) {
+        cv::Mat testLabels = alphaExpansionTest(unary, *_contrast, lambda, _neighbourhood);
+        int nDiffering = 0;
+        for (int y = 0; y < H; y++) {
+            for (int x = 0; x < W; x++) {
+                if (testLabels.at<short>(y, x) != _labels.at<short>(y, x))
+                    nDiffering += 1;
+            }
+        }
+        const double eGraphCut = crfEnergy(unary, *_contrast, lambda, _labels, _neighbourhood);
+        const double eFactorGraph = crfEnergy(unary, *_contrast, lambda, testLabels, _neighbourhood);
+        DRWN_LOG_MESSAGE("CRF verification: graph-cut energy " << eGraphCut
+            << ", factor graph energy " << eFactorGraph << ", "
+            << nDiffering << " of " << H * W << " pixels differ");
+        if (eGraphCut > eFactorGraph + 1.0e-6 * fabs(eFactorGraph)) {
+            DRWN_LOG_WARNING("graph-cut labelling has higher energy than factor graph inference");
+        }
+    }
+
+    DRWN_FCN_TOC;
+    return _labels;
+}
+
+const cv::Mat& CRFContext::inferDense(const cv::Mat& img, const vector< cv::Mat >& unary,
+    double lambda)
+{
+    DRWN_FCN_TIC;
+    DRWN_ASSERT_MSG(lambda >= 0.0, "lambda must be non-negative");
+    DRWN_ASSERT_MSG(unary.size() > 1, "invalid number of labels");
+    DRWN_ASSERT_MSG(_denseParams.nIterations >= 0, "invalid number of mean-field iterations");
+
+    double mark = (_telemetryStream != NULL) ? crfWallTime() : 0.0;
+    const double startTime = mark;
+    CRFTelemetry *telemetry = beginTelemetry(crfBackendName(CRF_DENSE), img.cols, img.rows,
+        unary, lambda);
+
+    _frameUnary.clear();
+    drwnThreadPool *pool = (drwnThreadPool::MAX_THREADS > 1) ? threadPool() : NULL;
+    _dense.initialize(img, _denseParams, drwnThreadPool::MAX_THREADS, pool);
+    if (telemetry != NULL) telemetry->addBuild(mark);
+    _dense.inference(unary, lambda, _denseParams, _labels, drwnThreadPool::MAX_THREADS, pool);
+
+    if (telemetry != NULL) {
+        // the energy is that of the grid CRF, so it needs the contrast
+        // weights of the image
+        telemetry->solveTime += CRFTelemetry::lap(mark);
+        telemetry->moves = _denseParams.nIterations;
+        telemetry->edges = 0;
+        telemetry->augmentations = telemetry->adoptions = -1;
+        _imageContrast.initialize(img);
+        _contrast = &_imageContrast;
+        endTelemetry(unary, lambda, _labels, startTime);
+    }
+
+    DRWN_FCN_TOC;
+    return _labels;
+}
+
+const cv::Mat& CRFContext::inferNextFrame(const cv::Mat& img, const vector< cv::Mat >& unary,
+    double lambda)
+{
+    DRWN_FCN_TIC;
+
+    prepare(img, unary);
+    DRWN_ASSERT_MSG(unary.size() == 2, "dynamic inference needs two labels");
+    DRWN_ASSERT_MSG(lambda >= 0.0, "lambda must be non-negative");
+    const int H = img.rows;
+    const int W = img.cols;
+
+    double mark = (_telemetryStream != NULL) ? crfWallTime() : 0.0;
+    const double startTime = mark;
+    CRFTelemetry *telemetry = beginTelemetry("video", W, H, unary, lambda);
+
+    // terminal capacity (source minus sink) of each pixel and the pairwise
+    // capacity of its W, N, NW and SW edges
+    const bool bFirstFrame = (_frameUnary.size() != (size_t)(H * W)) ||
+        (_grid.width() != W) || (_grid.height() != H);
+    if (bFirstFrame) {
+        _grid.reset(W, H);
+        _frameUnary.assign(H * W, 0.0f);
+        _frameWeights.assign(4 * H * W, 0.0f);
+    }
+
+    const int nNeighbours = (_neighbourhood == CRF_4_CONNECTED) ?
+        (int)CRFFourConnected::SIZE : (int)CRFEightConnected::SIZE;
+    for (int y = 0; y < H; y++) {
+        for (int x = 0; x < W; x++) {
+            const int i = y * W + x;
+
+            const float u = (float)(unary[0].at<double>(y, x) - unary[1].at<double>(y, x));
+            if (u != _frameUnary[i]) {
+                _grid.updateTerminalEdges(x, y, u - _frameUnary[i], 0.0f);
+                _frameUnary[i] = u;
+            }
+
+            for (int k = 0; k < nNeighbours; k++) {
+                const int xx = x + CRF_NEIGHBOUR_DX[k];
+                const int yy = y + CRF_NEIGHBOUR_DY[k];
+                if ((xx < 0) || (yy < 0) || (yy >= H)) continue;
+                const float w = (float)(lambda * crfContrast(*_contrast, k, x, y));
+                const float delta = w - _frameWeights[4 * i + k];
+                if (delta != 0.0f) {
+                    _grid.updateEdge(x, y, CRF_NEIGHBOUR_GRID[k], delta, delta);
+                    _frameWeights[4 * i + k] = w;
+                }
+            }
+        }
+    }
+
+    // run inference; the search counts of the grid run from its last reset
+    if (telemetry != NULL) {
+        telemetry->addBuild(mark);
+        telemetry->augmentations = -_grid.numAugmentations();
+        telemetry->adoptions = -_grid.numAdoptions();
+    }
+    if (bFirstFrame) {
+        _grid.solve();
+    } else {
+        _grid.resolve();
+    }
+    if (telemetry != NULL) {
+        telemetry->solveTime += CRFTelemetry::lap(mark);
+        telemetry->moves += 1;
+        telemetry->augmentations += _grid.numAugmentations();
+        telemetry->adoptions += _grid.numAdoptions();
+    }
+
+    _labels.create(H, W, CV_16S);
+    for (int y = 0; y < H; y++) {
+        for (int x = 0; x < W; x++) {
+            _labels.at<short>(y, x) = _grid.inSetS(x, y) ? 1 : 0;
+        }
+    }
+
+    if (telemetry != NULL) {
+        endTelemetry(unary, lambda, _labels, startTime);
+    }
+
+    DRWN_FCN_TOC;
+    return _labels;
+}
+
+const cv::Mat& CRFContext::inferBanded(const cv::Mat& img, const vector< cv::Mat >& unary,
+    double lambda, int factor, int bandWidth)
+{
+    DRWN_FCN_TIC;
+
+    prepare(img, unary);
+    DRWN_ASSERT_MSG(unary.size() == 2, "coarse-to-fine inference needs two labels");
+    DRWN_ASSERT_MSG(lambda >= 0.0, "lambda must be non-negative");
+    DRWN_ASSERT_MSG((factor >= 1) && (bandWidth >= 0), "invalid coarse-to-fine parameters");
+    const int H = img.rows;
+    const int W = img.cols;
+    const int Hc = (H + factor - 1) / factor;
+    const int Wc = (W + factor - 1) / factor;
+
+    // the record sums the nodes and edges of the coarse and band graphs
+    double mark = (_telemetryStream != NULL) ? crfWallTime() : 0.0;
+    const double startTime = mark;
+    CRFTelemetry *telemetry = beginTelemetry("banded", W, H, unary, lambda);
+    if (telemetry != NULL) {
+        telemetry->nodes = Wc * Hc;
+        telemetry->edges = (lambda > 0.0) ? crfEdgeCount(Wc, Hc, _neighbourhood) : 0;
+    }
+
+    // solve the coarse problem
+    cv::resize(img, _coarseImage, cv::Size(Wc, Hc), 0, 0, cv::INTER_AREA);
+    _coarseContrast.initialize(_coarseImage);
+    _coarseUnary.resize(2);
+    for (int l = 0; l < 2; l++) {
+        cv::resize(unary[l], _coarseUnary[l], cv::Size(Wc, Hc), 0, 0, cv::INTER_AREA);
+    }
+    _coarseLabels.create(Hc, Wc, CV_16S);
+    _frameUnary.clear();
+    if (telemetry != NULL) telemetry->addBuild(mark);
+    binaryGraphCut(_grid, _coarseUnary, _coarseContrast, lambda / factor, _coarseLabels,
+        1, _neighbourhood, 1.0, telemetry);
+
+    // upsample the labelling and mark its boundary
+    _labels.create(H, W, CV_16S);
+    for (int y = 0; y < H; y++) {
+        for (int x = 0; x < W; x++) {
+            _labels.at<short>(y, x) = _coarseLabels.at<short>(y * Hc / H, x * Wc / W);
+        }
+    }
+    if (telemetry != NULL) {
+        // record the coarse move with the energy of its full resolution labelling
+        telemetry->energies.back() = crfEnergy(unary, *_contrast, lambda, _labels, _neighbourhood);
+        mark = crfWallTime();
+    }
+
+    _band.create(H, W, CV_8UC1);
+    for (int y = 0; y < H; y++) {
+        for (int x = 0; x < W; x++) {
+            const short l = _labels.at<short>(y, x);
+            _band.at<unsigned char>(y, x) =
+                (((x > 0) && (_labels.at<short>(y, x - 1) != l)) ||
+                 ((x < W - 1) && (_labels.at<short>(y, x + 1) != l)) ||
+                 ((y > 0) && (_labels.at<short>(y - 1, x) != l)) ||
+                 ((y < H - 1) && (_labels.at<short>(y + 1, x) != l))) ? 255 : 0;
+        }
+    }
+    if (bandWidth > 0) {
+        cv::dilate(_band, _band, cv::Mat(), cv::Point(-1, -1), bandWidth);
+    }
+
+    // number the pixels in the band
+    _bandIndex.create(H, W, CV_32S);
+    int nBand = 0;
+    for (int y = 0; y < H; y++) {
+        for (int x = 0; x < W; x++) {
+            _bandIndex.at<int>(y, x) = _band.at<unsigned char>(y, x) ? nBand++ : -1;
+        }
+    }
+    DRWN_LOG_VERBOSE("...coarse-to-fine band has " << nBand << " of " << H * W << " pixels");
+    _bandSize = nBand;
+
+    if (nBand > 0) {
+        reserve(nBand);
+        _graph->reset();
+
+        _bandUnary.resize(2 * nBand);
         for (int y = 0; y < H; y++) {
+            for (int x = 0; x < W; x++) {
+                const int i = _bandIndex.at<int>(y, x);
+                if (i < 0) continue;
+                _bandUnary[2 * i] = unary[0].at<double>(y, x);
+                _bandUnary[2 * i + 1] = unary[1].at<double>(y, x);
+            }
+        }
+
+        // add pairwise terms touching the band
+        int nBandEdges = 0;
+        if (lambda > 0.0) {
+            BandEdgeBuilder builder = {this, 0};
+            buildPairwiseTerms(*_contrast, lambda, _neighbourhood, builder);
+            nBandEdges = builder.nEdges;
+        }
+
+        // add unary terms; nodes in the source set take label 1
+        for (int i = 0; i < nBand; i++) {
+            const double u0 = _bandUnary[2 * i];
+            const double u1 = _bandUnary[2 * i + 1];
+            if (u1 > u0) {
+                _graph->addTargetEdge(i, u1 - u0);
+            } else {
+                _graph->addSourceEdge(i, u0 - u1);
+            }
+        }
+
+        if (telemetry != NULL) {
+            telemetry->nodes += nBand;
+            telemetry->edges += nBandEdges;
+            telemetry->addBuild(mark);
+        }
+
+        _graph->solve();
+        if (telemetry != NULL) {
+            telemetry->solveTime += CRFTelemetry::lap(mark);
+            telemetry->moves += 1;
+        }
+
+        for (int y = 0; y < H; y++) {
+            for (int x = 0; x < W; x++) {
+                const int i = _bandIndex.at<int>(y, x);
+                if (i >= 0) {
+                    _labels.at<short>(y, x) = _graph->inSetS(i) ? 1 : 0;
+                }
+            }
+        }
+    }
+
+    if (telemetry != NULL) {
+        // darwin's max-flow does not report the search of the band solve
+        telemetry->augmentations = telemetry->adoptions = -1;
+        endTelemetry(unary, lambda, _labels, startTime);
+    }
+
+    DRWN_FCN_TOC;
+    return _labels;
+}
+
+// adds the pairwise term between pixels p and q with weight w to the band
+// graph; when only one lies in the band the other keeps its label and the
+// term becomes a unary term on the first. Returns true if an edge was added.
+bool CRFContext::addBandEdge(int xp, int yp, int xq, int yq, double w)
+{
+    const int p = _bandIndex.at<int>(yp, xp);
+    const int q = _bandIndex.at<int>(yq, xq);
+    if (p >= 0) {
+        if (q >= 0) {
+            _graph->addEdge(p, q, w, w);
+            return true;
+        }
+        _bandUnary[2 * p + 1 - _labels.at<short>(yq, xq)] += w;
+    } else if (q >= 0) {
+        _bandUnary[2 * q + 1 - _labels.at<short>(yp, xp)] += w;
+    }
+    return false;
+}
+
+void CRFContext::inferSweep(const cv::Mat& img, const vector< cv::Mat >& unary,
+    const vector<double>& lambdas, vector<cv::Mat>& labels,
+    vector<double>& breakpoints)
+{
+    _imageContrast.initialize(img);
+    inferSweep(_imageContrast, unary, lambdas, labels, breakpoints);
+}
+
+void CRFContext::inferSweep(const PixelContrasts& contrast, const vector< cv::Mat >& unary,
+    const vector<double>& lambdas, vector<cv::Mat>& labels,
+    vector<double>& breakpoints)
+{
+    DRWN_FCN_TIC;
+
+    prepare(contrast, unary);
+    DRWN_ASSERT_MSG(unary.size() == 2, "parametric inference needs two labels");
+    for (unsigned k = 0; k < lambdas.size(); k++) {
+        DRWN_ASSERT_MSG(lambdas[k] >= ((k == 0) ? 0.0 : lambdas[k - 1]),
+            "lambdas must be non-negative and ascending");
+    }
+
+    // one record for the whole sweep, with the labelling of the last weight
+    const double lambda = lambdas.empty() ? 0.0 : lambdas.back();
+    const double startTime = (_telemetryStream != NULL) ? crfWallTime() : 0.0;
+    CRFTelemetry *telemetry = beginTelemetry("sweep", contrast.width(), contrast.height(),
+        unary, lambda);
+
+    _frameUnary.clear();
+    parametricGraphCut(_grid, unary, *_contrast, lambdas, labels, breakpoints, _neighbourhood,
+        telemetry);
+
+    if ((telemetry != NULL) && !labels.empty()) {
+        endTelemetry(unary, lambda, labels.back(), startTime);
+    }
+
+    DRWN_FCN_TOC;
+}
+
+const cv::Mat& CRFContext::inferSuperpixels(const cv::Mat& img, const vector< cv::Mat >& unary,
+    double lambda, int regionSize, double compactness)
+{
+    DRWN_FCN_TIC;
+
+    prepare(img, unary);
+    DRWN_ASSERT_MSG(unary.size() == 2, "superpixel inference needs two labels");
+    DRWN_ASSERT_MSG(lambda >= 0.0, "lambda must be non-negative");
+    const int H = img.rows;
+    const int W = img.cols;
+
+    double mark = (_telemetryStream != NULL) ? crfWallTime() : 0.0;
+    const double startTime = mark;
+    CRFTelemetry *telemetry = beginTelemetry("superpixels", W, H, unary, lambda);
+
+    _nRegions = slicSuperpixels(img, regionSize, compactness, _segments);
+    DRWN_LOG_VERBOSE("...superpixel graph has " << _nRegions << " of " << H * W << " pixels");
+
+    // accumulate region unary terms
+    _regionUnary.assign(2 * _nRegions, 0.0);
+    for (int y = 0; y < H; y++) {
+        const int *s = _segments.ptr<int>(y);
+        for (int x = 0; x < W; x++) {
+            _regionUnary[2 * s[x]] += unary[0].at<double>(y, x);
+            _regionUnary[2 * s[x] + 1] += unary[1].at<double>(y, x);
+        }
+    }
+
+    // accumulate pairwise terms of pixel edges crossing region boundaries
+    map<long long, double> edges;
+    if (lambda > 0.0) {
+        RegionEdgeBuilder builder = {this, &edges};
+        buildPairwiseTerms(*_contrast, lambda, _neighbourhood, builder);
+    }
+
+    reserve(_nRegions);
+    _graph->reset();
+    for (map<long long, double>::const_iterator it = edges.begin(); it != edges.end(); ++it) {
+        const int p = (int)(it->first / _nRegions);
+        const int q = (int)(it->first % _nRegions);
+        _graph->addEdge(p, q, it->second, it->second);
+    }
+
+    // add unary terms; nodes in the source set take label 1
+    double offset = 0.0;
+    for (int i = 0; i < _nRegions; i++) {
+        const double u0 = _regionUnary[2 * i];
+        const double u1 = _regionUnary[2 * i + 1];
+        if (u1 > u0) {
+            _graph->addTargetEdge(i, u1 - u0);
+            offset += u0;
+        } else {
+            _graph->addSourceEdge(i, u0 - u1);
+            offset += u1;
+        }
+    }
+    if (telemetry != NULL) {
+        telemetry->nodes = _nRegions;
+        telemetry->edges = (int)edges.size();
+        telemetry->addBuild(mark);
+    }
+
+    // the region labelling has the energy of the pixel labelling
+    const double e = _graph->solve() + offset;
+    if (telemetry != NULL) {
+        telemetry->addSolve(mark, e);
+        // darwin's max-flow does not report its search
+        telemetry->augmentations = telemetry->adoptions = -1;
+    }
+
+    _labels.create(H, W, CV_16S);
+    for (int y = 0; y < H; y++) {
+        const int *s = _segments.ptr<int>(y);
+        for (int x = 0; x < W; x++) {
+            _labels.at<short>(y, x) = _graph->inSetS(s[x]) ? 1 : 0;
+        }
+    }
+
+    if (telemetry != NULL) {
+        endTelemetry(unary, lambda, _labels, startTime);
+    }
+
+    DRWN_FCN_TOC;
+    return _labels;
+}
+
+// adds weight w of the pixel edge between p and q to the edge between their
+// regions (keyed by smaller region * nRegions + larger region)
+void CRFContext::addRegionEdge(map<long long, double>& edges, int xp, int yp,
+    int xq, int yq, double w) const
+{
+    const int p = _segments.at<int>(yp, xp);
+    const int q = _segments.at<int>(yq, xq);
+    if (p == q) return;
+    const long long key = (p < q) ? (long long)p * _nRegions + q : (long long)q * _nRegions + p;
+    edges[key] += w;
+}
+
+void CRFContext::prepare(const cv::Mat& img, const vector< cv::Mat >& unary)
+{
+    _imageContrast.initialize(img);
+    prepare(_imageContrast, unary);
+}
+
+void CRFContext::prepare(const PixelContrasts& contrast, const vector< cv::Mat >& unary)
+{
+    _contrast = &contrast;
+    const int H = contrast.height();
+    const int W = contrast.width();
+
+    // parse unary potentials
+    const int L = (int) unary.size();
+    DRWN_ASSERT_MSG(L > 1, "invalid number of labels");
+    for (int l = 0; l < L; l++) {
+        DRWN_ASSERT_MSG((unary[l].rows == H) && (unary[l].cols == W),
+            "unary potentials must match image size " << H << "-by-" << W);
+    }
+}
+
+CRFTelemetry *CRFContext::beginTelemetry(const char *backend, int width, int height,
+    const vector< cv::Mat >& unary, double lambda)
+{
+    if (_telemetryStream == NULL) return NULL;
+
+    _telemetry.clear();
+    _telemetry.tag = _telemetryTag;
+    _telemetry.backend = backend;
+    _telemetry.width = width;
+    _telemetry.height = height;
+    _telemetry.labels = (int)unary.size();
+    _telemetry.connectivity = (int)_neighbourhood;
+    _telemetry.lambda = lambda;
+    _telemetry.nodes = width * height;
+    _telemetry.edges = (lambda > 0.0) ? crfEdgeCount(width, height, _neighbourhood) : 0;
+    return &_telemetry;
+}
+
+void CRFContext::endTelemetry(const vector< cv::Mat >& unary, double lambda,
+    const cv::Mat& labels, double startTime)
+{
+    _telemetry.totalTime = crfWallTime() - startTime;
+
+    // pixels moved away from their unary argmin by the pairwise terms
+    const int L = (int)unary.size();
+    for (int y = 0; y < labels.rows; y++) {
+        const short *lbl = labels.ptr<short>(y);
+        for (int x = 0; x < labels.cols; x++) {
+            int best = 0;
+            for (int l = 1; l < L; l++) {
+                if (unary[l].at<double>(y, x) < unary[best].at<double>(y, x)) best = l;
+            }
+            if (lbl[x] != best) _telemetry.changed += 1;
+        }
+    }
+    _telemetry.energy = crfEnergy(unary, *_contrast, lambda, labels, _neighbourhood);
+    if ((int)_telemetry.energies.size() < _telemetry.moves) {
+        _telemetry.energies.push_back(_telemetry.energy);
+    }
+
+    _telemetry.write(*_telemetryStream);
+}
+
+void CRFContext::reserve(int nNodes)
+{
+    if (nNodes <= _maxNodes) return;
+
+    // grow the graph; nodes beyond the current image are left unconnected
+    if (_graph != NULL) {
+        delete _graph;
+    }
+    _graph = new drwnBKMaxFlow(nNodes);
+    _graph->addNodes(nNodes);
+    _maxNodes = nNodes;
+}
+
+// Convenience wrapper for single images. Code processing many images should
+// keep a CRFContext alive across calls instead. The resolution is only used
+// by CRF_QUANTIZED.
+cv::Mat mexFunction(const cv::Mat& img, const vector< cv::Mat >& unary,
+    const double lambda, CRFBackend backend = CRF_GRAPHCUT, double resolution = 1000.0)
+{
+    CRFContext context;
+    context.setResolution(resolution);
+    return context.infer(img, unary, lambda, backend);
+}
+
+cv::Mat mexFunction(const PixelContrasts& contrast, const vector< cv::Mat >& unary,
+    const double lambda, CRFBackend backend = CRF_GRAPHCUT, double resolution = 1000.0)
+{
+    CRFContext context;
+    context.setResolution(resolution);
+    return context.infer(contrast, unary, lambda, backend);
+}
+
+// private functions -------------------------------------------------------
+
+void binaryGraphCut(drwnMaxFlow *g, const vector< cv::Mat > &unary,
+    const PixelContrasts &contrast, double lambda, cv::Mat &labels,
+    CRFNeighbourhood neighbourhood, CRFTelemetry *telemetry)
+{
+    DRWN_FCN_TIC;
+
+    const int H = contrast.height();
+    const int W = contrast.width();
+    double mark = (telemetry != NULL) ? crfWallTime() : 0.0;
+
+    // with two labels and Potts pairwise terms a single s-t cut is exact;
+    // nodes in the source set take label 1
+    g->reset();
+
+    // add unary terms, keeping only the difference between the two labels;
+    // nodes are numbered in row-major order so that the unary planes and
+    // the graph are both read sequentially
+    double offset = 0.0;
+    int varIndx = 0;
+    for (int y = 0; y < H; y++) {
+        const double *u0 = unary[0].ptr<double>(y);
+        const double *u1 = unary[1].ptr<double>(y);
+        for (int x = 0; x < W; x++) {
+            if (u1[x] > u0[x]) {
+                g->addTargetEdge(varIndx, u1[x] - u0[x]);
+                offset += u0[x];
+            } else {
+                g->addSourceEdge(varIndx, u0[x] - u1[x]);
+                offset += u1[x];
+            }
+            varIndx += 1;
+        }
+    }
+
+    // add pairwise terms
+    if (lambda > 0.0) {
+        addPairwiseTerms(g, contrast, lambda, neighbourhood);
+    }
+    if (telemetry != NULL) telemetry->addBuild(mark);
+
+    // run inference
+    const double e = g->solve() + offset;
+    DRWN_LOG_DEBUG("...binary graph-cut has energy " << e);
+    if (telemetry != NULL) telemetry->addSolve(mark, e);
+
+    varIndx = 0;
+    for (int y = 0; y < H; y++) {
+        short *l = labels.ptr<short>(y);
+        for (int x = 0; x < W; x++) {
+            l[x] = g->inSetS(varIndx) ? 1 : 0;
+            varIndx += 1;
+        }
+    }
+
+    DRWN_FCN_TOC;
+}
+
+void alphaExpansion(drwnMaxFlow *g, const vector< cv::Mat > &unary,
+    const PixelContrasts &contrast, double lambda, cv::Mat &labels,
+    CRFNeighbourhood neighbourhood, CRFTelemetry *telemetry)
+{
+    DRWN_FCN_TIC;
+
+    const int L = (int)unary.size();
+    const int H = contrast.height();
+    const int W = contrast.width();
+    double mark = (telemetry != NULL) ? crfWallTime() : 0.0;
+
+    // initialize labeling
+    labels.setTo(cv::Scalar(0));
+    for (int y = 0; y < H; y++) {
+        for (int x = 0; x < W; x++) {
             double e = unary[0].at<double>(y, x);
             for (int l = 1; l < L; l++) {
                 if (unary[l].at<double>(y, x) < e) {
@@ -98,9 +1244,6 @@ cv::Mat mexFunction(cv::Mat img, vector< cv::Mat > unary, const double lambda)
     }
 
     // run alpha expansion
-    drwnMaxFlow *g = new drwnBKMaxFlow(H * W);
-    g->addNodes(H * W);
-
     bool bChanged = (lambda > 0.0);
     int lastChanged = -1;
     double minEnergy = numeric_limits<double>::max();
@@ -116,10 +1259,12 @@ cv::Mat mexFunction(cv::Mat img, vector< cv::Mat > unary, const double lambda)
             addUnaryTerms(g, unary, labels, alpha);
 
             // add pairwise terms
-            addPairwiseTerms(g, contrast, lambda, labels, alpha);
+            addPairwiseTerms(g, contrast, lambda, labels, alpha, neighbourhood);
+            if (telemetry != NULL) telemetry->addBuild(mark);
 
             // run inference
             const double e = g->solve();
+            if (telemetry != NULL) telemetry->addSolve(mark, e);
 
             DRWN_LOG_DEBUG("...cycle " << nCycle << ", iteration " << alpha << " has energy " << e);
             if (e < minEnergy) {
@@ -128,8 +1273,8 @@ cv::Mat mexFunction(cv::Mat img, vector< cv::Mat > unary, const double lambda)
                 bChanged = true;
 
                 int varIndx = 0;
-                for (int x = 0; x < W; x++) {
-                    for (int y = 0; y < H; y++) {
+                for (int y = 0; y < H; y++) {
+                    for (int x = 0; x < W; x++) {
                         if (g->inSetS(varIndx)) {
                             labels.at<short>(y, x) = alpha;
                         }
@@ -140,269 +1285,419 @@ cv::Mat mexFunction(cv::Mat img, vector< cv::Mat > unary, const double lambda)
         }
     }
 
-    delete g;
-
-    // testing code
-    labels = alphaExpansionTest(unary, contrast, lambda);
-
-    // release memory
-    cvReleaseImage(&image);
-
-    // print profile information
-    drwnCodeProfiler::toc(drwnCodeProfiler::getHandle("mex"));
-    drwnCodeProfiler::print();
-    return labels;
+    DRWN_FCN_TOC;
 }
 
-// private functions -------------------------------------------------------
-
 
-void addUnaryTerms(drwnMaxFlow *g, const vector< cv::Mat > unary,
-    cv::Mat labels, int alpha)
+void addUnaryTerms(drwnMaxFlow *g, const vector< cv::Mat > &unary,
+    const cv::Mat &labels, int alpha)
 {
     const int H = labels.rows;
     const int W = labels.cols;
 
     int varIndx = 0;
-    for (int x = 0; x < W; x++) {
-        for (int y = 0; y < H; y++) {
-            g->addSourceEdge(varIndx, unary[labels.at<short>(y, x)].at<double>(y, x));
-            g->addTargetEdge(varIndx, unary[alpha].at<double>(y, x));
+    for (int y = 0; y < H; y++) {
+        const short *l = labels.ptr<short>(y);
+        const double *ua = unary[alpha].ptr<double>(y);
+        for (int x = 0; x < W; x++) {
+            g->addSourceEdge(varIndx, unary[l[x]].at<double>(y, x));
+            g->addTargetEdge(varIndx, ua[x]);
             varIndx += 1;
         }
     }
 }
 
-void addPairwiseTerms(drwnMaxFlow *g, const drwnPixelNeighbourContrasts contrast,
-    double lambda, cv::Mat labels, int alpha)
-{
-    const int H = labels.rows;
-    const int W = labels.cols;
+// pairwise edge builders for drwnMaxFlow; pixel (x, y) is node W * y + x
+struct PottsEdgeBuilder {
+    drwnMaxFlow *g;
+    int W;
+    void operator()(int x, int y, int xx, int yy, int /*k*/, double w) {
+        g->addEdge(W * y + x, W * yy + xx, w, w);
+    }
+};
+
+struct ExpansionEdgeBuilder {
+    drwnMaxFlow *g;
+    const cv::Mat *labels;
+    int alpha;
+    void operator()(int x, int y, int xx, int yy, int /*k*/, double w) {
+        const int W = labels->cols;
+        const int u = W * y + x;
+        const int v = W * yy + xx;
+
+        const int labelA = labels->at<short>(y, x);
+        const int labelB = labels->at<short>(yy, xx);
+
+        if ((labelA == alpha) && (labelB == alpha)) return;
+
+        if (labelA == alpha) {
+            g->addSourceEdge(v, w);
+        } else if (labelB == alpha) {
+            g->addSourceEdge(u, w);
+        } else if (labelA == labelB) {
+            g->addEdge(u, v, w, w);
+        } else {
+            g->addSourceEdge(u, w);
+            g->addEdge(u, v, w, 0.0);
+        }
+    }
+};
 
-    // add horizontal pairwise terms
-    for (int x = 1; x < W; x++) {
-        for (int y = 0; y < H; y++) {
-            const int u = H * x + y;
-            const int v = H * (x - 1) + y;
+void addPairwiseTerms(drwnMaxFlow *g, const PixelContrasts &contrast,
+    double lambda, CRFNeighbourhood neighbourhood)
+{
+    PottsEdgeBuilder builder = {g, contrast.width()};
+    buildPairwiseTerms(contrast, lambda, neighbourhood, builder);
+}
 
-            const double w = lambda * contrast.contrastW(x, y);
+void addPairwiseTerms(drwnMaxFlow *g, const PixelContrasts &contrast,
+    double lambda, const cv::Mat &labels, int alpha, CRFNeighbourhood neighbourhood)
+{
+    ExpansionEdgeBuilder builder = {g, &labels, alpha};
+    buildPairwiseTerms(contrast, lambda, neighbourhood, builder);
+}
 
-            const int labelA = labels.at<short>(y, x);
-            const int labelB = labels.at<short>(y, x - 1);
+// grid max-flow versions ---------------------------------------------------
 
-            if ((labelA == alpha) && (labelB == alpha)) continue;
+template <typename T>
+void binaryGraphCut(GridMaxFlow<T> &g, const vector< cv::Mat > &unary,
+    const PixelContrasts &contrast, double lambda, cv::Mat &labels,
+    unsigned nThreads, CRFNeighbourhood neighbourhood, double scale,
+    CRFTelemetry *telemetry, drwnThreadPool *threadPool)
+{
+    DRWN_FCN_TIC;
 
-            if (labelA == alpha) {
-                g->addSourceEdge(v, w);
-            } else if (labelB == alpha) {
-                g->addSourceEdge(u, w);
-            } else if (labelA == labelB) {
-                g->addEdge(u, v, w, w);
+    const int H = contrast.height();
+    const int W = contrast.width();
+    double mark = (telemetry != NULL) ? crfWallTime() : 0.0;
+
+    g.reset(W, H);
+
+    // add unary terms; nodes in the source set take label 1
+    double offset = 0.0;
+    for (int y = 0; y < H; y++) {
+        for (int x = 0; x < W; x++) {
+            const double u0 = unary[0].at<double>(y, x);
+            const double u1 = unary[1].at<double>(y, x);
+            if (u1 > u0) {
+                g.addTerminalEdges(x, y, T(0), crfCapacity<T>(u1 - u0, scale));
+                offset += u0;
             } else {
-                g->addSourceEdge(u, w);
-                g->addEdge(u, v, w, 0.0);
+                g.addTerminalEdges(x, y, crfCapacity<T>(u0 - u1, scale), T(0));
+                offset += u1;
             }
         }
     }
 
-    // add vertical pairwise terms
-    for (int x = 0; x < W; x++) {
-        for (int y = 1; y < H; y++) {
-            const int u = H * x + y;
-            const int v = H * x + y - 1;
-
-            const double w = lambda * contrast.contrastN(x, y);
-
-            const int labelA = labels.at<short>(y, x);
-            const int labelB = labels.at<short>(y - 1, x);
+    // add pairwise terms
+    if (lambda > 0.0) {
+        addPairwiseTerms(g, contrast, lambda, neighbourhood, scale);
+    }
+    if (telemetry != NULL) telemetry->addBuild(mark);
 
-            if ((labelA == alpha) && (labelB == alpha)) continue;
+    // run inference
+    const double flow = g.solveParallel(nThreads, threadPool);
+    if (telemetry != NULL) {
+        telemetry->addSolve(mark, flow / scale + offset);
+        telemetry->augmentations += g.numAugmentations();
+        telemetry->adoptions += g.numAdoptions();
+    }
 
-            if (labelA == alpha) {
-                g->addSourceEdge(v, w);
-            } else if (labelB == alpha) {
-                g->addSourceEdge(u, w);
-            } else if (labelA == labelB) {
-                g->addEdge(u, v, w, w);
-            } else {
-                g->addSourceEdge(u, w);
-                g->addEdge(u, v, w, 0.0);
-            }
+    for (int y = 0; y < H; y++) {
+        for (int x = 0; x < W; x++) {
+            labels.at<short>(y, x) = g.inSetS(x, y) ? 1 : 0;
         }
     }
 
-    // add diagonal pairwise terms
-    for (int x = 1; x < W; x++) {
-        for (int y = 1; y < H; y++) {
-            const int u = H * x + y;
-            const int v = H * (x - 1) + y - 1;
+    DRWN_FCN_TOC;
+}
 
-            const double w = lambda * contrast.contrastNW(x, y);
+template <typename T>
+struct GridPottsEdgeBuilder {
+    GridMaxFlow<T> *g;
+    double scale;
+    void operator()(int x, int y, int /*xx*/, int /*yy*/, int k, double w) {
+        const T c = crfCapacity<T>(w, scale);
+        g->addEdge(x, y, CRF_NEIGHBOUR_GRID[k], c, c);
+    }
+};
 
-            const int labelA = labels.at<short>(y, x);
-            const int labelB = labels.at<short>(y - 1, x - 1);
+template <typename T>
+void addPairwiseTerms(GridMaxFlow<T> &g, const PixelContrasts &contrast,
+    double lambda, CRFNeighbourhood neighbourhood, double scale)
+{
+    GridPottsEdgeBuilder<T> builder = {&g, scale};
+    buildPairwiseTerms(contrast, lambda, neighbourhood, builder);
+}
 
-            if ((labelA == alpha) && (labelB == alpha)) continue;
+void parametricGraphCut(GridMaxFlow<float> &g, const vector< cv::Mat > &unary,
+    const PixelContrasts &contrast, const vector<double> &lambdas,
+    vector<cv::Mat> &labels, vector<double> &breakpoints, CRFNeighbourhood neighbourhood,
+    CRFTelemetry *telemetry)
+{
+    DRWN_FCN_TIC;
 
-            if (labelA == alpha) {
-                g->addSourceEdge(v, w);
-            } else if (labelB == alpha) {
-                g->addSourceEdge(u, w);
-            } else if (labelA == labelB) {
-                g->addEdge(u, v, w, w);
+    const int H = contrast.height();
+    const int W = contrast.width();
+    double mark = (telemetry != NULL) ? crfWallTime() : 0.0;
+
+    labels.resize(lambdas.size());
+    breakpoints.clear();
+
+    g.reset(W, H);
+
+    // add unary terms; nodes in the source set take label 1
+    double offset = 0.0;
+    for (int y = 0; y < H; y++) {
+        for (int x = 0; x < W; x++) {
+            const double u0 = unary[0].at<double>(y, x);
+            const double u1 = unary[1].at<double>(y, x);
+            if (u1 > u0) {
+                g.addTerminalEdges(x, y, 0.0f, (float)(u1 - u0));
+                offset += u0;
             } else {
-                g->addSourceEdge(u, w);
-                g->addEdge(u, v, w, 0.0);
+                g.addTerminalEdges(x, y, (float)(u0 - u1), 0.0f);
+                offset += u1;
             }
         }
     }
 
-    for (int x = 1; x < W; x++) {
-        for (int y = 1; y < H; y++) {
-            const int u = H * x + y - 1;
-            const int v = H * (x - 1) + y;
-
-            const double w = lambda * contrast.contrastSW(x, y - 1);
-
-            const int labelA = labels.at<short>(y - 1, x);
-            const int labelB = labels.at<short>(y, x - 1);
+    double lastLambda = 0.0;
+    for (unsigned k = 0; k < lambdas.size(); k++) {
+        // raise the pairwise capacities to the new weight
+        if (lambdas[k] > lastLambda) {
+            addPairwiseTerms(g, contrast, lambdas[k] - lastLambda, neighbourhood);
+            lastLambda = lambdas[k];
+        }
+        if (telemetry != NULL) telemetry->addBuild(mark);
 
-            if ((labelA == alpha) && (labelB == alpha)) continue;
+        const double e = g.solve() + offset;
+        DRWN_LOG_DEBUG("...lambda " << lambdas[k] << " has energy " << e);
+        if (telemetry != NULL) telemetry->addSolve(mark, e);
 
-            if (labelA == alpha) {
-                g->addSourceEdge(v, w);
-            } else if (labelB == alpha) {
-                g->addSourceEdge(u, w);
-            } else if (labelA == labelB) {
-                g->addEdge(u, v, w, w);
-            } else {
-                g->addSourceEdge(u, w);
-                g->addEdge(u, v, w, 0.0);
+        labels[k].create(H, W, CV_16S);
+        bool bChanged = (k == 0);
+        for (int y = 0; y < H; y++) {
+            for (int x = 0; x < W; x++) {
+                labels[k].at<short>(y, x) = g.inSetS(x, y) ? 1 : 0;
+                if (!bChanged && (labels[k].at<short>(y, x) != labels[k - 1].at<short>(y, x)))
+                    bChanged = true;
             }
         }
+        if (bChanged && (k > 0)) {
+            breakpoints.push_back(lambdas[k]);
+        }
+        if (telemetry != NULL) CRFTelemetry::lap(mark);
     }
+
+    if (telemetry != NULL) {
+        telemetry->augmentations += g.numAugmentations();
+        telemetry->adoptions += g.numAdoptions();
+    }
+
+    DRWN_FCN_TOC;
 }
 
-cv::Mat alphaExpansionTest(vector< cv::Mat > unary,
-    const drwnPixelNeighbourContrasts &contrast, double lambda)
+// adds the alpha-expansion terms for the pairwise edge between (x, y) and its
+// neighbour in direction d, currently labelled labelA and labelB
+template <typename T>
+void addExpansionEdge(GridMaxFlow<T> &g, int x, int y, int d, T w,
+    int labelA, int labelB, int alpha)
+{
+    if ((labelA == alpha) && (labelB == alpha)) return;
+
+    if (labelA == alpha) {
+        g.addTerminalEdges(x + GRID_DX[d], y + GRID_DY[d], w, T(0));
+    } else if (labelB == alpha) {
+        g.addTerminalEdges(x, y, w, T(0));
+    } else if (labelA == labelB) {
+        g.addEdge(x, y, d, w, w);
+    } else {
+        g.addTerminalEdges(x, y, w, T(0));
+        g.addEdge(x, y, d, w, T(0));
+    }
+}
+
+template <typename T>
+struct GridExpansionEdgeBuilder {
+    GridMaxFlow<T> *g;
+    const cv::Mat *labels;
+    int alpha;
+    double scale;
+    void operator()(int x, int y, int xx, int yy, int k, double w) {
+        addExpansionEdge(*g, x, y, CRF_NEIGHBOUR_GRID[k], crfCapacity<T>(w, scale),
+            labels->at<short>(y, x), labels->at<short>(yy, xx), alpha);
+    }
+};
+
+template <typename T>
+void alphaExpansion(GridMaxFlow<T> &g, const vector< cv::Mat > &unary,
+    const PixelContrasts &contrast, double lambda, cv::Mat &labels,
+    unsigned nThreads, CRFNeighbourhood neighbourhood, double scale,
+    CRFTelemetry *telemetry, drwnThreadPool *threadPool)
 {
     DRWN_FCN_TIC;
 
     const int L = (int)unary.size();
     const int H = contrast.height();
     const int W = contrast.width();
+    double mark = (telemetry != NULL) ? crfWallTime() : 0.0;
 
-    // create graph
-    drwnVarUniversePtr universe(new drwnVarUniverse(H * W, L));
-    drwnFactorGraph graph(universe);
-
-    // add unary terms
-    for (int i = 0; i < H * W; i++) {
-        drwnTableFactor *phi = new drwnTableFactor(universe);
-        phi->addVariable(i);
-        for (int xi = 0; xi < L; xi++) {
-            (*phi)[xi] = unary[xi].at<double>(i % H, i / H);
+    // initialize labeling
+    labels.setTo(cv::Scalar(0));
+    for (int y = 0; y < H; y++) {
+        for (int x = 0; x < W; x++) {
+            double e = unary[0].at<double>(y, x);
+            for (int l = 1; l < L; l++) {
+                if (unary[l].at<double>(y, x) < e) {
+                    e = unary[l].at<double>(y, x);
+                    labels.at<short>(y, x) = l;
+                }
+            }
         }
-        graph.addFactor(phi);
     }
 
-    // add horizontal pairwise terms
-    for (int x = 1; x < W; x++) {
-        for (int y = 0; y < H; y++) {
-            const int u = H * x + y;
-            const int v = H * (x - 1) + y;
-
-            const double w = lambda * contrast.contrastW(x, y);
+    // run alpha expansion
+    bool bChanged = (lambda > 0.0);
+    int lastChanged = -1;
+    double minEnergy = numeric_limits<double>::max();
+    for (int nCycle = 0; bChanged; nCycle += 1) {
+        bChanged = false;
+        for (int alpha = 0; alpha < L; alpha++) {
+            if (alpha == lastChanged)
+                break;
 
-            drwnTableFactor *phi = new drwnTableFactor(universe);
-            phi->addVariable(u);
-            phi->addVariable(v);
+            g.reset(W, H);
 
-            for (int xi = 0; xi < L; xi++) {
-                for (int xj = 0; xj < L; xj++) {
-                    (*phi)[xi * L + xj] = (xi == xj) ? 0.0 : w;
+            // add unary terms
+            for (int y = 0; y < H; y++) {
+                for (int x = 0; x < W; x++) {
+                    g.addTerminalEdges(x, y, crfCapacity<T>(unary[labels.at<short>(y, x)].at<double>(y, x), scale),
+                        crfCapacity<T>(unary[alpha].at<double>(y, x), scale));
                 }
             }
 
-            graph.addFactor(phi);
-        }
-    }
-
-    // add vertical pairwise terms
-    for (int x = 0; x < W; x++) {
-        for (int y = 1; y < H; y++) {
-            const int u = H * x + y;
-            const int v = H * x + y - 1;
+            // add pairwise terms
+            GridExpansionEdgeBuilder<T> builder = {&g, &labels, alpha, scale};
+            buildPairwiseTerms(contrast, lambda, neighbourhood, builder);
+            if (telemetry != NULL) telemetry->addBuild(mark);
 
-            const double w = lambda * contrast.contrastN(x, y);
+            // run inference
+            const double e = g.solveParallel(nThreads, threadPool);
+            if (telemetry != NULL) {
+                telemetry->addSolve(mark, e / scale);
+                telemetry->augmentations += g.numAugmentations();
+                telemetry->adoptions += g.numAdoptions();
+            }
 
-            drwnTableFactor *phi = new drwnTableFactor(universe);
-            phi->addVariable(u);
-            phi->addVariable(v);
+            DRWN_LOG_DEBUG("...cycle " << nCycle << ", iteration " << alpha << " has energy " << e);
+            if (e < minEnergy) {
+                minEnergy = e;
+                lastChanged = alpha;
+                bChanged = true;
 
-            for (int xi = 0; xi < L; xi++) {
-                for (int xj = 0; xj < L; xj++) {
-                    (*phi)[xi * L + xj] = (xi == xj) ? 0.0 : w;
+                for (int y = 0; y < H; y++) {
+                    for (int x = 0; x < W; x++) {
+                        if (g.inSetS(x, y)) {
+                            labels.at<short>(y, x) = alpha;
+                        }
+                    }
                 }
             }
-
-            graph.addFactor(phi);
         }
     }
 
-    // add diagonal pairwise terms
-    for (int x = 1; x < W; x++) {
-        for (int y = 1; y < H; y++) {
-            const int u = H * x + y;
-            const int v = H * (x - 1) + y - 1;
-
-            const double w = lambda * contrast.contrastNW(x, y);
+    DRWN_FCN_TOC;
+}
 
-            drwnTableFactor *phi = new drwnTableFactor(universe);
-            phi->addVariable(u);
-            phi->addVariable(v);
+struct FactorEdgeBuilder {
+    drwnVarUniversePtr universe;
+    drwnFactorGraph *graph;
+    int W;
+    int L;
+    void operator()(int x, int y, int xx, int yy, int /*k*/, double w) {
+        drwnTableFactor *phi = new drwnTableFactor(universe);
+        phi->addVariable(W * y + x);
+        phi->addVariable(W * yy + xx);
 
-            for (int xi = 0; xi < L; xi++) {
-                for (int xj = 0; xj < L; xj++) {
-                    (*phi)[xi * L + xj] = (xi == xj) ? 0.0 : w;
-                }
+        for (int xi = 0; xi < L; xi++) {
+            for (int xj = 0; xj < L; xj++) {
+                (*phi)[xi * L + xj] = (xi == xj) ? 0.0 : w;
             }
-
-            graph.addFactor(phi);
         }
-    }
 
-    for (int x = 1; x < W; x++) {
-        for (int y = 1; y < H; y++) {
-            const int u = H * x + y - 1;
-            const int v = H * (x - 1) + y;
+        graph->addFactor(phi);
+    }
+};
 
-            const double w = lambda * contrast.contrastSW(x, y - 1);
+cv::Mat alphaExpansionTest(const vector< cv::Mat > &unary,
+    const PixelContrasts &contrast, double lambda,
+    CRFNeighbourhood neighbourhood)
+{
+    DRWN_FCN_TIC;
 
-            drwnTableFactor *phi = new drwnTableFactor(universe);
-            phi->addVariable(u);
-            phi->addVariable(v);
+    const int L = (int)unary.size();
+    const int H = contrast.height();
+    const int W = contrast.width();
 
-            for (int xi = 0; xi < L; xi++) {
-                for (int xj = 0; xj < L; xj++) {
-                    (*phi)[xi * L + xj] = (xi == xj) ? 0.0 : w;
-                }
-            }
+    // create graph
+    drwnVarUniversePtr universe(new drwnVarUniverse(H * W, L));
+    drwnFactorGraph graph(universe);
 
-            graph.addFactor(phi);
+    // add unary terms
+    for (int i = 0; i < H * W; i++) {
+        drwnTableFactor *phi = new drwnTableFactor(universe);
+        phi->addVariable(i);
+        for (int xi = 0; xi < L; xi++) {
+            (*phi)[xi] = unary[xi].at<double>(i / W, i % W);
         }
+        graph.addFactor(phi);
     }
 
+    // add pairwise terms
+    FactorEdgeBuilder builder = {universe, &graph, W, L};
+    buildPairwiseTerms(contrast, lambda, neighbourhood, builder);
+
     // run inference
     drwnAlphaExpansionInference inf(graph);
     drwnFullAssignment assignment;
     double e = inf.inference(assignment);
+    DRWN_LOG_DEBUG("...factor graph inference has energy " << e);
 
     cv::Mat labels(H, W, CV_16S);
     for (int i = 0; i < H * W; i++) {
-        labels.at<short>(i % H, i / H) = assignment[i];
+        labels.at<short>(i / W, i % W) = assignment[i];
     }
 
     DRWN_FCN_TOC;
     return labels;
 }
+
+struct EnergyEdgeBuilder {
+    const cv::Mat *labels;
+    double e;
+    void operator()(int x, int y, int xx, int yy, int /*k*/, double w) {
+        if (labels->at<short>(y, x) != labels->at<short>(yy, xx))
+            e += w;
+    }
+};
+
+double crfEnergy(const vector< cv::Mat > &unary,
+    const PixelContrasts &contrast, double lambda, const cv::Mat &labels,
+    CRFNeighbourhood neighbourhood)
+{
+    const int H = labels.rows;
+    const int W = labels.cols;
+
+    double e = 0.0;
+    for (int y = 0; y < H; y++) {
+        for (int x = 0; x < W; x++) {
+            e += unary[labels.at<short>(y, x)].at<double>(y, x);
+        }
+    }
+
+    EnergyEdgeBuilder builder = {&labels, 0.0};
+    buildPairwiseTerms(contrast, lambda, neighbourhood, builder);
+
+    return e + builder.e;
+}
@@ -0,0 +1,337 @@
+/*****************************************************************************
+** DARWIN: A FRAMEWORK FOR MACHINE LEARNING RESEARCH AND DEVELOPMENT
+** Distributed under the terms of the BSD license (see the LICENSE file)
+** Copyright (c) 2007-2013, Stephen Gould
+** All rights reserved.
+**
+******************************************************************************
+** FILENAME:    modelBundle.h
+** AUTHOR(S):
+**              Jimmy Lin <u5223173@anu.edu.au>
+**              Chris Claoue-Long <u5183532@anu.edu.au>
+**
+** Versioned binary bundle of everything needed to run a trained saliency
+** model: the weights, the parameters the feature maps were computed with,
+** the CRF parameters and optional lookup tables. The file is a fixed
+** header, a table of sections and the 8-byte aligned section payloads, all
+** in native byte order, so that a reader can memory-map it and use the
+** payloads in place without parsing.
+**
+*****************************************************************************/
+
+#pragma once
+
+// c++ standard headers
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// darwin library headers
+#include "drwnBase.h"
+
+#include "featureParameters.h"
+
+using namespace std;
+
+// file layout ---------------------------------------------------------------
+
+static const char MODEL_BUNDLE_MAGIC[4] = {'S', 'M', 'B', 'N'};
+static const uint32_t MODEL_BUNDLE_VERSION = 1;
+static const uint32_t MODEL_BUNDLE_BYTE_ORDER = 0x01020304;
+
+struct ModelBundleHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t byteOrder;         // MODEL_BUNDLE_BYTE_ORDER as written
+    uint32_t nSections;
+    uint64_t fileSize;
+};
+
+struct ModelBundleSection {
+    uint32_t tag;
+    uint32_t count;             // number of elements
+    uint64_t offset;            // from the start of the file
+    uint64_t bytes;
+};
+
+typedef enum {
+    MODEL_SECTION_WEIGHTS = 1,          // double[]: MSC, CSH, CSD, bias
+    MODEL_SECTION_FEATURES = 2,         // ModelFeatureConfig
+    MODEL_SECTION_CRF = 3,              // ModelCRFConfig
+    MODEL_SECTION_CSH_ASPECT_RATIOS = 16, // double[]: surround height / width
+    MODEL_SECTION_CSH_SIZES = 17        // double[]: surround width / shorter side
+} ModelSectionTag;
+
+// parameters of the feature maps the model was trained on
+struct ModelFeatureConfig {
+    int32_t mscHalfWindow;      // multi-scale contrast window
+    int32_t mscLevels;          // and pyramid levels
+    int32_t cshBinsPerDim;      // centre-surround colour histogram bins
+    int32_t cshAspectRatios;    // and surround rectangle shapes
+    int32_t cshSizes;
+    int32_t csdComponents;      // colour spatial distribution mixture size
+};
+
+// inference parameters for testModel
+struct ModelCRFConfig {
+    double lambda0;             // pairwise weight
+    double resolution;          // for the quantized backend
+    int32_t backend;            // CRFBackend
+    int32_t connectivity;       // 4 or 8
+    int32_t denseIterations;
+    int32_t reserved;
+    double bilateralXY;
+    double bilateralRGB;
+    double gaussianXY;
+    double gaussianWeight;
+};
+
+// the parameters in featureParameters.h, which the feature maps are
+// computed with
+ModelFeatureConfig modelFeatureConfig();
+
+// ModelBundleWriter ---------------------------------------------------------
+
+class ModelBundleWriter {
+ protected:
+    vector<ModelBundleSection> _sections;
+    vector<vector<char> > _payloads;
+
+ public:
+    ModelBundleWriter() { }
+
+    // adds a section of count elements of the given total size
+    void add(uint32_t tag, const void *data, uint32_t count, size_t bytes);
+    void addWeights(const vector<double> &weights) {
+        add(MODEL_SECTION_WEIGHTS, weights.empty() ? NULL : &weights[0],
+            (uint32_t)weights.size(), weights.size() * sizeof(double));
+    }
+    void addFeatures(const ModelFeatureConfig &config) {
+        add(MODEL_SECTION_FEATURES, &config, 1, sizeof(ModelFeatureConfig));
+    }
+    void addCRF(const ModelCRFConfig &config) {
+        add(MODEL_SECTION_CRF, &config, 1, sizeof(ModelCRFConfig));
+    }
+    void addTable(uint32_t tag, const double *values, uint32_t count) {
+        add(tag, values, count, count * sizeof(double));
+    }
+    // the centre-surround rectangle geometry of featureParameters.h
+    void addFeatureTables() {
+        addTable(MODEL_SECTION_CSH_ASPECT_RATIOS, CSH_ASPECT_RATIO, CSH_ASPECT_RATIOS);
+        addTable(MODEL_SECTION_CSH_SIZES, CSH_SIZE_RANGE, CSH_SIZES);
+    }
+
+    // returns false if the file could not be written
+    bool write(const char *filename) const;
+};
+
+// ModelBundle ---------------------------------------------------------------
+// A bundle mapped read-only into memory. Pointers returned by the accessors
+// are valid until the bundle is closed.
+
+class ModelBundle {
+ protected:
+    void *_data;
+    size_t _size;
+    const ModelBundleHeader *_header;
+    const ModelBundleSection *_sections;
+
+ public:
+    ModelBundle() : _data(NULL), _size(0), _header(NULL), _sections(NULL) { }
+    ~ModelBundle() { close(); }
+
+    // maps the file and checks its header and section table
+    bool open(const char *filename);
+    void close();
+    bool isOpen() const { return _data != NULL; }
+
+    // payload of the section with the given tag, or NULL
+    const void *section(uint32_t tag, uint32_t &count) const;
+
+    // the weights, or an empty vector
+    vector<double> weights() const;
+    const ModelFeatureConfig *features() const;
+    const ModelCRFConfig *crf() const;
+    const double *table(uint32_t tag, uint32_t &count) const;
+
+ protected:
+    const ModelBundleSection *find(uint32_t tag) const;
+};
+
+// implementation ------------------------------------------------------------
+
+ModelFeatureConfig modelFeatureConfig()
+{
+    ModelFeatureConfig config;
+    config.mscHalfWindow = MSC_HALF_WINDOW;
+    config.mscLevels = MSC_PYRAMID_LEVELS;
+    config.cshBinsPerDim = CSH_BINS_PER_DIM;
+    config.cshAspectRatios = CSH_ASPECT_RATIOS;
+    config.cshSizes = CSH_SIZES;
+    config.csdComponents = CSD_COMPONENTS;
+    return config;
+}
+
+// ModelBundleWriter implementation ------------------------------------------
+
+void ModelBundleWriter::add(uint32_t tag, const void *data, uint32_t count, size_t bytes)
+{
+    ModelBundleSection s;
+    s.tag = tag;
+    s.count = count;
+    s.offset = 0;
+    s.bytes = bytes;
+    _sections.push_back(s);
+    _payloads.push_back(vector<char>((const char *)data, (const char *)data + bytes));
+}
+
+bool ModelBundleWriter::write(const char *filename) const
+{
+    // lay the payloads out after the section table, 8-byte aligned
+    vector<ModelBundleSection> sections(_sections);
+    uint64_t offset = sizeof(ModelBundleHeader) + sections.size() * sizeof(ModelBundleSection);
+    for (unsigned i = 0; i < sections.size(); i++) {
+        offset = (offset + 7) & ~(uint64_t)7;
+        sections[i].offset = offset;
+        offset += sections[i].bytes;
+    }
+
+    ModelBundleHeader header;
+    memcpy(header.magic, MODEL_BUNDLE_MAGIC, 4);
+    header.version = MODEL_BUNDLE_VERSION;
+    header.byteOrder = MODEL_BUNDLE_BYTE_ORDER;
+    header.nSections = (uint32_t)sections.size();
+    header.fileSize = offset;
+
+    vector<char> buffer(offset, 0);
+    memcpy(&buffer[0], &header, sizeof(header));
+    if (!sections.empty()) {
+        memcpy(&buffer[sizeof(header)], &sections[0], sections.size() * sizeof(ModelBundleSection));
+    }
+    for (unsigned i = 0; i < sections.size(); i++) {
+        if (sections[i].bytes > 0) {
+            memcpy(&buffer[sections[i].offset], &_payloads[i][0], sections[i].bytes);
+        }
+    }
+
+    FILE *file = fopen(filename, "wb");
+    if (file == NULL) return false;
+    const bool bWritten = (fwrite(&buffer[0], 1, buffer.size(), file) == buffer.size());
+    return (fclose(file) == 0) && bWritten;
+}
+
+// ModelBundle implementation ------------------------------------------------
+
+bool ModelBundle::open(const char *filename)
+{
+    close();
+    const int fd = ::open(filename, O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if ((fstat(fd, &st) != 0) || ((size_t)st.st_size < sizeof(ModelBundleHeader))) {
+        ::close(fd);
+        DRWN_LOG_ERROR(filename << " is not a model bundle");
+        return false;
+    }
+    _size = (size_t)st.st_size;
+    _data = mmap(NULL, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (_data == MAP_FAILED) {
+        _data = NULL;
+        _size = 0;
+        return false;
+    }
+
+    _header = (const ModelBundleHeader *)_data;
+    if ((memcmp(_header->magic, MODEL_BUNDLE_MAGIC, 4) != 0) ||
+        (_header->byteOrder != MODEL_BUNDLE_BYTE_ORDER) || (_header->fileSize != _size) ||
+        (sizeof(ModelBundleHeader) + _header->nSections * sizeof(ModelBundleSection) > _size)) {
+        DRWN_LOG_ERROR(filename << " is not a model bundle or was written on another platform");
+        close();
+        return false;
+    }
+    if (_header->version != MODEL_BUNDLE_VERSION) {
+        DRWN_LOG_ERROR(filename << " is a version " << _header->version
+            << " model bundle; version " << MODEL_BUNDLE_VERSION << " is supported");
+        close();
+        return false;
+    }
+
+    _sections = (const ModelBundleSection *)((const char *)_data + sizeof(ModelBundleHeader));
+    for (uint32_t i = 0; i < _header->nSections; i++) {
+        if ((_sections[i].offset % 8 != 0) || (_sections[i].offset > _size) ||
+            (_sections[i].bytes > _size - _sections[i].offset)) {
+            DRWN_LOG_ERROR(filename << " has a corrupt section table");
+            close();
+            return false;
+        }
+    }
+    return true;
+}
+
+void ModelBundle::close()
+{
+    if (_data != NULL) {
+        munmap(_data, _size);
+    }
+    _data = NULL;
+    _size = 0;
+    _header = NULL;
+    _sections = NULL;
+}
+
+const ModelBundleSection *ModelBundle::find(uint32_t tag) const
+{
+    if (_data == NULL) return NULL;
+    for (uint32_t i = 0; i < _header->nSections; i++) {
+        if (_sections[i].tag == tag) {
+            return &_sections[i];
+        }
+    }
+    return NULL;
+}
+
+const void *ModelBundle::section(uint32_t tag, uint32_t &count) const
+{
+    const ModelBundleSection *s = find(tag);
+    count = (s == NULL) ? 0 : s->count;
+    return (s == NULL) ? NULL : (const char *)_data + s->offset;
+}
+
+const double *ModelBundle::table(uint32_t tag, uint32_t &count) const
+{
+    const ModelBundleSection *s = find(tag);
+    if ((s == NULL) || (s->bytes != s->count * sizeof(double))) {
+        count = 0;
+        return NULL;
+    }
+    count = s->count;
+    return (const double *)((const char *)_data + s->offset);
+}
+
+vector<double> ModelBundle::weights() const
+{
+    uint32_t count;
+    const double *w = table(MODEL_SECTION_WEIGHTS, count);
+    return (w == NULL) ? vector<double>() : vector<double>(w, w + count);
+}
+
+const ModelFeatureConfig *ModelBundle::features() const
+{
+    const ModelBundleSection *s = find(MODEL_SECTION_FEATURES);
+    return ((s == NULL) || (s->bytes != sizeof(ModelFeatureConfig))) ? NULL :
+        (const ModelFeatureConfig *)((const char *)_data + s->offset);
+}
+
+const ModelCRFConfig *ModelBundle::crf() const
+{
+    const ModelBundleSection *s = find(MODEL_SECTION_CRF);
+    return ((s == NULL) || (s->bytes != sizeof(ModelCRFConfig))) ? NULL :
+        (const ModelCRFConfig *)((const char *)_data + s->offset);
+}
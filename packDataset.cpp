@@ -0,0 +1,201 @@
+/*****************************************************************************
+** DARWIN: A FRAMEWORK FOR MACHINE LEARNING RESEARCH AND DEVELOPMENT
+** Distributed under the terms of the BSD license (see the LICENSE file)
+** Copyright (c) 2007-2013, Stephen Gould
+** All rights reserved.
+**
+******************************************************************************
+** FILENAME:    packDataset.cpp
+** AUTHOR(S):
+**     Jimmy Lin (u5223173) - linxin@gmail.com
+**     Chris Claoue-Long (u5183532) - u5183532@anu.edu.au
+**
+** Bundles the images of a directory, their feature maps and their ground
+** truth rectangles into one dataset pack, which trainModel, testModel and
+** scoreModel read with -pack in place of thousands of small files.
+**
+*****************************************************************************/
+
+// c++ standard headers
+#include <cstdlib>
+#include <cstdio>
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+
+// eigen matrix library headers
+#include "Eigen/Core"
+
+// opencv library headers
+#include "cv.h"
+#include "cxcore.h"
+#include "highgui.h"
+
+// darwin library headers
+#include "drwnBase.h"
+#include "drwnIO.h"
+#include "drwnML.h"
+#include "drwnVision.h"
+
+#include "parseLabel.h"
+#include "featureMapStore.h"
+#include "datasetPack.h"
+
+using namespace std;
+using namespace Eigen;
+
+// usage ---------------------------------------------------------------------
+
+void usage()
+{
+    cerr << DRWN_USAGE_HEADER << endl;
+    cerr << "USAGE: ./packDataset [OPTIONS] <imgDir> <packFile>\n";
+    cerr << "OPTIONS:\n"
+         << "  -labels <file>    :: ground truth label file of the images\n"
+         << "  -fmap <dir>       :: feature maps from <dir>/<image>.fmap\n"
+         << "  -msc <dir>        :: or from the JPEG feature maps of getFeatureMaps,\n"
+         << "  -csh <dir>        :: given all three of them\n"
+         << "  -csd <dir>\n"
+         << "  -raw              :: store decoded pixels rather than the JPEG files\n"
+         << DRWN_STANDARD_OPTIONS_USAGE
+	 << endl;
+}
+
+// reads the whole of a file, returning false if it cannot be read
+bool readFileBytes(const string &filename, vector<unsigned char> &data)
+{
+    data.clear();
+    FILE *file = fopen(filename.c_str(), "rb");
+    if (file == NULL) return false;
+    unsigned char buffer[1 << 16];
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        data.insert(data.end(), buffer, buffer + n);
+    }
+    const bool bRead = !ferror(file);
+    fclose(file);
+    return bRead;
+}
+
+// main ----------------------------------------------------------------------
+
+int main(int argc, char *argv[])
+{
+    // Set default value for optional command line arguments.
+    const char *lblFile = NULL;
+    const char *fmapDir = NULL;
+    const char *mscDir = NULL;
+    const char *cshDir = NULL;
+    const char *csdDir = NULL;
+    bool bRaw = false;
+
+    DRWN_BEGIN_CMDLINE_PROCESSING(argc, argv)
+        DRWN_CMDLINE_STR_OPTION("-labels", lblFile)
+        DRWN_CMDLINE_STR_OPTION("-fmap", fmapDir)
+        DRWN_CMDLINE_STR_OPTION("-msc", mscDir)
+        DRWN_CMDLINE_STR_OPTION("-csh", cshDir)
+        DRWN_CMDLINE_STR_OPTION("-csd", csdDir)
+        DRWN_CMDLINE_BOOL_OPTION("-raw", bRaw)
+    DRWN_END_CMDLINE_PROCESSING(usage());
+
+    // Check for the correct number of required arguments
+    if (DRWN_CMDLINE_ARGC != 2) {
+        usage();
+        return -1;
+    }
+
+    const char *imgDir = DRWN_CMDLINE_ARGV[0]; // directory restores original images
+    const char *packFile = DRWN_CMDLINE_ARGV[1]; // the dataset pack to write
+
+    DRWN_ASSERT_MSG(drwnDirExists(imgDir), "image directory " << imgDir << " does not exist");
+    const bool bJpegMaps = (mscDir != NULL) || (cshDir != NULL) || (csdDir != NULL);
+    DRWN_ASSERT_MSG(!bJpegMaps || ((mscDir != NULL) && (cshDir != NULL) && (csdDir != NULL)),
+        "-msc, -csh and -csd are needed together");
+    DRWN_ASSERT_MSG(!bJpegMaps || (fmapDir == NULL), "-fmap and -msc/-csh/-csd are exclusive");
+    if (fmapDir != NULL) {
+        DRWN_ASSERT_MSG(drwnDirExists(fmapDir), "feature map directory " << fmapDir << " does not exist");
+    }
+    if (lblFile != NULL) {
+        DRWN_ASSERT_MSG(drwnFileExists(lblFile), "Labels file " << lblFile << " does not exist");
+    }
+
+    vector<string> baseNames = drwnDirectoryListing(imgDir, ".jpg", false, false);
+    DRWN_LOG_MESSAGE("Packing " << baseNames.size() << " images...");
+    map< string, vector<int> > fileLabelPairs;
+    if (lblFile != NULL) {
+        fileLabelPairs = parseLabel(lblFile);
+    }
+
+    DatasetPackWriter writer;
+    DRWN_ASSERT_MSG(writer.open(packFile), "could not create dataset pack " << packFile);
+    vector<unsigned char> image;
+    vector<unsigned char> features;
+    size_t nImageBytes = 0;
+    size_t nFeatureBytes = 0;
+    int nLabelled = 0;
+    for (unsigned i = 0; i < baseNames.size(); i++) {
+        const string processedImage = baseNames[i] + ".jpg";
+        const string imageName = string(imgDir) + DRWN_DIRSEP + processedImage;
+        DRWN_LOG_STATUS("...packing image " << baseNames[i]);
+
+        // the image is decoded once for its size, and to keep its pixels
+        // with -raw
+        const cv::Mat img = cv::imread(imageName);
+        DRWN_ASSERT_MSG(img.data != NULL, "could not read image " << imageName);
+        if (bRaw) {
+            image.resize(3 * (size_t)img.rows * img.cols);
+            for (int y = 0; y < img.rows; y++) {
+                memcpy(&image[3 * (size_t)y * img.cols], img.ptr<unsigned char>(y), 3 * (size_t)img.cols);
+            }
+        } else {
+            DRWN_ASSERT_MSG(readFileBytes(imageName, image), "could not read image " << imageName);
+        }
+
+        features.clear();
+        if (fmapDir != NULL) {
+            const string filename = string(fmapDir) + DRWN_DIRSEP + baseNames[i] + ".fmap";
+            FeatureMapFile file;
+            DRWN_ASSERT_MSG(file.read(filename.c_str()) && file.complete(),
+                "could not read feature maps " << filename);
+            DRWN_ASSERT_MSG((file.width() == img.cols) && (file.height() == img.rows),
+                "feature maps " << filename << " do not match the size of the image");
+            file.serialize(features);
+        } else if (bJpegMaps) {
+            const cv::Mat maps = loadFeatureMaps(NULL, mscDir, cshDir, csdDir, baseNames[i]);
+            DRWN_ASSERT_MSG((maps.cols == img.cols) && (maps.rows == img.rows),
+                "feature maps of " << baseNames[i] << " are missing or do not match the size of the image");
+            FeatureMapFile file;
+            cv::Mat plane(maps.rows, maps.cols, CV_8UC1);
+            for (int k = 0; k < FEATURE_NUM_MAPS; k++) {
+                for (int y = 0; y < maps.rows; y++) {
+                    for (int x = 0; x < maps.cols; x++) {
+                        plane.at<unsigned char>(y, x) = maps.at<cv::Vec3b>(y, x).val[k];
+                    }
+                }
+                file.setPlane((FeatureMapKind)k, plane, FEATURE_MAP_UINT8);
+            }
+            file.serialize(features);
+        }
+
+        map< string, vector<int> >::const_iterator it = fileLabelPairs.find(processedImage);
+        const vector<int> *box = (it == fileLabelPairs.end()) ? NULL : &it->second;
+        if ((lblFile != NULL) && (box == NULL)) {
+            DRWN_LOG_WARNING("no ground truth for " << processedImage);
+        }
+        nLabelled += (box != NULL) ? 1 : 0;
+
+        DRWN_ASSERT_MSG(writer.add(baseNames[i], img.cols, img.rows,
+            bRaw ? PACK_IMAGE_BGR : PACK_IMAGE_ENCODED, image, features, box),
+            "could not write dataset pack " << packFile);
+        nImageBytes += image.size();
+        nFeatureBytes += features.size();
+    }
+    DRWN_ASSERT_MSG(writer.close(), "could not write dataset pack " << packFile);
+    DRWN_LOG_MESSAGE("Packed " << writer.size() << " images (" << (nImageBytes >> 20) << "MB), "
+        << ((nFeatureBytes > 0) ? "feature maps (" + toString(nFeatureBytes >> 20) + "MB)" : string("no feature maps"))
+        << " and " << nLabelled << " rectangles into " << packFile);
+
+    // Clean up by freeing memory and printing profile information.
+    drwnCodeProfiler::print();
+    return 0;
+}
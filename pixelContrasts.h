@@ -0,0 +1,223 @@
+/*****************************************************************************
+** DARWIN: A FRAMEWORK FOR MACHINE LEARNING RESEARCH AND DEVELOPMENT
+** Distributed under the terms of the BSD license (see the LICENSE file)
+** Copyright (c) 2007-2013, Stephen Gould
+** All rights reserved.
+**
+******************************************************************************
+** FILENAME:    pixelContrasts.h
+** AUTHOR(S):
+**              Jimmy Lin <u5223173@anu.edu.au>
+**              Chris Claoue-Long <u5183532@anu.edu.au>
+**
+** Contrast-sensitive pairwise weights exp(-beta ||I_p - I_q||^2) between
+** each pixel and its W, N, NW and SW neighbours, with beta = 1 / (2 <||I_p -
+** I_q||^2>) averaged over all 8-connected pairs. Stands in for
+** drwnPixelNeighbourContrasts, reading CV_8UC3 cv::Mat images directly and
+** vectorising the exponentials; benchCRF -contrast reports the largest
+** difference between the two. An initialized object only depends on the
+** image, so it can be kept and passed to the CRF for any number of pairwise
+** weights or backends.
+**
+*****************************************************************************/
+
+#pragma once
+
+// c++ standard headers
+#include <cstdlib>
+#include <cmath>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// opencv library headers
+#include "cv.h"
+#include "cxcore.h"
+
+// darwin library headers
+#include "drwnBase.h"
+
+using namespace std;
+
+// fast exponential -----------------------------------------------------------
+// exp(x) = 2^n exp(r) with |r| <= ln(2) / 2 and exp(r) from a degree 6
+// polynomial (Cephes expf); relative error below 2e-7 for -87 < x < 88
+
+inline float fastExp(float x)
+{
+    x = std::max(-87.3f, std::min(88.3f, x));
+    const float n = floorf(x * 1.44269504088896341f + 0.5f);
+    x -= n * 0.693359375f;
+    x -= n * -2.12194440e-4f;
+
+    float y = 1.9875691500e-4f;
+    y = y * x + 1.3981999507e-3f;
+    y = y * x + 8.3334519073e-3f;
+    y = y * x + 4.1665795894e-2f;
+    y = y * x + 1.6666665459e-1f;
+    y = y * x + 5.0000001201e-1f;
+    y = y * x * x + x + 1.0f;
+
+    return ldexpf(y, (int)n);
+}
+
+#if defined(__SSE2__)
+inline __m128 fastExp(__m128 x)
+{
+    x = _mm_max_ps(_mm_set1_ps(-87.3f), _mm_min_ps(_mm_set1_ps(88.3f), x));
+
+    // n = floor(x log2(e) + 1/2); truncation rounds towards zero so
+    // negative values are corrected by one
+    __m128 fx = _mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(1.44269504088896341f)), _mm_set1_ps(0.5f));
+    __m128i n = _mm_cvttps_epi32(fx);
+    __m128 t = _mm_cvtepi32_ps(n);
+    const __m128 mask = _mm_cmpgt_ps(t, fx);
+    t = _mm_sub_ps(t, _mm_and_ps(mask, _mm_set1_ps(1.0f)));
+    n = _mm_cvttps_epi32(t);
+
+    x = _mm_sub_ps(x, _mm_mul_ps(t, _mm_set1_ps(0.693359375f)));
+    x = _mm_sub_ps(x, _mm_mul_ps(t, _mm_set1_ps(-2.12194440e-4f)));
+
+    __m128 y = _mm_set1_ps(1.9875691500e-4f);
+    y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(1.3981999507e-3f));
+    y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(8.3334519073e-3f));
+    y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(4.1665795894e-2f));
+    y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(1.6666665459e-1f));
+    y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(5.0000001201e-1f));
+    y = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_mul_ps(y, x), x), x), _mm_set1_ps(1.0f));
+
+    // scale by 2^n by building the float exponent directly
+    const __m128i e = _mm_slli_epi32(_mm_add_epi32(n, _mm_set1_epi32(127)), 23);
+    return _mm_mul_ps(y, _mm_castsi128_ps(e));
+}
+#endif
+
+// PixelContrasts -------------------------------------------------------------
+
+class PixelContrasts {
+ public:
+    // directions, in the order of the contrast planes
+    typedef enum { W = 0, N, NW, SW, NUM_DIRECTIONS } Direction;
+
+ protected:
+    int _width;
+    int _height;
+    double _beta;
+    vector<float> _weights;     // NUM_DIRECTIONS planes of H-by-W, row-major
+
+ public:
+    PixelContrasts() : _width(0), _height(0), _beta(0.0) { }
+    ~PixelContrasts() { }
+
+    // Computes the weights of a CV_8UC3 image. Storage is reused when the
+    // image is no larger than the last one.
+    void initialize(const cv::Mat &img);
+
+    int width() const { return _width; }
+    int height() const { return _height; }
+    double beta() const { return _beta; }
+
+    // weight of the edge between (x, y) and (x - 1, y), (x, y - 1),
+    // (x - 1, y - 1) or (x - 1, y + 1); zero where the neighbour lies
+    // outside the image
+    float contrastW(int x, int y) const { return _weights[y * _width + x]; }
+    float contrastN(int x, int y) const { return _weights[(_height + y) * _width + x]; }
+    float contrastNW(int x, int y) const { return _weights[(2 * _height + y) * _width + x]; }
+    float contrastSW(int x, int y) const { return _weights[(3 * _height + y) * _width + x]; }
+};
+
+// PixelContrasts implementation ----------------------------------------------
+
+void PixelContrasts::initialize(const cv::Mat &img)
+{
+    DRWN_FCN_TIC;
+    DRWN_ASSERT_MSG(img.type() == CV_8UC3, "contrast weights need an 8-bit colour image");
+
+    _width = img.cols;
+    _height = img.rows;
+    const int H = _height;
+    const int W = _width;
+    const size_t planeSize = (size_t)H * W;
+    _weights.resize(NUM_DIRECTIONS * planeSize);
+
+    // squared colour differences to each neighbour, one pass over the rows
+    double sum = 0.0;
+    for (int y = 0; y < H; y++) {
+        const unsigned char *p = img.ptr<unsigned char>(y);
+        const unsigned char *pn = (y > 0) ? img.ptr<unsigned char>(y - 1) : NULL;
+        const unsigned char *ps = (y < H - 1) ? img.ptr<unsigned char>(y + 1) : NULL;
+        float *w = &_weights[y * W];
+        float *n = &_weights[planeSize + y * W];
+        float *nw = &_weights[2 * planeSize + y * W];
+        float *sw = &_weights[3 * planeSize + y * W];
+        double rowSum = 0.0;
+        for (int x = 0; x < W; x++) {
+            const int i = 3 * x;
+            float d0, d1, d2;
+            if (x > 0) {
+                d0 = (float)p[i] - p[i - 3]; d1 = (float)p[i + 1] - p[i - 2]; d2 = (float)p[i + 2] - p[i - 1];
+                w[x] = d0 * d0 + d1 * d1 + d2 * d2;
+                rowSum += w[x];
+            } else {
+                w[x] = 0.0f;
+            }
+            if (pn != NULL) {
+                d0 = (float)p[i] - pn[i]; d1 = (float)p[i + 1] - pn[i + 1]; d2 = (float)p[i + 2] - pn[i + 2];
+                n[x] = d0 * d0 + d1 * d1 + d2 * d2;
+                rowSum += n[x];
+            } else {
+                n[x] = 0.0f;
+            }
+            if ((pn != NULL) && (x > 0)) {
+                d0 = (float)p[i] - pn[i - 3]; d1 = (float)p[i + 1] - pn[i - 2]; d2 = (float)p[i + 2] - pn[i - 1];
+                nw[x] = d0 * d0 + d1 * d1 + d2 * d2;
+                rowSum += nw[x];
+            } else {
+                nw[x] = 0.0f;
+            }
+            if ((ps != NULL) && (x > 0)) {
+                d0 = (float)p[i] - ps[i - 3]; d1 = (float)p[i + 1] - ps[i - 2]; d2 = (float)p[i + 2] - ps[i - 1];
+                sw[x] = d0 * d0 + d1 * d1 + d2 * d2;
+                rowSum += sw[x];
+            } else {
+                sw[x] = 0.0f;
+            }
+        }
+        sum += rowSum;
+    }
+
+    // beta from the mean over all edges of the 8-connected grid
+    const double nEdges = (double)(W - 1) * H + (double)W * (H - 1) + 2.0 * (W - 1) * (H - 1);
+    _beta = (sum > 0.0) ? 0.5 * nEdges / sum : 0.0;
+
+    // exponentiate all planes in one sweep
+    const float negBeta = (float)(-_beta);
+    float *c = &_weights[0];
+    const size_t n = _weights.size();
+    size_t i = 0;
+#if defined(__SSE2__)
+    const __m128 b = _mm_set1_ps(negBeta);
+    for (; i + 4 <= n; i += 4) {
+        _mm_storeu_ps(c + i, fastExp(_mm_mul_ps(b, _mm_loadu_ps(c + i))));
+    }
+#endif
+    for (; i < n; i++) {
+        c[i] = fastExp(negBeta * c[i]);
+    }
+
+    // clear edges leaving the image
+    for (int y = 0; y < H; y++) {
+        _weights[y * W] = 0.0f;
+        _weights[2 * planeSize + y * W] = 0.0f;
+        _weights[3 * planeSize + y * W] = 0.0f;
+    }
+    for (int x = 0; x < W; x++) {
+        _weights[planeSize + x] = 0.0f;
+        _weights[2 * planeSize + x] = 0.0f;
+        _weights[3 * planeSize + (H - 1) * W + x] = 0.0f;
+    }
+
+    DRWN_FCN_TOC;
+}
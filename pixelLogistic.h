@@ -0,0 +1,168 @@
+/*****************************************************************************
+** DARWIN: A FRAMEWORK FOR MACHINE LEARNING RESEARCH AND DEVELOPMENT
+** Distributed under the terms of the BSD license (see the LICENSE file)
+** Copyright (c) 2007-2013, Stephen Gould
+** All rights reserved.
+**
+******************************************************************************
+** FILENAME:    pixelLogistic.h
+** AUTHOR(S):
+**              Jimmy Lin <u5223173@anu.edu.au>
+**              Chris Claoue-Long <u5183532@anu.edu.au>
+**
+** Batch training of the pixel saliency model directly on a contiguous
+** row-major feature matrix, x = (msc, csh, csd, 1) per row. It minimizes
+** the objective of darwin's two-class logistic classifier, so the weights
+** follow the convention of writeSaliencyModel (saliencyUtils.h). With four
+** parameters, Newton's method converges in a handful of passes over the
+** matrix, and nothing is copied into per-sample vectors.
+**
+*****************************************************************************/
+
+#pragma once
+
+// c++ standard headers
+#include <cstdlib>
+#include <cmath>
+#include <vector>
+
+// eigen matrix library headers
+#include "Eigen/Core"
+#include "Eigen/Cholesky"
+
+// darwin library headers
+#include "drwnBase.h"
+#include "drwnML.h"
+
+using namespace std;
+
+#include "Classifier.h"
+
+// one row of features per pixel
+typedef Eigen::Matrix<float, Eigen::Dynamic, 4, Eigen::RowMajor> PixelFeatureMatrix;
+
+// prototypes ----------------------------------------------------------------
+
+// Fits p(background | x) = 1 / (1 + exp(-theta^T x)) to the rows of
+// features, with targets 1 for salient and 0 for background pixels and
+// optional per-row weights (NULL for unit weights). Like darwin's
+// drwnTMultiClassLogistic, theta scores class 0 and the objective is the
+// weighted mean log loss plus l2 / 2 ||theta||^2; the bias is not
+// regularized. Starts from zero and returns the final objective.
+double fitPixelLogistic(const PixelFeatureMatrix &features, const Eigen::VectorXf &targets,
+    const Eigen::VectorXf *weights, vector<double> &theta,
+    double l2 = drwnMultiClassLogisticBase::REG_STRENGTH, int maxIterations = 50);
+
+// Trains darwin's two-class logistic classifier on the same rows, copying
+// them into per-sample vectors, and returns its weights in theta. Used to
+// check fitPixelLogistic (trainModel -verify).
+void fitDarwinLogistic(const PixelFeatureMatrix &features, const Eigen::VectorXf &targets,
+    const Eigen::VectorXf *weights, vector<double> &theta);
+
+// implementation ------------------------------------------------------------
+
+// objective, gradient and Hessian at theta, in one pass over the rows
+static double pixelLogisticObjective(const PixelFeatureMatrix &features,
+    const Eigen::VectorXf &targets, const Eigen::VectorXf *weights, double l2,
+    const Eigen::Vector4d &theta, Eigen::Vector4d &g, Eigen::Matrix4d &h)
+{
+    double loss = 0.0;
+    double total = 0.0;
+    g.setZero();
+    h.setZero();
+    for (int i = 0; i < features.rows(); i++) {
+        const Eigen::Vector4d x = features.row(i).transpose().cast<double>();
+        const double c = (weights == NULL) ? 1.0 : (double)(*weights)[i];
+        const bool bBackground = (targets[i] < 0.5f);
+        const double z = theta.dot(x);
+        const double p = 1.0 / (1.0 + exp(-z));
+        // -log p(target | x), computed stably
+        const double m = bBackground ? -z : z;
+        loss += c * ((m > 0.0) ? m + log1p(exp(-m)) : log1p(exp(m)));
+        g += (c * (p - (bBackground ? 1.0 : 0.0))) * x;
+        h.selfadjointView<Eigen::Lower>().rankUpdate(x, c * p * (1.0 - p));
+        total += c;
+    }
+    h = h.selfadjointView<Eigen::Lower>();
+
+    total = std::max(total, 1.0e-12);
+    loss /= total;
+    g /= total;
+    h /= total;
+    for (int d = 0; d < 3; d++) {
+        loss += 0.5 * l2 * theta[d] * theta[d];
+        g[d] += l2 * theta[d];
+        h(d, d) += l2;
+    }
+    return loss;
+}
+
+double fitPixelLogistic(const PixelFeatureMatrix &features, const Eigen::VectorXf &targets,
+    const Eigen::VectorXf *weights, vector<double> &theta, double l2, int maxIterations)
+{
+    DRWN_FCN_TIC;
+    DRWN_ASSERT_MSG(targets.rows() == features.rows(), "feature and target counts differ");
+
+    Eigen::Vector4d w = Eigen::Vector4d::Zero();
+    Eigen::Vector4d g;
+    Eigen::Matrix4d h;
+    double objective = pixelLogisticObjective(features, targets, weights, l2, w, g, h);
+    for (int n = 0; n < maxIterations; n++) {
+        // Newton step, halved until the objective decreases
+        const Eigen::Vector4d step = h.ldlt().solve(g);
+        double alpha = 1.0;
+        Eigen::Vector4d gNext;
+        Eigen::Matrix4d hNext;
+        double next = pixelLogisticObjective(features, targets, weights, l2, w - step, gNext, hNext);
+        while ((next > objective) && (alpha > 1.0e-4)) {
+            alpha *= 0.5;
+            next = pixelLogisticObjective(features, targets, weights, l2, w - alpha * step, gNext, hNext);
+        }
+        if (next > objective) break;
+
+        w -= alpha * step;
+        g = gNext;
+        h = hNext;
+        const double decrease = objective - next;
+        objective = next;
+        if ((alpha * step.norm() < 1.0e-8) || (decrease < 1.0e-12)) break;
+    }
+
+    theta.resize(4);
+    for (int d = 0; d < 4; d++) {
+        theta[d] = w[d];
+    }
+
+    DRWN_FCN_TOC;
+    return objective;
+}
+
+void fitDarwinLogistic(const PixelFeatureMatrix &features, const Eigen::VectorXf &targets,
+    const Eigen::VectorXf *weights, vector<double> &theta)
+{
+    DRWN_ASSERT_MSG(targets.rows() == features.rows(), "feature and target counts differ");
+
+    const int nDimension = 4;
+    const int n = features.rows();
+    vector< vector<double> > x(n, vector<double>(nDimension));
+    vector<int> y(n);
+    for (int i = 0; i < n; i++) {
+        for (int d = 0; d < nDimension; d++) {
+            x[i][d] = features(i, d);
+        }
+        y[i] = (targets[i] > 0.5f) ? 1 : 0;
+    }
+
+    Classifier classifier;
+    classifier.initialize(nDimension, 2);
+    if (weights == NULL) {
+        classifier.train(x, y);
+    } else {
+        vector<double> w(n);
+        for (int i = 0; i < n; i++) {
+            w[i] = (*weights)[i];
+        }
+        classifier.train(x, y, w);
+    }
+    theta = classifier.getWeights();
+}
@@ -0,0 +1,180 @@
+/*****************************************************************************
+** DARWIN: A FRAMEWORK FOR MACHINE LEARNING RESEARCH AND DEVELOPMENT
+** Distributed under the terms of the BSD license (see the LICENSE file)
+** Copyright (c) 2007-2013, Stephen Gould
+** All rights reserved.
+**
+******************************************************************************
+** FILENAME:    pixelSampling.h
+** AUTHOR(S):
+**              Jimmy Lin <u5223173@anu.edu.au>
+**              Chris Claoue-Long <u5183532@anu.edu.au>
+**
+** Stratified selection of the training pixels of one image. Pixels are
+** grouped by their ground truth label (inside or outside the rectangle)
+** and, optionally, by bands of distance to the rectangle's edge. Half of
+** the sample is drawn from each label and spread evenly over its bands,
+** so that the few salient pixels and the hard pixels near the boundary are
+** not swamped by the background. Every selected pixel carries the inverse
+** of its stratum's sampling rate as a weight, which keeps the weighted
+** loss an unbiased estimate of the loss over all pixels.
+**
+*****************************************************************************/
+
+#pragma once
+
+// c++ standard headers
+#include <cstdlib>
+#include <vector>
+#include <algorithm>
+
+// darwin library headers
+#include "drwnBase.h"
+
+using namespace std;
+
+// StratifiedPixelSampler -----------------------------------------------------
+
+class StratifiedPixelSampler {
+ protected:
+    int _nSamples;              // pixels per image
+    int _nBands;                // distance bands per label
+    unsigned _seed;
+
+    // pixel indices of every stratum, positive bands first; kept between
+    // images to avoid reallocation
+    vector<vector<int> > _strata;
+    vector<int> _quota;
+
+ public:
+    StratifiedPixelSampler(int nSamples, int nBands = 1, unsigned seed = 0);
+
+    int samples() const { return _nSamples; }
+    int bands() const { return _nBands; }
+
+    // Selects pixels of a W x H image with the ground truth rectangle
+    // (left, top, right, bottom), inclusive. Writes their row-major indices
+    // and weights, and returns their number. The selection depends only on
+    // the seed, the image key and the image size and rectangle, so that
+    // images can be sampled in any order.
+    int sample(int W, int H, const vector<int> &box, unsigned key,
+        vector<int> &indices, vector<float> &weights);
+
+ protected:
+    // splits n samples over the given strata, as evenly as their sizes allow
+    static int allocate(int n, const vector<vector<int> > &strata, int first, int last,
+        vector<int> &quota);
+};
+
+// StratifiedPixelSampler implementation --------------------------------------
+
+StratifiedPixelSampler::StratifiedPixelSampler(int nSamples, int nBands, unsigned seed) :
+    _nSamples(nSamples), _nBands(nBands), _seed(seed)
+{
+    DRWN_ASSERT_MSG(_nSamples > 0, "number of samples must be positive");
+    DRWN_ASSERT_MSG(_nBands > 0, "number of distance bands must be positive");
+    _strata.resize(2 * _nBands);
+    _quota.resize(2 * _nBands);
+}
+
+int StratifiedPixelSampler::sample(int W, int H, const vector<int> &box, unsigned key,
+    vector<int> &indices, vector<float> &weights)
+{
+    const int left = std::max(box[0], 0);
+    const int top = std::max(box[1], 0);
+    const int right = std::min(box[2], W - 1);
+    const int bottom = std::min(box[3], H - 1);
+
+    // largest distance to the edge inside and outside the rectangle, which
+    // the bands of each label divide evenly
+    const int insideRange = std::max(0, (std::min(right - left, bottom - top)) / 2) + 1;
+    const int outsideRange = std::max(std::max(left, W - 1 - right), std::max(top, H - 1 - bottom)) + 1;
+
+    for (int s = 0; s < 2 * _nBands; s++) {
+        _strata[s].clear();
+    }
+    for (int y = 0; y < H; y++) {
+        const int dy = (y < top) ? top - y : ((y > bottom) ? y - bottom : 0);
+        for (int x = 0; x < W; x++) {
+            const int dx = (x < left) ? left - x : ((x > right) ? x - right : 0);
+            int s;
+            if ((dx == 0) && (dy == 0)) {
+                const int d = std::min(std::min(x - left, right - x), std::min(y - top, bottom - y));
+                s = std::min(_nBands - 1, d * _nBands / insideRange);
+            } else {
+                const int d = std::max(dx, dy) - 1;
+                s = _nBands + std::min(_nBands - 1, d * _nBands / outsideRange);
+            }
+            _strata[s].push_back(y * W + x);
+        }
+    }
+
+    // half of the samples for each label, unless one label runs short
+    int nPositive = 0;
+    for (int s = 0; s < _nBands; s++) {
+        nPositive += (int)_strata[s].size();
+    }
+    const int nNegative = W * H - nPositive;
+    int positiveTake = std::min(nPositive, _nSamples / 2);
+    const int negativeTake = std::min(nNegative, _nSamples - positiveTake);
+    positiveTake = std::min(nPositive, _nSamples - negativeTake);
+    allocate(positiveTake, _strata, 0, _nBands, _quota);
+    allocate(negativeTake, _strata, _nBands, 2 * _nBands, _quota);
+
+    // partial Fisher-Yates shuffle of every stratum with its own
+    // deterministic generator
+    indices.clear();
+    weights.clear();
+    unsigned state = (_seed * 2654435761u) ^ (key * 40503u + 1u);
+    for (int s = 0; s < 2 * _nBands; s++) {
+        vector<int> &stratum = _strata[s];
+        const int n = (int)stratum.size();
+        const int k = _quota[s];
+        if (k == 0) continue;
+        for (int i = 0; i < k; i++) {
+            state = state * 1103515245u + 12345u;
+            const int j = i + (int)((state >> 8) % (unsigned)(n - i));
+            std::swap(stratum[i], stratum[j]);
+        }
+        // visit the selected pixels in memory order
+        std::sort(stratum.begin(), stratum.begin() + k);
+        const float w = (float)n / (float)k;
+        indices.insert(indices.end(), stratum.begin(), stratum.begin() + k);
+        weights.insert(weights.end(), k, w);
+    }
+
+    return (int)indices.size();
+}
+
+int StratifiedPixelSampler::allocate(int n, const vector<vector<int> > &strata, int first, int last,
+    vector<int> &quota)
+{
+    // water filling: strata smaller than an even share are taken whole and
+    // the remainder is shared among the others
+    int remaining = n;
+    int open = last - first;
+    for (int s = first; s < last; s++) {
+        quota[s] = -1;
+    }
+    bool bChanged = true;
+    while (bChanged && (open > 0)) {
+        bChanged = false;
+        const int share = remaining / open;
+        for (int s = first; s < last; s++) {
+            if ((quota[s] < 0) && ((int)strata[s].size() <= share)) {
+                quota[s] = (int)strata[s].size();
+                remaining -= quota[s];
+                open -= 1;
+                bChanged = true;
+            }
+        }
+    }
+    for (int s = first; s < last; s++) {
+        if (quota[s] >= 0) continue;
+        const int share = remaining / open;
+        quota[s] = share + ((remaining - share * open) > 0 ? 1 : 0);
+        remaining -= quota[s];
+        open -= 1;
+    }
+    return n - remaining;
+}
@@ -0,0 +1,275 @@
+/*****************************************************************************
+** DARWIN: A FRAMEWORK FOR MACHINE LEARNING RESEARCH AND DEVELOPMENT
+** Distributed under the terms of the BSD license (see the LICENSE file)
+** Copyright (c) 2007-2013, Stephen Gould
+** All rights reserved.
+**
+******************************************************************************
+** FILENAME:    prefetchPipeline.h
+** AUTHOR(S):
+**              Jimmy Lin <u5223173@anu.edu.au>
+**              Chris Claoue-Long <u5183532@anu.edu.au>
+**
+** Loads the images of a dataset and their feature maps ahead of the loop
+** that uses them, so that decoding overlaps with the unary and CRF stages.
+** Each decoder thread loads every nThreads-th image into its own bounded
+** single-producer single-consumer ring, and the consumer takes them from
+** the rings in turn, so items arrive in image order without any lock.
+**
+*****************************************************************************/
+
+#pragma once
+
+// c++ standard headers
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+// opencv library headers
+#include "cv.h"
+#include "cxcore.h"
+#include "highgui.h"
+
+// darwin library headers
+#include "drwnBase.h"
+
+#include "featureMapStore.h"
+#include "datasetPack.h"
+
+using namespace std;
+
+// SpscRing ------------------------------------------------------------------
+// Bounded ring for exactly one producer thread and one consumer thread.
+// Each side only writes its own index, and full barriers order the slot
+// accesses against the index updates.
+
+template <typename T>
+class SpscRing {
+ protected:
+    vector<T> _slots;           // one more than the capacity
+    volatile unsigned _head;    // next slot to read, written by the consumer
+    volatile unsigned _tail;    // next slot to write, written by the producer
+
+ public:
+    SpscRing(unsigned capacity) : _slots(capacity + 1), _head(0), _tail(0) { }
+
+    // returns false if the ring is full
+    bool push(const T &value) {
+        const unsigned tail = _tail;
+        const unsigned next = (tail + 1) % _slots.size();
+        if (next == _head) return false;
+        __sync_synchronize();   // the consumer is done with the slot
+        _slots[tail] = value;
+        __sync_synchronize();   // publish the slot before the index
+        _tail = next;
+        return true;
+    }
+
+    // returns false if the ring is empty
+    bool pop(T &value) {
+        const unsigned head = _head;
+        if (head == _tail) return false;
+        __sync_synchronize();   // read the slot after the index
+        value = _slots[head];
+        _slots[head] = T();     // release it here rather than on the producer
+        __sync_synchronize();
+        _head = (head + 1) % _slots.size();
+        return true;
+    }
+};
+
+// PrefetchItem and loaders --------------------------------------------------
+
+struct PrefetchItem {
+    unsigned index;             // position of the image in the dataset
+    cv::Mat img;
+    cv::Mat features;           // packed MSC, CSH and CSD maps
+    string error;               // why loading failed, or empty
+
+    PrefetchItem() : index(0) { }
+};
+
+class PrefetchLoader {
+ public:
+    virtual ~PrefetchLoader() { }
+    // Fills in item, and may be called from several threads at once. A
+    // failure is recorded in item.error rather than raised, since only
+    // the consumer thread can stop the program cleanly.
+    virtual void load(unsigned index, PrefetchItem &item) const = 0;
+};
+
+// Loads image and/or feature maps from a dataset pack, or from the image
+// directory and the feature maps as loadFeatureMaps reads them.
+class DatasetImageLoader : public PrefetchLoader {
+ public:
+    const vector<string> *baseNames;
+    const DatasetPack *pack;    // or NULL for the directories below
+    const char *imgDir;
+    const char *fmapDir;
+    const char *mscDir;
+    const char *cshDir;
+    const char *csdDir;
+    bool bImages;
+    bool bFeatures;
+
+ public:
+    DatasetImageLoader() : baseNames(NULL), pack(NULL), imgDir(NULL), fmapDir(NULL),
+        mscDir(NULL), cshDir(NULL), csdDir(NULL), bImages(true), bFeatures(true) { }
+    void load(unsigned index, PrefetchItem &item) const;
+};
+
+// PrefetchPipeline ----------------------------------------------------------
+// Hands out the items 0 to nItems - 1 in order with up to depth of them
+// loaded in advance by nThreads decoder threads. With a depth of zero the
+// items are loaded by next() itself. An item that failed to load stops the
+// program in next(), on the consumer thread, with the loader's message.
+
+class PrefetchPipeline {
+ protected:
+    struct Decoder {
+        PrefetchPipeline *owner;
+        unsigned first;         // loads first, first + nThreads, ...
+        SpscRing<PrefetchItem> *ring;
+        pthread_t thread;
+    };
+
+    const PrefetchLoader &_loader;
+    unsigned _nItems;
+    unsigned _next;
+    vector<Decoder> _decoders;
+    volatile int _stop;
+    double _waitTime;
+
+ public:
+    PrefetchPipeline(const PrefetchLoader &loader, unsigned nItems, unsigned depth, unsigned nThreads);
+    ~PrefetchPipeline();
+
+    // the next item, or false once all of them have been handed out
+    bool next(PrefetchItem &item);
+
+    // seconds next() spent waiting for or doing the loading
+    double waitTime() const { return _waitTime; }
+
+ protected:
+    static void *decode(void *arg);
+    static void backoff(unsigned &nTries);
+    static double wallTime();
+};
+
+// DatasetImageLoader implementation -----------------------------------------
+
+void DatasetImageLoader::load(unsigned index, PrefetchItem &item) const
+{
+    item.index = index;
+    const string &baseName = (*baseNames)[index];
+    if (pack != NULL) {
+        if (bImages) item.img = pack->image(index);
+        if (bFeatures && !pack->readFeatures(index, item.features)) {
+            item.error = "dataset pack has no valid feature maps for " + baseName;
+        }
+    } else {
+        if (bImages) item.img = cv::imread(string(imgDir) + DRWN_DIRSEP + baseName + ".jpg");
+        if (bFeatures) {
+            readFeatureMaps(fmapDir, mscDir, cshDir, csdDir, baseName, item.features, item.error);
+        }
+    }
+    if (bImages && item.img.empty() && item.error.empty()) {
+        item.error = "could not read image " + baseName;
+    }
+}
+
+// PrefetchPipeline implementation -------------------------------------------
+
+PrefetchPipeline::PrefetchPipeline(const PrefetchLoader &loader, unsigned nItems,
+    unsigned depth, unsigned nThreads) :
+    _loader(loader), _nItems(nItems), _next(0), _stop(0), _waitTime(0.0)
+{
+    nThreads = std::min(nThreads, std::min(depth, nItems));
+    if (nThreads == 0) return;
+
+    // the depth is shared between the rings
+    const unsigned capacity = (depth + nThreads - 1) / nThreads;
+    _decoders.resize(nThreads);
+    for (unsigned k = 0; k < nThreads; k++) {
+        _decoders[k].owner = this;
+        _decoders[k].first = k;
+        _decoders[k].ring = new SpscRing<PrefetchItem>(capacity);
+    }
+    for (unsigned k = 0; k < nThreads; k++) {
+        DRWN_ASSERT_MSG(pthread_create(&_decoders[k].thread, NULL, decode, &_decoders[k]) == 0,
+            "could not start decoder thread");
+    }
+}
+
+PrefetchPipeline::~PrefetchPipeline()
+{
+    __sync_lock_test_and_set(&_stop, 1);
+    for (unsigned k = 0; k < _decoders.size(); k++) {
+        pthread_join(_decoders[k].thread, NULL);
+    }
+    for (unsigned k = 0; k < _decoders.size(); k++) {
+        delete _decoders[k].ring;
+    }
+}
+
+bool PrefetchPipeline::next(PrefetchItem &item)
+{
+    if (_next >= _nItems) return false;
+
+    const double startTime = wallTime();
+    if (_decoders.empty()) {
+        _loader.load(_next, item);
+    } else {
+        SpscRing<PrefetchItem> *ring = _decoders[_next % _decoders.size()].ring;
+        unsigned nTries = 0;
+        while (!ring->pop(item)) {
+            backoff(nTries);
+        }
+        DRWN_ASSERT(item.index == _next);
+    }
+    DRWN_ASSERT_MSG(item.error.empty(), item.error);
+    _waitTime += wallTime() - startTime;
+    _next += 1;
+    return true;
+}
+
+void *PrefetchPipeline::decode(void *arg)
+{
+    Decoder *decoder = (Decoder *)arg;
+    PrefetchPipeline *owner = decoder->owner;
+    const unsigned stride = owner->_decoders.size();
+    for (unsigned i = decoder->first; (i < owner->_nItems) && !owner->_stop; i += stride) {
+        PrefetchItem item;
+        owner->_loader.load(i, item);
+        unsigned nTries = 0;
+        while (!decoder->ring->push(item)) {
+            if (owner->_stop) return NULL;
+            backoff(nTries);
+        }
+    }
+    return NULL;
+}
+
+void PrefetchPipeline::backoff(unsigned &nTries)
+{
+    // spin briefly for a handoff that is about to happen, then give up the
+    // processor, then sleep while a whole image is being decoded
+    nTries += 1;
+    if (nTries < 64) return;
+    if (nTries < 128) {
+        sched_yield();
+    } else {
+        usleep(100);
+    }
+}
+
+double PrefetchPipeline::wallTime()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + 1.0e-6 * tv.tv_usec;
+}
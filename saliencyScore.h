@@ -0,0 +1,124 @@
+/*****************************************************************************
+** DARWIN: A FRAMEWORK FOR MACHINE LEARNING RESEARCH AND DEVELOPMENT
+** Distributed under the terms of the BSD license (see the LICENSE file)
+** Copyright (c) 2007-2013, Stephen Gould
+** All rights reserved.
+**
+******************************************************************************
+** FILENAME:    saliencyScore.h
+** AUTHOR(S):
+**              Jimmy Lin <u5223173@anu.edu.au>
+**              Chris Claoue-Long <u5183532@anu.edu.au>
+**
+** Scoring of predicted salient rectangles against the ground truth: the
+** Boundary Displacement Error and the recall, precision and F-measure of
+** the overlap, accumulated over images exactly as scoreModel reports them.
+**
+*****************************************************************************/
+
+#pragma once
+
+// c++ standard headers
+#include <cmath>
+#include <vector>
+
+using namespace std;
+
+// prototypes ----------------------------------------------------------------
+
+// Sum over the pixels of the large rectangle that lie outside the small one
+// of their distance to the nearest pixel of the small rectangle. All
+// coordinates are inclusive.
+float BDEdistance(int largeLeft, int largeTop, int largeRight, int largeBottom,
+    int smallLeft, int smallTop, int smallRight, int smallBottom);
+
+// SaliencyScore -------------------------------------------------------------
+// Running totals of the scores of a set of images. Every image counts
+// towards the averages, including those that scoreModel skips because of
+// out-of-range or empty rectangles.
+
+struct SaliencyScore {
+    float bde;                  // sum of the per-image BDE over the area
+    double recall;
+    double precision;
+    double fMeasure;
+    int nImages;
+
+    SaliencyScore() { clear(); }
+    void clear() { bde = 0.0f; recall = precision = fMeasure = 0.0; nImages = 0; }
+
+    // scores one image from its (left, top, right, bottom) rectangles and
+    // returns false if the image only counts towards the averages
+    bool add(const vector<int> &result, const vector<int> &truth);
+
+    float averageBDE() const { return (nImages > 0) ? bde / (float)nImages : 0.0f; }
+    double averageRecall() const { return (nImages > 0) ? recall / (float)nImages : 0.0; }
+    double averagePrecision() const { return (nImages > 0) ? precision / (float)nImages : 0.0; }
+    double averageFMeasure() const { return (nImages > 0) ? fMeasure / (float)nImages : 0.0; }
+};
+
+// implementation ------------------------------------------------------------
+
+float BDEdistance(int largeLeft, int largeTop, int largeRight, int largeBottom,
+    int smallLeft, int smallTop, int smallRight, int smallBottom)
+{
+    float dist = 0.0;
+    for (int x = largeLeft; x <= largeRight; x++) {
+        for (int y = largeTop; y <= largeBottom; y++) {
+            if (!(x >= smallLeft && x <= smallRight && y >= smallTop && y <= smallBottom)) {
+                // the nearest pixel of the small rectangle is (x, y) clamped
+                // to it, so there is no need to search the whole rectangle
+                const int smallx = std::min(std::max(x, smallLeft), smallRight);
+                const int smally = std::min(std::max(y, smallTop), smallBottom);
+                dist += sqrt(pow((float)x - smallx, 2) + pow((float)y - smally, 2));
+            }
+        }
+    }
+
+    return dist;
+}
+
+bool SaliencyScore::add(const vector<int> &result, const vector<int> &truth)
+{
+    const int rleft = result.at(0);
+    const int tleft = truth.at(0);
+    const int rtop = result.at(1);
+    const int ttop = truth.at(1);
+    const int rright = result.at(2);
+    const int tright = truth.at(2);
+    const int rbottom = result.at(3);
+    const int tbottom = truth.at(3);
+    nImages += 1;
+
+    // to avoid case of exception.
+    if (rleft < 0 || tleft < 0 || rtop < 0 || ttop < 0) {
+        return false;
+    }
+    if (rright > 500 || tright > 500 || rbottom > 500 || ttop > 500) {
+        return false;
+    }
+    // get the largest area rectangle, use this to calculate the distance
+    if ((rright - rleft) * (rbottom - rtop) > (tright - tleft) * (tbottom - ttop))
+        bde += (BDEdistance(rleft, rtop, rright, rbottom, tleft, ttop, tright, tbottom) / ((rright - rleft) * (rbottom - rtop)));
+    else bde += (BDEdistance(tleft, ttop, tright, tbottom, rleft, rtop, rright, rbottom) / ((tright - tleft) * (tbottom - ttop)));
+
+    // compute the overlapped region, used for precision and recall computation
+    if (rtop == 0 && rbottom == 0 && rleft == 0 && rright == 0) {
+        return false;
+    }
+    const int overlapLeft = std::max(rleft, tleft);
+    const int overlapRight = std::min(rright - 1, tright);
+    const int overlapTop = std::max(rtop, ttop);
+    const int overlapBottom = std::min(rbottom - 1, tbottom);
+    const int nDetectedPixels = ((overlapRight >= overlapLeft) && (overlapBottom >= overlapTop)) ?
+        (overlapRight - overlapLeft + 1) * (overlapBottom - overlapTop + 1) : 0;
+
+    const double r = nDetectedPixels / (1.0 * (tbottom - ttop) * (tright - tleft));
+    const double p = nDetectedPixels / (1.0 * (rbottom - rtop) * (rright - rleft));
+    recall += r;
+    precision += p;
+    if (r != 0 || p != 0) {
+        fMeasure += (1.5 * p * r) / (0.5 * p + r);
+    }
+    return true;
+}
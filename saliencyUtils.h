@@ -0,0 +1,177 @@
+/*****************************************************************************
+** DARWIN: A FRAMEWORK FOR MACHINE LEARNING RESEARCH AND DEVELOPMENT
+** Distributed under the terms of the BSD license (see the LICENSE file)
+** Copyright (c) 2007-2013, Stephen Gould
+** All rights reserved.
+**
+******************************************************************************
+** FILENAME:    saliencyUtils.h
+** AUTHOR(S):
+**              Jimmy Lin <u5223173@anu.edu.au>
+**              Chris Claoue-Long <u5183532@anu.edu.au>
+**
+** Helpers shared by the applications that run the saliency CRF.
+**
+*****************************************************************************/
+
+#pragma once
+
+// c++ standard headers
+#include <vector>
+#include <string>
+#include <fstream>
+
+// opencv library headers
+#include "cv.h"
+#include "cxcore.h"
+
+using namespace std;
+
+// prototypes ----------------------------------------------------------------
+
+// Combines the multi-scale contrast, centre-surround histogram and colour
+// spatial distribution feature maps (first channel of each) with weights
+// lambda1, lambda2 and lambda3 and rescales the result to [0, 1] to give the
+// unary potentials of the two-label saliency CRF. Buffers in unary are
+// reused when they already have the right size.
+void computeUnary(const cv::Mat &msc, const cv::Mat &csh, const cv::Mat &csd,
+    double lambda1, double lambda2, double lambda3, vector< cv::Mat > &unary);
+
+// As above, for the three feature maps packed into the channels of one
+// CV_8UC3 image, in the order MSC, CSH, CSD, or of one CV_32FC3 image with
+// values in [0, 1].
+void computeUnary(const cv::Mat &features, double lambda1, double lambda2,
+    double lambda3, vector< cv::Mat > &unary);
+
+// Returns the bounding box of the salient region of a CV_16S binary
+// labelling, taken from the external contours of the label 1 pixels.
+cv::Rect salientBoundingBox(const cv::Mat &labels);
+
+// Appends the label file entry for one image, in the format of the MSRA
+// ground truth label files read by scoreModel.
+void writeLabelEntry(ofstream &ofs, const string &baseName, int width, int height,
+    const cv::Rect &box);
+
+// Writes the weights of the pixel saliency model (MSC, CSH, CSD and bias)
+// as a one-line text file. Returns false on failure. Every trainer follows
+// darwin's two-class logistic classifier, whose weights score class 0, the
+// background: theta^T x is the log-odds of background against salient,
+// which is why computeUnary uses it as the cost of the salient label.
+bool writeSaliencyModel(const char *filename, const vector<double> &weights);
+
+// implementation ------------------------------------------------------------
+
+void computeUnary(const cv::Mat &msc, const cv::Mat &csh, const cv::Mat &csd,
+    double lambda1, double lambda2, double lambda3, vector< cv::Mat > &unary)
+{
+    unary.resize(2);
+    unary[0].create(msc.rows, msc.cols, CV_64F);
+    unary[1].create(msc.rows, msc.cols, CV_64F);
+
+    double maxValue = -1e6, minValue = 1e6;
+    for (int y = 0; y < msc.rows; y++) {
+        for (int x = 0; x < msc.cols; x++) {
+            const double grayscale = lambda1 * (msc.at<cv::Vec3b>(y, x).val[0] / 255.0) +
+                lambda2 * (csh.at<cv::Vec3b>(y, x).val[0] / 255.0) +
+                lambda3 * (csd.at<cv::Vec3b>(y, x).val[0] / 255.0);
+            unary[1].at<double>(y, x) = grayscale;
+            maxValue = (maxValue < grayscale) ? grayscale : maxValue;
+            minValue = (minValue > grayscale) ? grayscale : minValue;
+        }
+    }
+
+    const double range = maxValue - minValue;
+    for (int y = 0; y < msc.rows; y++) {
+        for (int x = 0; x < msc.cols; x++) {
+            unary[1].at<double>(y, x) = (unary[1].at<double>(y, x) - minValue) / range;
+            unary[0].at<double>(y, x) = 1 - unary[1].at<double>(y, x);
+        }
+    }
+}
+
+void computeUnary(const cv::Mat &features, double lambda1, double lambda2,
+    double lambda3, vector< cv::Mat > &unary)
+{
+    unary.resize(2);
+    unary[0].create(features.rows, features.cols, CV_64F);
+    unary[1].create(features.rows, features.cols, CV_64F);
+
+    double maxValue = -1e6, minValue = 1e6;
+    const bool bFloat = (features.depth() == CV_32F);
+    for (int y = 0; y < features.rows; y++) {
+        const cv::Vec3b *f = features.ptr<cv::Vec3b>(y);
+        const cv::Vec3f *g = features.ptr<cv::Vec3f>(y);
+        double *u = unary[1].ptr<double>(y);
+        for (int x = 0; x < features.cols; x++) {
+            const double grayscale = bFloat ?
+                lambda1 * g[x].val[0] + lambda2 * g[x].val[1] + lambda3 * g[x].val[2] :
+                lambda1 * (f[x].val[0] / 255.0) + lambda2 * (f[x].val[1] / 255.0) +
+                lambda3 * (f[x].val[2] / 255.0);
+            u[x] = grayscale;
+            maxValue = (maxValue < grayscale) ? grayscale : maxValue;
+            minValue = (minValue > grayscale) ? grayscale : minValue;
+        }
+    }
+
+    const double range = maxValue - minValue;
+    for (int y = 0; y < features.rows; y++) {
+        double *u0 = unary[0].ptr<double>(y);
+        double *u1 = unary[1].ptr<double>(y);
+        for (int x = 0; x < features.cols; x++) {
+            u1[x] = (u1[x] - minValue) / range;
+            u0[x] = 1 - u1[x];
+        }
+    }
+}
+
+cv::Rect salientBoundingBox(const cv::Mat &labels)
+{
+    cv::Mat mask(labels.rows, labels.cols, CV_8UC1);
+    for (int y = 0; y < labels.rows; y++) {
+        for (int x = 0; x < labels.cols; x++) {
+            mask.at<unsigned char>(y, x) = labels.at<short>(y, x) * 255 > 125 ? 255 : 0;
+        }
+    }
+
+    // find the contours, returning only extreme external bounds, find the largest contour area.
+    // FIXME change to getting a bounding box around all white pixels
+    vector<vector<cv::Point> > contours;
+    findContours(mask, contours, CV_RETR_EXTERNAL, CV_CHAIN_APPROX_SIMPLE);
+    if (contours.empty()) {
+        return cv::Rect(0, 0, 0, 0);
+    }
+
+    // find the largest contour area
+    unsigned int area = 0;
+    int idx = 0;
+    for (unsigned int it = 0; it < contours.size(); it++) {
+        if (area < contours[it].size())
+            idx = it;
+    }
+
+    return boundingRect(contours[idx]);
+}
+
+void writeLabelEntry(ofstream &ofs, const string &baseName, int width, int height,
+    const cv::Rect &box)
+{
+    // the \r here is to mimic the windows-style carriage returns that are contained in the truth label files
+    ofs << baseName.substr(0, 1) << "\\" << baseName << ".jpg\r\n";
+    ofs << width << " " << height << "\n";
+    // we're getting the second labels so put bogus padding values as the first set
+    ofs << "0 0 0 0; " << box.x << " " << box.y << " " << box.x + box.width << " "
+        << box.y + box.height << ";\n\n";
+}
+
+bool writeSaliencyModel(const char *filename, const vector<double> &weights)
+{
+    ofstream ofs(filename, ios::out | ios::trunc);
+    if (!ofs.is_open()) return false;
+    ofs << "saliency-model 1 " << weights.size();
+    ofs.precision(17);
+    for (unsigned i = 0; i < weights.size(); i++) {
+        ofs << " " << weights[i];
+    }
+    ofs << "\n";
+    return !ofs.fail();
+}
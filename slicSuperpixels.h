@@ -0,0 +1,184 @@
+/*****************************************************************************
+** DARWIN: A FRAMEWORK FOR MACHINE LEARNING RESEARCH AND DEVELOPMENT
+** Distributed under the terms of the BSD license (see the LICENSE file)
+** Copyright (c) 2007-2013, Stephen Gould
+** All rights reserved.
+**
+******************************************************************************
+** FILENAME:    slicSuperpixels.h
+** AUTHOR(S):
+**              Jimmy Lin <u5223173@anu.edu.au>
+**              Chris Claoue-Long <u5183532@anu.edu.au>
+**
+** SLIC superpixels (Achanta et al., 2012): k-means in Lab colour and image
+** position, seeded on a regular grid and searching only a 2S-by-2S window
+** around each centre, followed by merging of small disconnected fragments.
+**
+*****************************************************************************/
+
+#pragma once
+
+// c++ standard headers
+#include <cstdlib>
+#include <vector>
+#include <limits>
+
+// opencv library headers
+#include "cv.h"
+#include "cxcore.h"
+
+// darwin library headers
+#include "drwnBase.h"
+
+using namespace std;
+
+// prototypes ----------------------------------------------------------------
+
+// Oversegments a BGR image into superpixels of roughly regionSize-by-
+// regionSize pixels. Larger compactness favours square regions over colour
+// boundaries. Writes an H-by-W CV_32S map of region indices to segments and
+// returns the number of regions.
+int slicSuperpixels(const cv::Mat &img, int regionSize, double compactness,
+    cv::Mat &segments, int nIterations = 10);
+
+// implementation ------------------------------------------------------------
+
+int slicSuperpixels(const cv::Mat &img, int regionSize, double compactness,
+    cv::Mat &segments, int nIterations)
+{
+    DRWN_FCN_TIC;
+    DRWN_ASSERT_MSG(regionSize > 0, "invalid superpixel size");
+
+    const int H = img.rows;
+    const int W = img.cols;
+    const int S = regionSize;
+
+    cv::Mat lab;
+    cv::cvtColor(img, lab, CV_BGR2Lab);
+
+    // seed cluster centres (l, a, b, x, y) on a regular grid
+    const int nx = std::max(1, (W + S / 2) / S);
+    const int ny = std::max(1, (H + S / 2) / S);
+    const int K = nx * ny;
+    vector<double> centres(5 * K);
+    for (int j = 0; j < ny; j++) {
+        for (int i = 0; i < nx; i++) {
+            const int x = (int)((i + 0.5) * W / nx);
+            const int y = (int)((j + 0.5) * H / ny);
+            const cv::Vec3b &c = lab.at<cv::Vec3b>(y, x);
+            double *centre = &centres[5 * (j * nx + i)];
+            centre[0] = c[0]; centre[1] = c[1]; centre[2] = c[2];
+            centre[3] = x; centre[4] = y;
+        }
+    }
+
+    // assign pixels to the nearest centre within its window and move each
+    // centre to the mean of its pixels
+    segments.create(H, W, CV_32S);
+    segments.setTo(cv::Scalar(-1));
+    vector<double> dist(H * W);
+    vector<double> sums(6 * K);
+    const double spatialWeight = (compactness * compactness) / (double)(S * S);
+    for (int n = 0; n < nIterations; n++) {
+        std::fill(dist.begin(), dist.end(), numeric_limits<double>::max());
+        for (int k = 0; k < K; k++) {
+            const double *centre = &centres[5 * k];
+            const int x0 = std::max(0, (int)centre[3] - S);
+            const int x1 = std::min(W, (int)centre[3] + S + 1);
+            const int y0 = std::max(0, (int)centre[4] - S);
+            const int y1 = std::min(H, (int)centre[4] + S + 1);
+            for (int y = y0; y < y1; y++) {
+                const cv::Vec3b *p = lab.ptr<cv::Vec3b>(y);
+                int *s = segments.ptr<int>(y);
+                for (int x = x0; x < x1; x++) {
+                    const double dl = p[x][0] - centre[0];
+                    const double da = p[x][1] - centre[1];
+                    const double db = p[x][2] - centre[2];
+                    const double dx = x - centre[3];
+                    const double dy = y - centre[4];
+                    const double d = dl * dl + da * da + db * db +
+                        spatialWeight * (dx * dx + dy * dy);
+                    if (d < dist[y * W + x]) {
+                        dist[y * W + x] = d;
+                        s[x] = k;
+                    }
+                }
+            }
+        }
+
+        std::fill(sums.begin(), sums.end(), 0.0);
+        for (int y = 0; y < H; y++) {
+            const cv::Vec3b *p = lab.ptr<cv::Vec3b>(y);
+            const int *s = segments.ptr<int>(y);
+            for (int x = 0; x < W; x++) {
+                double *sum = &sums[6 * s[x]];
+                sum[0] += p[x][0]; sum[1] += p[x][1]; sum[2] += p[x][2];
+                sum[3] += x; sum[4] += y; sum[5] += 1.0;
+            }
+        }
+        for (int k = 0; k < K; k++) {
+            if (sums[6 * k + 5] == 0.0) continue;
+            for (int c = 0; c < 5; c++) {
+                centres[5 * k + c] = sums[6 * k + c] / sums[6 * k + 5];
+            }
+        }
+    }
+
+    // enforce connectivity: relabel 4-connected components in scan order
+    // and merge those much smaller than a superpixel into the previously
+    // labelled neighbour
+    const int minSize = std::max(1, S * S / 4);
+    cv::Mat relabelled(H, W, CV_32S, cv::Scalar(-1));
+    vector<int> component;
+    component.reserve(H * W);
+    const int dx4[4] = {-1, 1, 0, 0};
+    const int dy4[4] = {0, 0, -1, 1};
+    int nRegions = 0;
+    for (int y = 0; y < H; y++) {
+        for (int x = 0; x < W; x++) {
+            if (relabelled.at<int>(y, x) >= 0) continue;
+
+            // label of an adjacent component found earlier
+            int adjacent = -1;
+            for (int d = 0; d < 4; d++) {
+                const int xx = x + dx4[d];
+                const int yy = y + dy4[d];
+                if ((xx >= 0) && (yy >= 0) && (xx < W) && (yy < H) &&
+                    (relabelled.at<int>(yy, xx) >= 0)) {
+                    adjacent = relabelled.at<int>(yy, xx);
+                }
+            }
+
+            // flood fill the component
+            const int k = segments.at<int>(y, x);
+            component.clear();
+            component.push_back(y * W + x);
+            relabelled.at<int>(y, x) = nRegions;
+            for (size_t i = 0; i < component.size(); i++) {
+                const int cx = component[i] % W;
+                const int cy = component[i] / W;
+                for (int d = 0; d < 4; d++) {
+                    const int xx = cx + dx4[d];
+                    const int yy = cy + dy4[d];
+                    if ((xx >= 0) && (yy >= 0) && (xx < W) && (yy < H) &&
+                        (relabelled.at<int>(yy, xx) < 0) && (segments.at<int>(yy, xx) == k)) {
+                        relabelled.at<int>(yy, xx) = nRegions;
+                        component.push_back(yy * W + xx);
+                    }
+                }
+            }
+
+            if (((int)component.size() < minSize) && (adjacent >= 0)) {
+                for (size_t i = 0; i < component.size(); i++) {
+                    relabelled.at<int>(component[i] / W, component[i] % W) = adjacent;
+                }
+            } else {
+                nRegions += 1;
+            }
+        }
+    }
+    segments = relabelled;
+
+    DRWN_FCN_TOC;
+    return nRegions;
+}
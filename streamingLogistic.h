@@ -0,0 +1,360 @@
+/*****************************************************************************
+** DARWIN: A FRAMEWORK FOR MACHINE LEARNING RESEARCH AND DEVELOPMENT
+** Distributed under the terms of the BSD license (see the LICENSE file)
+** Copyright (c) 2007-2013, Stephen Gould
+** All rights reserved.
+**
+******************************************************************************
+** FILENAME:    streamingLogistic.h
+** AUTHOR(S):
+**              Jimmy Lin <u5223173@anu.edu.au>
+**              Chris Claoue-Long <u5183532@anu.edu.au>
+**
+** Global pixel saliency model trained by streaming. The per-pixel features
+** of a whole dataset are written once to a flat binary feature store on
+** disk, and a single logistic regression model is then fitted by mini-batch
+** SGD over several epochs, reading the store through a fixed size buffer.
+** Memory use depends on the buffer size only, not on the number of images.
+**
+*****************************************************************************/
+
+#pragma once
+
+// c++ standard headers
+#include <cstdlib>
+#include <cstdio>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <stdint.h>
+#include <sys/types.h>
+
+// darwin library headers
+#include "drwnBase.h"
+
+using namespace std;
+
+// FeatureStore ---------------------------------------------------------------
+// A header (magic number, image count, record count and a hash of the image
+// list) followed by one record per pixel: the first channel of the MSC, CSH
+// and CSD maps and the ground truth label. The writer fills a temporary file
+// and only renames it into place once it is complete, so a run that dies
+// part way does not leave a store that looks valid.
+
+struct FeatureRecord {
+    unsigned char msc;
+    unsigned char csh;
+    unsigned char csd;
+    unsigned char label;
+};
+
+static const char FEATURE_STORE_MAGIC[4] = {'S', 'F', 'S', '2'};
+static const int FEATURE_STORE_HEADER_BYTES = 4 + 4 + 8 + 8;
+
+// Hash of the image base names and their ground truth rectangles, in order,
+// identifying the dataset a feature store was written from.
+unsigned long long featureStoreListHash(const vector<string> &baseNames,
+    const map<string, vector<int> > &labels);
+
+class FeatureStoreWriter {
+ protected:
+    FILE *_file;
+    string _filename;           // final name of the store
+    unsigned _nImages;
+    unsigned long long _listHash;
+    unsigned long long _count;
+
+ public:
+    FeatureStoreWriter() : _file(NULL), _nImages(0), _listHash(0), _count(0) { }
+    // a store that was not closed is discarded
+    ~FeatureStoreWriter() { discard(); }
+
+    bool open(const char *filename, unsigned nImages, unsigned long long listHash);
+    void append(const FeatureRecord *records, size_t n);
+    // writes the record count and renames the store into place, returning
+    // false on failure
+    bool close();
+    void discard();
+
+    unsigned long long size() const { return _count; }
+
+ protected:
+    string temporaryName() const { return _filename + ".tmp"; }
+    bool writeHeader();
+};
+
+class FeatureStoreReader {
+ protected:
+    FILE *_file;
+    unsigned _nImages;
+    unsigned long long _listHash;
+    unsigned long long _count;
+
+ public:
+    FeatureStoreReader() : _file(NULL), _nImages(0), _listHash(0), _count(0) { }
+    ~FeatureStoreReader() { close(); }
+
+    bool open(const char *filename);
+    void close();
+
+    unsigned long long size() const { return _count; }
+    // the image count and list hash the store was written with
+    unsigned images() const { return _nImages; }
+    unsigned long long listHash() const { return _listHash; }
+    // reads up to n records starting at record first and returns the
+    // number read
+    size_t read(unsigned long long first, FeatureRecord *records, size_t n);
+};
+
+// StreamingLogisticTrainer ---------------------------------------------------
+
+struct StreamingLogisticParameters {
+    int epochs;                 // passes over the feature store
+    int batchSize;              // records per gradient step
+    size_t bufferRecords;       // records held in memory at once
+    size_t chunkRecords;        // records read from disk at once
+    double learningRate;        // AdaGrad step size
+    double l2;                  // weight decay
+    unsigned seed;              // seed of the chunk and record shuffles
+
+    StreamingLogisticParameters() : epochs(5), batchSize(256),
+        bufferRecords(4 << 20), chunkRecords(64 << 10), learningRate(0.5),
+        l2(1.0e-6), seed(0) { }
+};
+
+// Fits p(background | x) = 1 / (1 + exp(-w^T x)) for x = (msc, csh, csd, 1)
+// with features scaled to [0, 1], so that w follows the convention of the
+// batch trainers (see writeSaliencyModel in saliencyUtils.h). Every epoch visits the store in chunks
+// taken in random order; the chunks filling the buffer are shuffled
+// together before being cut into mini-batches, so that batches mix pixels
+// of several images.
+class StreamingLogisticTrainer {
+ public:
+    static const int DIMENSION = 4;
+
+ protected:
+    StreamingLogisticParameters _params;
+    vector<double> _weights;
+    double _loss;               // mean log loss over the last epoch
+
+    // deterministic generator for std::random_shuffle
+    struct Random {
+        unsigned state;
+        explicit Random(unsigned seed) : state(seed) { }
+        ptrdiff_t operator()(ptrdiff_t n) {
+            state = state * 1103515245u + 12345u;
+            return (ptrdiff_t)((state >> 8) % (unsigned)n);
+        }
+    };
+
+ public:
+    StreamingLogisticTrainer(const StreamingLogisticParameters &params = StreamingLogisticParameters()) :
+        _params(params), _weights(DIMENSION, 0.0), _loss(0.0) { }
+
+    // trains from zero weights and returns them
+    const vector<double> &train(FeatureStoreReader &store);
+
+    const vector<double> &weights() const { return _weights; }
+    double loss() const { return _loss; }
+};
+
+// FeatureStore implementation ------------------------------------------------
+
+unsigned long long featureStoreListHash(const vector<string> &baseNames,
+    const map<string, vector<int> > &labels)
+{
+    // 64-bit FNV-1a over the names and the bytes of their rectangles
+    unsigned long long h = 14695981039346656037ull;
+    for (unsigned i = 0; i < baseNames.size(); i++) {
+        const string &name = baseNames[i];
+        for (unsigned k = 0; k <= name.size(); k++) {
+            h = (h ^ (unsigned char)name.c_str()[k]) * 1099511628211ull;
+        }
+        map<string, vector<int> >::const_iterator it = labels.find(name + ".jpg");
+        if (it == labels.end()) continue;
+        for (unsigned k = 0; k < it->second.size(); k++) {
+            const unsigned v = (unsigned)it->second[k];
+            for (int b = 0; b < 32; b += 8) {
+                h = (h ^ ((v >> b) & 0xff)) * 1099511628211ull;
+            }
+        }
+    }
+    return h;
+}
+
+bool FeatureStoreWriter::open(const char *filename, unsigned nImages, unsigned long long listHash)
+{
+    discard();
+    _filename = string(filename);
+    _file = fopen(temporaryName().c_str(), "wb");
+    if (_file == NULL) return false;
+
+    // the count is filled in by close()
+    _nImages = nImages;
+    _listHash = listHash;
+    _count = 0;
+    if (!writeHeader()) {
+        discard();
+        return false;
+    }
+    return true;
+}
+
+bool FeatureStoreWriter::writeHeader()
+{
+    const uint32_t nImages = _nImages;
+    return (fwrite(FEATURE_STORE_MAGIC, sizeof(char), 4, _file) == 4) &&
+        (fwrite(&nImages, sizeof(uint32_t), 1, _file) == 1) &&
+        (fwrite(&_count, sizeof(unsigned long long), 1, _file) == 1) &&
+        (fwrite(&_listHash, sizeof(unsigned long long), 1, _file) == 1);
+}
+
+void FeatureStoreWriter::append(const FeatureRecord *records, size_t n)
+{
+    DRWN_ASSERT(_file != NULL);
+    if (fwrite(records, sizeof(FeatureRecord), n, _file) != n) {
+        DRWN_LOG_FATAL("failed to write to feature store");
+    }
+    _count += n;
+}
+
+bool FeatureStoreWriter::close()
+{
+    if (_file == NULL) return false;
+    bool bWritten = (fseeko(_file, 0, SEEK_SET) == 0) && writeHeader();
+    bWritten = (fclose(_file) == 0) && bWritten;
+    _file = NULL;
+    if (!bWritten || (rename(temporaryName().c_str(), _filename.c_str()) != 0)) {
+        remove(temporaryName().c_str());
+        return false;
+    }
+    return true;
+}
+
+void FeatureStoreWriter::discard()
+{
+    if (_file == NULL) return;
+    fclose(_file);
+    _file = NULL;
+    remove(temporaryName().c_str());
+}
+
+bool FeatureStoreReader::open(const char *filename)
+{
+    close();
+    _file = fopen(filename, "rb");
+    if (_file == NULL) return false;
+
+    char magic[4];
+    uint32_t nImages;
+    if ((fread(magic, sizeof(char), 4, _file) != 4) ||
+        !std::equal(magic, magic + 4, FEATURE_STORE_MAGIC) ||
+        (fread(&nImages, sizeof(uint32_t), 1, _file) != 1) ||
+        (fread(&_count, sizeof(unsigned long long), 1, _file) != 1) ||
+        (fread(&_listHash, sizeof(unsigned long long), 1, _file) != 1)) {
+        DRWN_LOG_WARNING(filename << " is not a feature store of this version");
+        close();
+        return false;
+    }
+    _nImages = nImages;
+    return true;
+}
+
+void FeatureStoreReader::close()
+{
+    if (_file != NULL) {
+        fclose(_file);
+        _file = NULL;
+    }
+    _nImages = 0;
+    _listHash = 0;
+    _count = 0;
+}
+
+size_t FeatureStoreReader::read(unsigned long long first, FeatureRecord *records, size_t n)
+{
+    DRWN_ASSERT(_file != NULL);
+    if (first >= _count) return 0;
+    n = (size_t)std::min((unsigned long long)n, _count - first);
+    if (fseeko(_file, (off_t)(FEATURE_STORE_HEADER_BYTES + first * sizeof(FeatureRecord)), SEEK_SET) != 0) return 0;
+    return fread(records, sizeof(FeatureRecord), n, _file);
+}
+
+// StreamingLogisticTrainer implementation ------------------------------------
+
+const vector<double> &StreamingLogisticTrainer::train(FeatureStoreReader &store)
+{
+    DRWN_FCN_TIC;
+    DRWN_ASSERT_MSG((_params.batchSize > 0) && (_params.chunkRecords > 0) &&
+        (_params.bufferRecords >= _params.chunkRecords), "invalid streaming parameters");
+
+    // feature values of each byte
+    double scale[256];
+    for (int i = 0; i < 256; i++) {
+        scale[i] = i / 255.0;
+    }
+
+    const unsigned long long nRecords = store.size();
+    const size_t nChunks = (size_t)((nRecords + _params.chunkRecords - 1) / _params.chunkRecords);
+    const size_t chunksPerBuffer = _params.bufferRecords / _params.chunkRecords;
+    vector<FeatureRecord> buffer(chunksPerBuffer * _params.chunkRecords);
+    vector<size_t> chunkOrder(nChunks);
+    for (size_t i = 0; i < nChunks; i++) {
+        chunkOrder[i] = i;
+    }
+
+    Random random(_params.seed);
+    _weights.assign(DIMENSION, 0.0);
+    vector<double> sumSquares(DIMENSION, 0.0);
+    vector<double> gradient(DIMENSION);
+    for (int epoch = 0; epoch < _params.epochs; epoch++) {
+        std::random_shuffle(chunkOrder.begin(), chunkOrder.end(), random);
+        double epochLoss = 0.0;
+        for (size_t c = 0; c < nChunks; c += chunksPerBuffer) {
+            // fill the buffer with the next chunks and mix them
+            size_t nBuffered = 0;
+            for (size_t k = c; (k < nChunks) && (k < c + chunksPerBuffer); k++) {
+                nBuffered += store.read((unsigned long long)chunkOrder[k] * _params.chunkRecords,
+                    &buffer[nBuffered], _params.chunkRecords);
+            }
+            std::random_shuffle(buffer.begin(), buffer.begin() + nBuffered, random);
+
+            // AdaGrad steps on the mini-batches
+            for (size_t b = 0; b < nBuffered; b += _params.batchSize) {
+                const size_t e = std::min(nBuffered, b + _params.batchSize);
+                std::fill(gradient.begin(), gradient.end(), 0.0);
+                for (size_t i = b; i < e; i++) {
+                    const FeatureRecord &r = buffer[i];
+                    const double x0 = scale[r.msc];
+                    const double x1 = scale[r.csh];
+                    const double x2 = scale[r.csd];
+                    const double z = _weights[0] * x0 + _weights[1] * x1 + _weights[2] * x2 + _weights[3];
+                    const double p = 1.0 / (1.0 + exp(-z));
+                    const double residual = p - (r.label ? 0.0 : 1.0);
+                    gradient[0] += residual * x0;
+                    gradient[1] += residual * x1;
+                    gradient[2] += residual * x2;
+                    gradient[3] += residual;
+                    // log(1 + exp(-z)) or log(1 + exp(z)), computed stably
+                    const double m = r.label ? z : -z;
+                    epochLoss += (m > 0.0) ? m + log1p(exp(-m)) : log1p(exp(m));
+                }
+                const double n = (double)(e - b);
+                for (int d = 0; d < DIMENSION; d++) {
+                    const double g = gradient[d] / n + ((d < DIMENSION - 1) ? _params.l2 * _weights[d] : 0.0);
+                    sumSquares[d] += g * g;
+                    _weights[d] -= _params.learningRate * g / (sqrt(sumSquares[d]) + 1.0e-12);
+                }
+            }
+        }
+
+        _loss = (nRecords > 0) ? epochLoss / nRecords : 0.0;
+        DRWN_LOG_VERBOSE("...epoch " << epoch << " has mean log loss " << _loss << ", weights "
+            << _weights[0] << ", " << _weights[1] << ", " << _weights[2] << ", " << _weights[3]);
+    }
+
+    DRWN_FCN_TOC;
+    return _weights;
+}
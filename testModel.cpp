@@ -34,6 +34,11 @@
 #include "drwnVision.h"
 
 #include "mexImageCRF.h"
+#include "saliencyUtils.h"
+#include "modelBundle.h"
+#include "featureMapStore.h"
+#include "datasetPack.h"
+#include "prefetchPipeline.h"
 
 using namespace std;
 using namespace Eigen;
@@ -44,8 +49,26 @@ void usage()
 {
     cerr << DRWN_USAGE_HEADER << endl;
     cerr << "USAGE: ./testModel [OPTIONS] <imgDir> <mscDir> <cshDir> <csdDir> <outputDir> <outputLbls> <lambda>\n";
+    cerr << "       ./testModel [OPTIONS] -model <bundle> <imgDir> <mscDir> <cshDir> <csdDir> <outputDir> <outputLbls>\n";
+    cerr << "       (with -pack <pack>, without <imgDir> <mscDir> <cshDir> <csdDir>)\n";
     cerr << "OPTIONS:\n"
          << "  -o <lblDir>       :: output directory for predicted labels\n"
+         << "  -model <bundle>   :: take the weights and CRF parameters from a trainModel bundle\n"
+         << "  -fmap <dir>       :: read <dir>/<image>.fmap instead of the JPEG feature maps\n"
+         << "  -pack <pack>      :: read the images and feature maps from a packDataset pack\n"
+         << "  -crf <backend>    :: CRF inference backend: graphcut (default), grid, quantized,\n"
+         << "                       dense, expansion, verify or parallel (experimental)\n"
+         << "  -sweep <n>        :: also label for lambda * k / n, k = 1..n, in one parametric pass\n"
+         << "  -coarse <f>       :: coarse-to-fine inference from images downsampled by f\n"
+         << "  -band <w>         :: width of the refined band for -coarse (default: 4)\n"
+         << "  -resolution <r>   :: capacity units per unit energy for -crf quantized (default: 1000)\n"
+         << "  -connectivity <n> :: 4- or 8-connected (default) pairwise terms\n"
+         << "  -superpixels <s>  :: inference on SLIC superpixels of about s-by-s pixels\n"
+         << "                       (-sweep, -coarse and -superpixels replace -crf; give one at most)\n"
+         << "  -iterations <n>   :: mean-field iterations for -crf dense (default: 5)\n"
+         << "  -telemetry <file> :: write per-image CRF metrics to file as JSON lines\n"
+         << "  -prefetch <n>     :: images loaded ahead of inference, 0 to load inline (default: 4)\n"
+         << "  -decoders <n>     :: threads loading them (default: 1)\n"
          << "  -x                :: visualize\n"
          << DRWN_STANDARD_OPTIONS_USAGE
 	 << endl;
@@ -57,15 +80,45 @@ int main (int argc, char * argv[]) {
 
     // Set default value for optional command line arguments.
     const char *modelFile = NULL;
+    const char *bundleFile = NULL;
+    const char *fmapDir = NULL;
+    const char *packFile = NULL;
+    const char *crfBackendName = NULL;
+    int sweepSteps = 0;
+    int coarseFactor = 1;
+    int bandWidth = 4;
+    int superpixelSize = 0;
+    int connectivity = 0;
+    double resolution = 0.0;
+    int denseIterations = 0;
+    const char *telemetryFile = NULL;
+    int prefetchDepth = 4;
+    int nDecoders = 1;
     bool bVisualize = false;
 
     DRWN_BEGIN_CMDLINE_PROCESSING(argc, argv)
         DRWN_CMDLINE_STR_OPTION("-o", modelFile)
+        DRWN_CMDLINE_STR_OPTION("-model", bundleFile)
+        DRWN_CMDLINE_STR_OPTION("-fmap", fmapDir)
+        DRWN_CMDLINE_STR_OPTION("-pack", packFile)
+        DRWN_CMDLINE_STR_OPTION("-crf", crfBackendName)
+        DRWN_CMDLINE_INT_OPTION("-sweep", sweepSteps)
+        DRWN_CMDLINE_INT_OPTION("-coarse", coarseFactor)
+        DRWN_CMDLINE_INT_OPTION("-band", bandWidth)
+        DRWN_CMDLINE_INT_OPTION("-superpixels", superpixelSize)
+        DRWN_CMDLINE_INT_OPTION("-connectivity", connectivity)
+        DRWN_CMDLINE_REAL_OPTION("-resolution", resolution)
+        DRWN_CMDLINE_INT_OPTION("-iterations", denseIterations)
+        DRWN_CMDLINE_STR_OPTION("-telemetry", telemetryFile)
+        DRWN_CMDLINE_INT_OPTION("-prefetch", prefetchDepth)
+        DRWN_CMDLINE_INT_OPTION("-decoders", nDecoders)
         DRWN_CMDLINE_BOOL_OPTION("-x", bVisualize)
     DRWN_END_CMDLINE_PROCESSING(usage());
+    const bool bBackendOption = (crfBackendName != NULL);
 
     // Check for the correct number of required arguments
-    if (DRWN_CMDLINE_ARGC != 10) {
+    const int nInputs = (packFile != NULL) ? 0 : 4;
+    if (DRWN_CMDLINE_ARGC != nInputs + ((bundleFile != NULL) ? 2 : 6)) {
         usage();
         return -1;
     }
@@ -76,29 +129,101 @@ int main (int argc, char * argv[]) {
     // with the same base as the image directory, but with extension
     // ".txt". 
      
-    const char *imgDir = DRWN_CMDLINE_ARGV[0]; // directory restores original images
-    const char *mscDir = DRWN_CMDLINE_ARGV[1]; // directory restores multiscale contrast feature map
-    const char *cshDir = DRWN_CMDLINE_ARGV[2]; // directory restores center surround histogram feature map
-    const char *csdDir = DRWN_CMDLINE_ARGV[3]; // directory restores color spatial distribution feature map
-    const char *outputDir = DRWN_CMDLINE_ARGV[4]; // directory for resulting images
-    const char *outLbls = DRWN_CMDLINE_ARGV[5]; // output labels file
-    const double lambda1 = atof(DRWN_CMDLINE_ARGV[6]); // lambda for local feature
-    const double lambda2 = atof(DRWN_CMDLINE_ARGV[7]); // lambda for regional feature 
-    const double lambda3 = atof(DRWN_CMDLINE_ARGV[8]); // lambda for global feature
-    const double lambda0 = atof(DRWN_CMDLINE_ARGV[9]); // lambda for pairwise term
+    const char *imgDir = (nInputs > 0) ? DRWN_CMDLINE_ARGV[0] : NULL; // directory restores original images
+    const char *mscDir = (nInputs > 0) ? DRWN_CMDLINE_ARGV[1] : NULL; // directory restores multiscale contrast feature map
+    const char *cshDir = (nInputs > 0) ? DRWN_CMDLINE_ARGV[2] : NULL; // directory restores center surround histogram feature map
+    const char *csdDir = (nInputs > 0) ? DRWN_CMDLINE_ARGV[3] : NULL; // directory restores color spatial distribution feature map
+    const char *outputDir = DRWN_CMDLINE_ARGV[nInputs]; // directory for resulting images
+    const char *outLbls = DRWN_CMDLINE_ARGV[nInputs + 1]; // output labels file
+    double lambda1 = 0.0; // lambda for local feature
+    double lambda2 = 0.0; // lambda for regional feature 
+    double lambda3 = 0.0; // lambda for global feature
+    double lambda0 = 0.0; // lambda for pairwise term
+    DenseCRFParameters denseParams;
+
+    if (bundleFile != NULL) {
+        // the weights, and any CRF parameters not given on the command line,
+        // come from the bundle
+        const double loadStartTime = crfWallTime();
+        ModelBundle bundle;
+        DRWN_ASSERT_MSG(bundle.open(bundleFile), "could not read model bundle " << bundleFile);
+        const vector<double> weights = bundle.weights();
+        const ModelCRFConfig *crfConfig = bundle.crf();
+        DRWN_ASSERT_MSG((weights.size() >= 3) && (crfConfig != NULL),
+            "model bundle " << bundleFile << " has no weights or CRF parameters");
+        lambda1 = weights[0];
+        lambda2 = weights[1];
+        lambda3 = weights[2];
+        lambda0 = crfConfig->lambda0;
+        if (crfBackendName == NULL) crfBackendName = ::crfBackendName((CRFBackend)crfConfig->backend);
+        if (connectivity == 0) connectivity = crfConfig->connectivity;
+        if (resolution == 0.0) resolution = crfConfig->resolution;
+        if (denseIterations == 0) denseIterations = crfConfig->denseIterations;
+        denseParams.bilateralXY = crfConfig->bilateralXY;
+        denseParams.bilateralRGB = crfConfig->bilateralRGB;
+        denseParams.gaussianXY = crfConfig->gaussianXY;
+        denseParams.gaussianWeight = crfConfig->gaussianWeight;
+
+        const ModelFeatureConfig *features = bundle.features();
+        const ModelFeatureConfig expected = modelFeatureConfig();
+        if ((features == NULL) || (memcmp(features, &expected, sizeof(ModelFeatureConfig)) != 0)) {
+            DRWN_LOG_WARNING("model bundle " << bundleFile << " was trained on feature maps "
+                "computed with other parameters");
+        }
+        DRWN_LOG_MESSAGE("Loaded model bundle " << bundleFile << " in "
+            << 1000.0 * (crfWallTime() - loadStartTime) << "ms");
+    } else {
+        lambda1 = atof(DRWN_CMDLINE_ARGV[nInputs + 2]);
+        lambda2 = atof(DRWN_CMDLINE_ARGV[nInputs + 3]);
+        lambda3 = atof(DRWN_CMDLINE_ARGV[nInputs + 4]);
+        lambda0 = atof(DRWN_CMDLINE_ARGV[nInputs + 5]);
+    }
+    if (crfBackendName == NULL) crfBackendName = "graphcut";
+    if (connectivity == 0) connectivity = 8;
+    if (resolution == 0.0) resolution = 1000.0;
+    if (denseIterations > 0) denseParams.nIterations = denseIterations;
+
+    const CRFBackend crfBackend = parseCRFBackend(crfBackendName);
+    const CRFNeighbourhood neighbourhood = parseCRFNeighbourhood(connectivity);
+
+    // -sweep, -coarse and -superpixels each replace the -crf backend by
+    // their own two-label inference, so at most one of them may be given
+    const int nModes = ((sweepSteps > 0) ? 1 : 0) + ((coarseFactor > 1) ? 1 : 0) +
+        ((superpixelSize > 0) ? 1 : 0);
+    DRWN_ASSERT_MSG(nModes <= 1, "-sweep, -coarse and -superpixels cannot be combined");
+    DRWN_ASSERT_MSG((nModes == 0) || !bBackendOption,
+        "-crf cannot be combined with -sweep, -coarse or -superpixels");
+    const char *crfMode = (sweepSteps > 0) ? "sweep" : (coarseFactor > 1) ? "banded" :
+        (superpixelSize > 0) ? "superpixels" : crfBackendName;
+    if ((nModes > 0) && (bundleFile != NULL)) {
+        DRWN_LOG_MESSAGE("Using " << crfMode << " inference instead of the "
+            << crfBackendName << " backend of the model bundle");
+    }
     
     // Check for existence of the directory containing orginal images
-    DRWN_ASSERT_MSG(drwnDirExists(imgDir), "image directory " << imgDir << " does not exist");
-    DRWN_ASSERT_MSG(drwnDirExists(mscDir), "Multiscale Contrast directory " << mscDir << " does not exist");
-    DRWN_ASSERT_MSG(drwnDirExists(cshDir), "Centre-Surround Histogram directory " << cshDir << " does not exist");
-    DRWN_ASSERT_MSG(drwnDirExists(csdDir), "Colour Spatial Distribution directory " << csdDir << " does not exist");
+    DatasetPack pack;
+    if (packFile != NULL) {
+        DRWN_ASSERT_MSG(pack.open(packFile), "could not read dataset pack " << packFile);
+        for (unsigned i = 0; i < pack.size(); i++) {
+            DRWN_ASSERT_MSG(pack.hasFeatures(i), "dataset pack " << packFile << " has no feature maps for "
+                << pack.name(i) << " (build it with packDataset -fmap or -msc/-csh/-csd)");
+        }
+    } else {
+        DRWN_ASSERT_MSG(drwnDirExists(imgDir), "image directory " << imgDir << " does not exist");
+        if (fmapDir != NULL) {
+            DRWN_ASSERT_MSG(drwnDirExists(fmapDir), "feature map directory " << fmapDir << " does not exist");
+        } else {
+            DRWN_ASSERT_MSG(drwnDirExists(mscDir), "Multiscale Contrast directory " << mscDir << " does not exist");
+            DRWN_ASSERT_MSG(drwnDirExists(cshDir), "Centre-Surround Histogram directory " << cshDir << " does not exist");
+            DRWN_ASSERT_MSG(drwnDirExists(csdDir), "Colour Spatial Distribution directory " << csdDir << " does not exist");
+        }
+    }
     DRWN_ASSERT_MSG(drwnDirExists(outputDir), "Output directory " << outputDir << " does not exist");
 
     // Get a list of images from the image directory.
-    vector<string> baseNames = drwnDirectoryListing(imgDir, ".jpg", false, false);
+    vector<string> baseNames = pack.isOpen() ? pack.baseNames() :
+        drwnDirectoryListing(imgDir, ".jpg", false, false);
     DRWN_LOG_MESSAGE("Loading " << baseNames.size() << " images and labels...");
-    string dir = string(imgDir);
-    //int dirIndex = dir.find_last_of(DRWN_DIRSEP)-1; // get the last occurrence
     ofstream outputLbls;
     outputLbls.open(outLbls, ios::out | ios::trunc);
     if (!outputLbls.is_open()){
@@ -107,30 +232,68 @@ int main (int argc, char * argv[]) {
     }
     outputLbls << baseNames.size() << "\n\n"; // number of labels there will be in this file
 
+    // with -sweep, also write a label file for each pairwise weight
+    // lambda0 * k / sweepSteps, k = 1, ..., sweepSteps
+    vector<double> sweepLambdas;
+    vector<ofstream *> sweepLbls;
+    for (int k = 1; k <= sweepSteps; k++) {
+        sweepLambdas.push_back(lambda0 * k / sweepSteps);
+        const string filename = string(outLbls) + ".lambda" + toString(sweepLambdas.back());
+        sweepLbls.push_back(new ofstream(filename.c_str(), ios::out | ios::trunc));
+        if (!sweepLbls.back()->is_open()) {
+            cerr << "ERROR CREATING OUTPUT LABEL FILE " << filename;
+            return -1;
+        }
+        *sweepLbls.back() << baseNames.size() << "\n\n";
+    }
+    vector<cv::Mat> sweepLabels;
+    vector<double> breakpoints;
+    size_t sweepBreakpoints = 0;
+
     //often-used variables of the loop are here to save on memory!
     cv::Mat img;
-    cv::Mat msc;
-    cv::Mat csh;
-    cv::Mat csd;
+    cv::Mat features;           // packed MSC, CSH and CSD maps
     cv::Mat binaryMask;
     cv::Mat bounding;
-    vector<vector<cv::Point> > contours;
-    unsigned int area;
-    int idx;
     cv::Rect box;
     cv::Point pt1, pt2;
     int tempSaliency;
     vector< cv::Mat > unary(2);
-    double grayscale;
+    CRFContext crf;
+    crf.setNeighbourhood(neighbourhood);
+    crf.setResolution(resolution);
+    crf.setDenseParameters(denseParams);
+    ofstream telemetry;
+    if (telemetryFile != NULL) {
+        telemetry.open(telemetryFile, ios::out | ios::trunc);
+        if (!telemetry.is_open()) {
+            cerr << "ERROR CREATING TELEMETRY FILE " << telemetryFile;
+            return -1;
+        }
+        crf.setTelemetry(&telemetry);
+    }
+    double crfTotalTime = 0.0;
     
+    // images and feature maps are decoded ahead while the CRF runs
+    DatasetImageLoader loader;
+    loader.baseNames = &baseNames;
+    loader.pack = pack.isOpen() ? &pack : NULL;
+    loader.imgDir = imgDir;
+    loader.fmapDir = fmapDir;
+    loader.mscDir = mscDir;
+    loader.cshDir = cshDir;
+    loader.csdDir = csdDir;
+    DRWN_ASSERT_MSG((prefetchDepth >= 0) && (nDecoders >= 1), "invalid -prefetch or -decoders");
+    PrefetchPipeline prefetch(loader, baseNames.size(), prefetchDepth, nDecoders);
+    PrefetchItem item;
+
     for (unsigned i = 0; i < baseNames.size(); i++) {
-        String processedImage = baseNames[i] + ".jpg";
         DRWN_LOG_STATUS("...processing image " << baseNames[i]);
+        crf.setTelemetryTag(baseNames[i]);
         // read the image and draw the rectangle of labels of training data
-        img = cv::imread(string(imgDir) + DRWN_DIRSEP + processedImage);
-        msc = cv::imread(string(mscDir) + DRWN_DIRSEP + processedImage);
-        csh = cv::imread(string(cshDir) + DRWN_DIRSEP + processedImage);
-        csd = cv::imread(string(csdDir) + DRWN_DIRSEP + processedImage);
+        prefetch.next(item);
+        img = item.img;
+        features = item.features;
         
         if (bVisualize) {
             //drwnDrawRegionBoundaries and drwnShowDebuggingImage use OpenCV 1.0 C API
@@ -140,32 +303,25 @@ int main (int argc, char * argv[]) {
             cvReleaseImage(&canvas);
         }
         
-        cv::Mat tempMat(img.rows, img.cols, CV_64F);
-        double maxValue = -1e6, minValue = 1e6;
-        for (int y = 0; y < img.rows; y ++) {
-            for (int x = 0 ; x < img.cols; x ++) {
-                grayscale = lambda1 * (msc.at<Vec3b>(y,x).val[0] / 255.0) +  
-                    lambda2 * (csh.at<Vec3b>(y,x).val[0] / 255.0 )  + 
-                       lambda3 * (csd.at<Vec3b>(y,x).val[0] / 255.0 );
-                tempMat.at<double>(y,x) = grayscale;
-                maxValue = (maxValue < grayscale)?grayscale:maxValue;
-                minValue = (minValue > grayscale)?grayscale:minValue;
-            }
-        }
-
-        double range = maxValue - minValue;
-        // get unary potential and combine them by pre-computed parameters 
-        unary[0] = cv::Mat(img.rows, img.cols, CV_64F);
-        unary[1] = cv::Mat(img.rows, img.cols, CV_64F);
-        for (int y = 0; y < img.rows; y ++) {
-            for (int x = 0 ; x < img.cols; x ++) {
-                unary[1].at<double>(y,x) = (tempMat.at<double>(y,x) - minValue) / range;
-                unary[0].at<double>(y,x) = 1 - unary[1].at<double>(y,x);
-            }
-        }
+        // get unary potential and combine them by pre-computed parameters
+        computeUnary(features, lambda1, lambda2, lambda3, unary);
 
         // compute binary mask of each pixel
-        binaryMask = mexFunction(img, unary, lambda0);
+        const double crfStartTime = crfWallTime();
+        if (sweepSteps > 0) {
+            crf.inferSweep(img, unary, sweepLambdas, sweepLabels, breakpoints);
+            binaryMask = sweepLabels.back();
+            sweepBreakpoints += breakpoints.size();
+        } else if (coarseFactor > 1) {
+            binaryMask = crf.inferBanded(img, unary, lambda0, coarseFactor, bandWidth);
+        } else if (superpixelSize > 0) {
+            binaryMask = crf.inferSuperpixels(img, unary, lambda0, superpixelSize);
+        } else {
+            binaryMask = crf.infer(img, unary, lambda0, crfBackend);
+        }
+        const double crfTime = crfWallTime() - crfStartTime;
+        crfTotalTime += crfTime;
+        DRWN_LOG_VERBOSE("...CRF inference took " << 1000.0 * crfTime << "ms");
 
         // interpret the binary mask as a two-color image
         cv::Mat pres(img.rows, img.cols, CV_8UC3);
@@ -188,20 +344,8 @@ int main (int argc, char * argv[]) {
         }
         
         
-        // convert pres to a suitable image for working on finding the bounding box using OpenCV functions
-        cvtColor(pres, bounding, CV_BGR2GRAY);
-        
-        // find the contours, returning only extreme external bounds, find the largest contour area.
-        // FIXME change to getting a bounding box around all white pixels
-        findContours(bounding,contours,CV_RETR_EXTERNAL,CV_CHAIN_APPROX_SIMPLE);
-        
-        // find the largest contour area
-        area = 0;
-        for(unsigned int it=0; it<contours.size();it++) {
-            if(area < contours[it].size())
-                idx = it; 
-        }
-        box = boundingRect(contours[idx]);
+        // find the bounding box of the salient region
+        box = salientBoundingBox(binaryMask);
         pt1.x = box.x;
         pt1.y = box.y;
         pt2.x = box.x + box.width;
@@ -224,14 +368,31 @@ int main (int argc, char * argv[]) {
         cv::imwrite(string(outputDir) + baseNames[i] + "RECT.jpg", bounding);
 
         // add the rectangle to the list of output labels
-        // the \r here is to mimic the windows-style carriage returns that are contained in the truth label files
-        outputLbls << baseNames[i].substr(0,1) << "\\" << baseNames[i] << ".jpg\r\n";
-        outputLbls << img.cols << " " << img.rows << "\n";
-        // we're getting the second labels so put bogus padding values as the first set
-        outputLbls << "0 0 0 0; " << pt1.x << " " << pt1.y << " " << pt2.x << " " << pt2.y << ";\n\n";
+        writeLabelEntry(outputLbls, baseNames[i], img.cols, img.rows, box);
+
+        // add the rectangles for the other pairwise weights of the sweep
+        for (unsigned k = 0; k < sweepLbls.size(); k++) {
+            writeLabelEntry(*sweepLbls[k], baseNames[i], img.cols, img.rows,
+                salientBoundingBox(sweepLabels[k]));
+        }
     }
     
     outputLbls.close();
+    telemetry.close();
+    for (unsigned k = 0; k < sweepLbls.size(); k++) {
+        sweepLbls[k]->close();
+        delete sweepLbls[k];
+    }
+    if ((sweepSteps > 0) && !baseNames.empty()) {
+        DRWN_LOG_MESSAGE("Average of " << (double)sweepBreakpoints / baseNames.size()
+            << " labelling changes per image over the lambda sweep");
+    }
+    if (!baseNames.empty()) {
+        DRWN_LOG_MESSAGE("Average CRF inference time: " << 1000.0 * crfTotalTime / baseNames.size()
+            << "ms per image (" << crfMode << " inference)");
+        DRWN_LOG_MESSAGE("Average wait for image loading: " << 1000.0 * prefetch.waitTime() / baseNames.size()
+            << "ms per image (prefetch depth " << prefetchDepth << ")");
+    }
     // Clean up by freeing memory and printing profile information.
     cvDestroyAllWindows();
     drwnCodeProfiler::print();
@@ -38,7 +38,15 @@
 
 #include "mexImageCRF.h"
 #include "parseLabel.h"
-#include "Classifier.h"
+#include "saliencyUtils.h"
+#include "streamingLogistic.h"
+#include "featureTuples.h"
+#include "pixelLogistic.h"
+#include "pixelSampling.h"
+#include "modelBundle.h"
+#include "featureMapStore.h"
+#include "datasetPack.h"
+#include "prefetchPipeline.h"
 
 using namespace std;
 using namespace Eigen;
@@ -48,28 +56,223 @@ using namespace Eigen;
 void usage() {
     cerr << DRWN_USAGE_HEADER << endl;
     cerr << "USAGE: ./trainModel [OPTIONS] <imgDir> <mscDir> <cshDir> <csdDir> <lblFile> \n";
+    cerr << "       ./trainModel [OPTIONS] -pack <pack>\n";
     cerr << "OPTIONS:\n"
          << "  -o <model>        :: output model\n"
+         << "  -fmap <dir>       :: read <dir>/<image>.fmap instead of the JPEG feature maps\n"
+         << "  -pack <pack>      :: read the images, feature maps and labels from a packDataset pack\n"
+         << "  -bundle <file>    :: also write the model as a binary bundle for testModel -model\n"
+         << "  -l0 <w>           :: pairwise weight stored in the bundle (default: 1)\n"
+         << "  -crf <backend>    :: CRF backend stored in the bundle (default: graphcut)\n"
+         << "  -connectivity <n> :: CRF connectivity stored in the bundle (default: 8)\n"
+         << "  -streaming        :: fit one global model by mini-batch SGD over all pixels\n"
+         << "  -store <file>     :: feature store for -streaming (kept, and reused for the same images)\n"
+         << "  -epochs <n>       :: passes over the feature store (default: 5)\n"
+         << "  -batch <n>        :: pixels per gradient step (default: 256)\n"
+         << "  -buffer <mb>      :: memory for buffered pixels in megabytes (default: 16)\n"
+         << "  -rate <r>         :: AdaGrad learning rate (default: 0.5)\n"
+         << "  -seed <n>         :: seed of the pixel shuffle and sampling (default: 0)\n"
+         << "  -dedup            :: fit one global model on weighted distinct feature tuples\n"
+         << "  -samples <n>      :: train each image on n stratified pixels (default: all)\n"
+         << "  -bands <n>        :: distance-to-box bands per label for -samples (default: 1)\n"
+         << "  -compare          :: also train on all pixels and report the weight change\n"
+         << "  -verify           :: also train darwin's logistic classifier and report the weight difference,\n"
+         << "                       or with -streaming check the signs against -dedup training\n"
+         << "  -prefetch <n>     :: images loaded ahead of training, 0 to load inline\n"
+         << "                       (default: 4 per thread)\n"
+         << "  -decoders <n>     :: threads loading them (default: 1)\n"
          << "  -x                :: visualize\n"
          << DRWN_STANDARD_OPTIONS_USAGE
 	 << endl;
 }
 
+// ImageTrainingJob ----------------------------------------------------------
+// Trains the model of one image. Jobs share only read-only settings and keep
+// their results until the caller reduces them in image order, so any number
+// of them can run at once on a thread pool. A job is reused for many images
+// and keeps its training buffers, which are only reallocated when the number
+// of pixels (or samples) differs from that of its previous image.
+
+struct ImageTrainingSettings {
+    int nSamples;               // stratified pixels per image, or 0 for all
+    int nBands;                 // distance bands per label
+    unsigned seed;
+    bool bCompare;              // also train on all pixels
+    bool bVerify;               // also train darwin's classifier
+};
+
+class ImageTrainingJob : public drwnThreadJob {
+ public:
+    const ImageTrainingSettings *settings;
+    cv::Mat maps;               // packed feature maps of the image
+    const vector<int> *box;     // ground truth rectangle
+    unsigned index;             // position of the image in the dataset
+
+    // results
+    vector<double> lambda;      // model of the image
+    vector<double> fullLambda;  // model on all pixels, with bCompare
+    vector<double> darwinLambda; // darwin's model on the same pixels, with bVerify
+    int nPixels;
+    int nSampled;
+    double sampledTime;
+    double fullTime;
+
+ protected:
+    // training buffers kept across images
+    PixelFeatureMatrix _features;
+    Eigen::VectorXf _targets;
+    Eigen::VectorXf _weights;
+    vector<int> _sampleIndices;
+    vector<float> _sampleWeights;
+
+ public:
+    ImageTrainingJob() : settings(NULL), box(NULL), index(0), nPixels(0),
+        nSampled(0), sampledTime(0.0), fullTime(0.0) { }
+    void operator()();
+};
+
+void ImageTrainingJob::operator()()
+{
+    // basic info of currently processed image
+    const int H = maps.rows;
+    const int W = maps.cols;
+    const int nDimension = 4;
+
+    // ground truth label
+    const int left = (*box)[0];
+    const int top = (*box)[1];
+    const int right = (*box)[2];
+    const int bottom = (*box)[3];
+    nPixels = H * W;
+    nSampled = 0;
+    sampledTime = fullTime = 0.0;
+
+    const bool bSample = (settings->nSamples > 0);
+    if (!bSample || settings->bCompare) {
+        // form the feature row and target of each pixel in one pass
+        _features.resize(H * W, nDimension);
+        _targets.resize(H * W);
+        for (int y = 0 ; y < H ; y ++) {
+            for (int x = 0 ; x < W ; x ++) {
+                float *f = _features.data() + (y * W + x) * nDimension;
+                f[0] = packedFeature(maps, y, x, FEATURE_MSC);
+                f[1] = packedFeature(maps, y, x, FEATURE_CSH);
+                f[2] = packedFeature(maps, y, x, FEATURE_CSD);
+                f[3] = 1.0f;
+                _targets[y * W + x] = (y >= top && y <= bottom && x >= left && x <= right) ? 1.0f : 0.0f;
+            }
+        }
+
+        const double startTime = crfWallTime();
+        fitPixelLogistic(_features, _targets, NULL, fullLambda);
+        fullTime = crfWallTime() - startTime;
+        lambda = fullLambda;
+    }
+
+    if (bSample) {
+        // only the selected pixels are read, weighted by the inverse of
+        // their stratum's sampling rate
+        StratifiedPixelSampler sampler(settings->nSamples, settings->nBands, settings->seed);
+        nSampled = sampler.sample(W, H, *box, index, _sampleIndices, _sampleWeights);
+        _features.resize(nSampled, nDimension);
+        _targets.resize(nSampled);
+        _weights.resize(nSampled);
+        for (int k = 0; k < nSampled; k++) {
+            const int y = _sampleIndices[k] / W;
+            const int x = _sampleIndices[k] - y * W;
+            float *f = _features.data() + k * nDimension;
+            f[0] = packedFeature(maps, y, x, FEATURE_MSC);
+            f[1] = packedFeature(maps, y, x, FEATURE_CSH);
+            f[2] = packedFeature(maps, y, x, FEATURE_CSD);
+            f[3] = 1.0f;
+            _targets[k] = (y >= top && y <= bottom && x >= left && x <= right) ? 1.0f : 0.0f;
+            _weights[k] = _sampleWeights[k];
+        }
+
+        const double startTime = crfWallTime();
+        fitPixelLogistic(_features, _targets, &_weights, lambda);
+        sampledTime = crfWallTime() - startTime;
+    }
+
+    // the buffers still hold the pixels that lambda was trained on
+    if (settings->bVerify) {
+        fitDarwinLogistic(_features, _targets, bSample ? &_weights : NULL, darwinLambda);
+    }
+}
+
+// largest difference between two models, relative to the magnitude of the
+// second
+double logisticWeightDifference(const vector<double> &a, const vector<double> &b)
+{
+    double difference = 0.0;
+    for (unsigned k = 0; k < a.size(); k++) {
+        difference = std::max(difference, fabs(a[k] - b[k]) / (1.0 + fabs(b[k])));
+    }
+    return difference;
+}
+
+void reportDarwinDifference(double difference)
+{
+    DRWN_LOG_MESSAGE("Largest relative weight difference against darwin's logistic classifier: "
+        << difference);
+    if (difference > 1.0e-3) {
+        DRWN_LOG_WARNING("logistic weights differ from those of darwin's classifier");
+    }
+}
+
 // main ----------------------------------------------------------------------
 
 int main (int argc, char * argv[]) {
 
     // Set default value for optional command line arguments.
     const char *modelFile = NULL;
+    const char *fmapDir = NULL;
+    const char *packFile = NULL;
+    const char *bundleFile = NULL;
+    double lambda0 = 1.0;
+    const char *crfBackendName = "graphcut";
+    int connectivity = 8;
+    bool bStreaming = false;
+    const char *storeFile = NULL;
+    StreamingLogisticParameters streamingParams;
+    int bufferMegabytes = (int)(streamingParams.bufferRecords * sizeof(FeatureRecord) >> 20);
+    int seed = 0;
+    bool bDeduplicate = false;
+    int nSamples = 0;
+    int nBands = 1;
+    bool bCompare = false;
+    bool bVerify = false;
+    int prefetchDepth = -1;
+    int nDecoders = 1;
     bool bVisualize = false;
 
     DRWN_BEGIN_CMDLINE_PROCESSING(argc, argv)
         DRWN_CMDLINE_STR_OPTION("-o", modelFile)
+        DRWN_CMDLINE_STR_OPTION("-fmap", fmapDir)
+        DRWN_CMDLINE_STR_OPTION("-pack", packFile)
+        DRWN_CMDLINE_STR_OPTION("-bundle", bundleFile)
+        DRWN_CMDLINE_REAL_OPTION("-l0", lambda0)
+        DRWN_CMDLINE_STR_OPTION("-crf", crfBackendName)
+        DRWN_CMDLINE_INT_OPTION("-connectivity", connectivity)
+        DRWN_CMDLINE_BOOL_OPTION("-streaming", bStreaming)
+        DRWN_CMDLINE_STR_OPTION("-store", storeFile)
+        DRWN_CMDLINE_INT_OPTION("-epochs", streamingParams.epochs)
+        DRWN_CMDLINE_INT_OPTION("-batch", streamingParams.batchSize)
+        DRWN_CMDLINE_INT_OPTION("-buffer", bufferMegabytes)
+        DRWN_CMDLINE_REAL_OPTION("-rate", streamingParams.learningRate)
+        DRWN_CMDLINE_INT_OPTION("-seed", seed)
+        DRWN_CMDLINE_BOOL_OPTION("-dedup", bDeduplicate)
+        DRWN_CMDLINE_INT_OPTION("-samples", nSamples)
+        DRWN_CMDLINE_INT_OPTION("-bands", nBands)
+        DRWN_CMDLINE_BOOL_OPTION("-compare", bCompare)
+        DRWN_CMDLINE_BOOL_OPTION("-verify", bVerify)
+        DRWN_CMDLINE_INT_OPTION("-prefetch", prefetchDepth)
+        DRWN_CMDLINE_INT_OPTION("-decoders", nDecoders)
         DRWN_CMDLINE_BOOL_OPTION("-x", bVisualize)
     DRWN_END_CMDLINE_PROCESSING(usage());
 
     // Check for the correct number of required arguments
-    if (DRWN_CMDLINE_ARGC != 5) {
+    if (DRWN_CMDLINE_ARGC != ((packFile != NULL) ? 0 : 5)) {
         usage();
         return -1;
     }
@@ -80,98 +283,350 @@ int main (int argc, char * argv[]) {
      * with the same base as the image directory, but with extension
      * ".txt". 
      */
-    const char *imgDir = DRWN_CMDLINE_ARGV[0]; // directory restores original images
-    const char *mscDir = DRWN_CMDLINE_ARGV[1]; // directory restores multiscale contrast feature map
-    const char *cshDir = DRWN_CMDLINE_ARGV[2]; // directory restores center surround histogram feature map
-    const char *csdDir = DRWN_CMDLINE_ARGV[3]; // directory restores color spatial distribution feature map
-    const char *lblFile = DRWN_CMDLINE_ARGV[4]; // a single text file with ground truth rectangle
-
-    // check their existence
-    DRWN_ASSERT_MSG(drwnDirExists(imgDir), "image directory " << imgDir << " does not exist");
-    DRWN_ASSERT_MSG(drwnDirExists(mscDir), "Multiscale Contrast directory " << mscDir << " does not exist");
-    DRWN_ASSERT_MSG(drwnDirExists(imgDir), "Centre-Surround histogram directory " << cshDir << " does not exist");
-    DRWN_ASSERT_MSG(drwnDirExists(imgDir), "Colour Spatial Distribution directory " << csdDir << " does not exist");
-    DRWN_ASSERT_MSG(drwnFileExists(lblFile), "Labels file " << lblFile << " does not exist");
-
-
-    // Get a list of images from the image directory.
-    vector<string> baseNames = drwnDirectoryListing(imgDir, ".jpg", false, false);
+    const char *imgDir = NULL; // directory restores original images
+    const char *mscDir = NULL; // directory restores multiscale contrast feature map
+    const char *cshDir = NULL; // directory restores center surround histogram feature map
+    const char *csdDir = NULL; // directory restores color spatial distribution feature map
+    const char *lblFile = NULL; // a single text file with ground truth rectangle
+
+    // with -pack, everything comes from one mapped file
+    DatasetPack pack;
+    vector<string> baseNames;
+    map< string, vector<int> > fileLabelPairs;
+    if (packFile != NULL) {
+        DRWN_ASSERT_MSG(pack.open(packFile), "could not read dataset pack " << packFile);
+        baseNames = pack.baseNames();
+        fileLabelPairs = pack.labels();
+        for (unsigned i = 0; i < pack.size(); i++) {
+            DRWN_ASSERT_MSG(pack.hasBox(i), "dataset pack " << packFile << " has no ground truth for "
+                << pack.name(i) << " (build it with packDataset -labels)");
+            DRWN_ASSERT_MSG(pack.hasFeatures(i), "dataset pack " << packFile << " has no feature maps for "
+                << pack.name(i) << " (build it with packDataset -fmap or -msc/-csh/-csd)");
+        }
+    } else {
+        imgDir = DRWN_CMDLINE_ARGV[0];
+        mscDir = DRWN_CMDLINE_ARGV[1];
+        cshDir = DRWN_CMDLINE_ARGV[2];
+        csdDir = DRWN_CMDLINE_ARGV[3];
+        lblFile = DRWN_CMDLINE_ARGV[4];
+
+        // check their existence
+        DRWN_ASSERT_MSG(drwnDirExists(imgDir), "image directory " << imgDir << " does not exist");
+        if (fmapDir != NULL) {
+            DRWN_ASSERT_MSG(drwnDirExists(fmapDir), "feature map directory " << fmapDir << " does not exist");
+        } else {
+            DRWN_ASSERT_MSG(drwnDirExists(mscDir), "Multiscale Contrast directory " << mscDir << " does not exist");
+            DRWN_ASSERT_MSG(drwnDirExists(imgDir), "Centre-Surround histogram directory " << cshDir << " does not exist");
+            DRWN_ASSERT_MSG(drwnDirExists(imgDir), "Colour Spatial Distribution directory " << csdDir << " does not exist");
+        }
+        DRWN_ASSERT_MSG(drwnFileExists(lblFile), "Labels file " << lblFile << " does not exist");
+
+        // Get a list of images from the image directory.
+        baseNames = drwnDirectoryListing(imgDir, ".jpg", false, false);
+        fileLabelPairs = parseLabel(lblFile);
+        for (unsigned i = 0; i < baseNames.size(); i++) {
+            DRWN_ASSERT_MSG(fileLabelPairs.find(baseNames[i] + ".jpg") != fileLabelPairs.end(),
+                "Labels file " << lblFile << " has no ground truth for " << baseNames[i]);
+        }
+    }
     const int nImages = baseNames.size();
     DRWN_LOG_MESSAGE("Loading " << nImages << " images and labels...");
-
-    map< string, vector<int> > fileLabelPairs = parseLabel(lblFile);
     String processedImage;
 
-    // initialise one 2-class logistic model, data dimension = 3
+    // the feature maps are decoded ahead of the loops below, by default a
+    // whole window of per-image jobs ahead. A single decoder, as in
+    // testModel, leaves the cores to the training threads; the wait for
+    // feature maps is logged so that -decoders can be raised if it is large
+    const unsigned nWindow = 4 * std::max(drwnThreadPool::MAX_THREADS, 1u);
+    if (prefetchDepth < 0) prefetchDepth = (int)nWindow;
+    DRWN_ASSERT_MSG(nDecoders >= 1, "invalid -decoders");
+    DatasetImageLoader loader;
+    loader.baseNames = &baseNames;
+    loader.pack = pack.isOpen() ? &pack : NULL;
+    loader.fmapDir = fmapDir;
+    loader.mscDir = mscDir;
+    loader.cshDir = cshDir;
+    loader.csdDir = csdDir;
+    loader.bImages = false;
+    PrefetchItem item;
+
+    // logistic model on three features and a bias
     const int nDimension = 4;
-    const int nClasses = 2;
 
     vector<double> summation (nDimension, 0.0);
+    vector<double> modelWeights;
+    DRWN_ASSERT_MSG(!(bStreaming && bDeduplicate), "-streaming and -dedup are exclusive");
+    const bool bPerImage = !bStreaming && !bDeduplicate;
 
-    for (unsigned i = 0; i < baseNames.size(); i ++ ) {
-        processedImage = baseNames[i] + ".jpg";
-        DRWN_LOG_STATUS("...processing image " << baseNames[i]);
-        Classifier classifier;
-        classifier.initialize(nDimension, nClasses);
-        // read the image and draw the rectangle of labels of training data
-        cv::Mat img = cv::imread(string(imgDir) + DRWN_DIRSEP + processedImage);
-        cv::Mat msc = cv::imread(string(mscDir) + DRWN_DIRSEP + processedImage);
-        cv::Mat csh = cv::imread(string(cshDir) + DRWN_DIRSEP + processedImage);
-        cv::Mat csd = cv::imread(string(csdDir) + DRWN_DIRSEP + processedImage);
-
-        // basic info of currently processed image
-        const int H = img.rows;
-        const int W = img.cols;
-
-        // form feature vector for each pixel
-        vector< vector<double> > features;
-        features.resize(H * W, vector<double>(nDimension, 0.0));
-        for (int y = 0 ; y < H ; y ++) {
-            for (int x = 0 ; x < W ; x ++) {
-                features[ y * W + x ][0] = msc.at<Vec3b>(y,x).val[0] / 255.0;
-                features[ y * W + x ][1] = csh.at<Vec3b>(y,x).val[0] / 255.0;
-                features[ y * W + x ][2] = csd.at<Vec3b>(y,x).val[0] / 255.0;
-                features[ y * W + x ][3] = 1;
+    if (bDeduplicate) {
+        // fold every pixel of every image into counts per distinct
+        // (msc, csh, csd) tuple and train once on the weighted tuples
+        FeatureTupleCounts counts;
+        PrefetchPipeline prefetch(loader, baseNames.size(), prefetchDepth, nDecoders);
+        for (unsigned i = 0; i < baseNames.size(); i++) {
+            processedImage = baseNames[i] + ".jpg";
+            DRWN_LOG_STATUS("...counting features of image " << baseNames[i]);
+            prefetch.next(item);
+            const cv::Mat &maps = item.features;
+            const vector<int> &box = fileLabelPairs.find(processedImage)->second;
+            for (int y = 0; y < maps.rows; y++) {
+                for (int x = 0; x < maps.cols; x++) {
+                    counts.add(packedFeatureByte(maps, y, x, FEATURE_MSC),
+                        packedFeatureByte(maps, y, x, FEATURE_CSH),
+                        packedFeatureByte(maps, y, x, FEATURE_CSD),
+                        y >= box[1] && y <= box[3] && x >= box[0] && x <= box[2]);
+                }
             }
         }
 
-        // ground truth label
-        int left, top, right, bottom;
-        vector<int> tempRectangle = fileLabelPairs.find(processedImage)->second ;
-        left =  tempRectangle [0];
-        top = tempRectangle [1];
-        right = tempRectangle [2];
-        bottom = tempRectangle[3];
+        PixelFeatureMatrix features;
+        Eigen::VectorXf targets;
+        Eigen::VectorXf weights;
+        counts.samples(features, targets, weights);
+        DRWN_LOG_MESSAGE("Folded " << counts.total() << " pixels into " << counts.size()
+            << " distinct feature tuples (" << features.rows() << " weighted samples)");
 
-        // form target vector for the current image
-        vector<int> targets( H * W, 0);
-        for (int y = 0 ; y < H ; y ++) {
-            for (int x = 0 ; x < W ; x ++) {
-                if ( y >= top && y <= bottom && x >= left && x <= right)
-                    targets[ y * W + x ] = 1;
+        fitPixelLogistic(features, targets, &weights, modelWeights);
+        cout << "global: " << modelWeights[0] << "," << modelWeights[1] << ","
+             << modelWeights[2] << "," << modelWeights[3] << endl;
+
+        if (bVerify) {
+            vector<double> darwinWeights;
+            fitDarwinLogistic(features, targets, &weights, darwinWeights);
+            reportDarwinDifference(logisticWeightDifference(modelWeights, darwinWeights));
+        }
+    }
+
+    if (bStreaming) {
+        // write every pixel of every image to the feature store once, then
+        // fit a single model over several passes through a fixed buffer
+        const string storeName = (storeFile != NULL) ? string(storeFile) :
+            ((modelFile != NULL) ? string(modelFile) : string("trainModel")) + ".store";
+        // a store is only reused for the same images and rectangles
+        const unsigned long long listHash = featureStoreListHash(baseNames, fileLabelPairs);
+        FeatureStoreReader store;
+        bool bReuse = store.open(storeName.c_str());
+        if (bReuse && ((store.images() != baseNames.size()) || (store.listHash() != listHash))) {
+            DRWN_LOG_WARNING("feature store " << storeName << " was written for other images; rewriting it");
+            store.close();
+            bReuse = false;
+        }
+        if (bReuse) {
+            DRWN_LOG_MESSAGE("Reusing feature store " << storeName << " with " << store.size() << " pixels");
+        } else {
+            FeatureStoreWriter writer;
+            DRWN_ASSERT_MSG(writer.open(storeName.c_str(), baseNames.size(), listHash),
+                "could not create feature store " << storeName);
+            vector<FeatureRecord> row;
+            PrefetchPipeline prefetch(loader, baseNames.size(), prefetchDepth, nDecoders);
+            for (unsigned i = 0; i < baseNames.size(); i++) {
+                processedImage = baseNames[i] + ".jpg";
+                DRWN_LOG_STATUS("...storing features of image " << baseNames[i]);
+                prefetch.next(item);
+                const cv::Mat &maps = item.features;
+                const vector<int> &box = fileLabelPairs.find(processedImage)->second;
+
+                row.resize(maps.cols);
+                for (int y = 0; y < maps.rows; y++) {
+                    for (int x = 0; x < maps.cols; x++) {
+                        row[x].msc = packedFeatureByte(maps, y, x, FEATURE_MSC);
+                        row[x].csh = packedFeatureByte(maps, y, x, FEATURE_CSH);
+                        row[x].csd = packedFeatureByte(maps, y, x, FEATURE_CSD);
+                        row[x].label = (y >= box[1] && y <= box[3] && x >= box[0] && x <= box[2]) ? 1 : 0;
+                    }
+                    writer.append(&row[0], row.size());
+                }
             }
-        } 
+            DRWN_ASSERT_MSG(writer.close(), "could not write feature store " << storeName);
+            DRWN_ASSERT_MSG(store.open(storeName.c_str()), "could not read feature store " << storeName);
+        }
 
-        classifier.train(features, targets);
+        streamingParams.bufferRecords = std::max(streamingParams.chunkRecords,
+            ((size_t)bufferMegabytes << 20) / sizeof(FeatureRecord));
+        streamingParams.seed = (unsigned)seed;
+        StreamingLogisticTrainer trainer(streamingParams);
+        modelWeights = trainer.train(store);
+        DRWN_LOG_MESSAGE("Trained on " << store.size() << " pixels, mean log loss " << trainer.loss());
+        cout << "global: " << modelWeights[0] << "," << modelWeights[1] << ","
+             << modelWeights[2] << "," << modelWeights[3] << endl;
 
-        vector<double> lambda = classifier.getWeights();
-        cout << lambda[0] << "," << lambda[1] << "," << lambda[2] << "," << lambda[3]  << endl;
-        for (int k = 0; k < nDimension ; k ++) {
-            summation[k] += lambda[k];
+        if (bVerify) {
+            // fit the same pixels as -dedup does and compare the signs
+            FeatureTupleCounts counts;
+            vector<FeatureRecord> chunk(streamingParams.chunkRecords);
+            for (unsigned long long first = 0; first < store.size(); first += chunk.size()) {
+                const size_t n = store.read(first, &chunk[0], chunk.size());
+                DRWN_ASSERT_MSG(n > 0, "could not read feature store " << storeName);
+                for (size_t k = 0; k < n; k++) {
+                    counts.add(chunk[k].msc, chunk[k].csh, chunk[k].csd, chunk[k].label != 0);
+                }
+            }
+            PixelFeatureMatrix features;
+            Eigen::VectorXf targets;
+            Eigen::VectorXf weights;
+            counts.samples(features, targets, weights);
+            vector<double> dedupWeights;
+            fitPixelLogistic(features, targets, &weights, dedupWeights);
+            cout << "dedup: " << dedupWeights[0] << "," << dedupWeights[1] << ","
+                 << dedupWeights[2] << "," << dedupWeights[3] << endl;
+            int nDiffering = 0;
+            for (int k = 0; k < nDimension; k++) {
+                if ((modelWeights[k] < 0.0) != (dedupWeights[k] < 0.0)) nDiffering += 1;
+            }
+            DRWN_LOG_MESSAGE(nDiffering << " of " << nDimension
+                << " streaming weights differ in sign from -dedup training");
+            if (nDiffering > 0) {
+                DRWN_LOG_WARNING("streaming and -dedup weights disagree in sign");
+            }
         }
+    }
+
+    // stratified subsampling of the pixels of each image, optionally
+    // checked against training on all of them
+    const bool bSample = bPerImage && (nSamples > 0);
+    DRWN_ASSERT_MSG(!bSample || (nBands > 0), "number of distance bands must be positive");
+    vector<double> fullSummation(nDimension, 0.0);
+    double weightChange = 0.0;
+    double sampledTime = 0.0;
+    double fullTime = 0.0;
+    long long nSampledPixels = 0;
+    long long nPixels = 0;
+
+    // images are trained in windows of jobs on one thread pool, and each
+    // window is reduced in image order, so that the printed models and their
+    // sum are the same for any number of threads
+    ImageTrainingSettings settings;
+    settings.nSamples = bSample ? nSamples : 0;
+    settings.nBands = nBands;
+    settings.seed = (unsigned)seed;
+    settings.bCompare = bSample && bCompare;
+    settings.bVerify = bVerify;
+    double darwinDifference = 0.0;
 
-        // show the image and feature maps 
-        if (bVisualize) {
-            //drwnDrawRegionBoundaries and drwnShowDebuggingImage use OpenCV 1.0 C API
-            IplImage cvimg = (IplImage)img;
-            IplImage *canvas = cvCloneImage(&cvimg);
-            drwnShowDebuggingImage(canvas, "image", false);
-            cvReleaseImage(&canvas);
+    // while a window trains, the decoders load the maps of the next one
+    PrefetchPipeline prefetch(loader, bPerImage ? baseNames.size() : 0, prefetchDepth, nDecoders);
+    vector<ImageTrainingJob> jobs(bPerImage ? nWindow : 0);
+    drwnThreadPool threadPool;
+    for (unsigned first = 0; bPerImage && (first < baseNames.size()); first += nWindow) {
+        const unsigned last = std::min((unsigned)baseNames.size(), first + nWindow);
+        DRWN_LOG_STATUS("...processing images " << first + 1 << " to " << last << " of " << nImages);
+        for (unsigned i = first; i < last; i++) {
+            prefetch.next(item);
+            jobs[i - first].maps = item.features;
         }
+        threadPool.start();
+        for (unsigned i = first; i < last; i++) {
+            ImageTrainingJob &job = jobs[i - first];
+            job.settings = &settings;
+            job.box = &fileLabelPairs.find(baseNames[i] + ".jpg")->second;
+            job.index = i;
+            threadPool.addJob(&job);
+        }
+        threadPool.finish();
+
+        for (unsigned i = first; i < last; i++) {
+            const ImageTrainingJob &job = jobs[i - first];
+            const vector<double> &lambda = job.lambda;
+            nPixels += job.nPixels;
+            nSampledPixels += job.nSampled;
+            sampledTime += job.sampledTime;
+            fullTime += job.fullTime;
+            if (settings.bCompare) {
+                double change = 0.0;
+                for (int k = 0; k < nDimension; k++) {
+                    fullSummation[k] += job.fullLambda[k];
+                    change += (lambda[k] - job.fullLambda[k]) * (lambda[k] - job.fullLambda[k]);
+                }
+                weightChange += sqrt(change);
+                DRWN_LOG_VERBOSE("..." << baseNames[i] << " weight change " << sqrt(change));
+            }
+            if (settings.bVerify) {
+                const double difference = logisticWeightDifference(lambda, job.darwinLambda);
+                darwinDifference = std::max(darwinDifference, difference);
+                DRWN_LOG_VERBOSE("..." << baseNames[i] << " differs from darwin's weights by " << difference);
+            }
+
+            cout << lambda[0] << "," << lambda[1] << "," << lambda[2] << "," << lambda[3]  << endl;
+            for (int k = 0; k < nDimension ; k ++) {
+                summation[k] += lambda[k];
+            }
+
+            // show the image and feature maps
+            if (bVisualize) {
+                processedImage = baseNames[i] + ".jpg";
+                cv::Mat img = pack.isOpen() ? pack.image(i) :
+                    cv::imread(string(imgDir) + DRWN_DIRSEP + processedImage);
+                //drwnDrawRegionBoundaries and drwnShowDebuggingImage use OpenCV 1.0 C API
+                IplImage cvimg = (IplImage)img;
+                IplImage *canvas = cvCloneImage(&cvimg);
+                drwnShowDebuggingImage(canvas, "image", false);
+                cvReleaseImage(&canvas);
+            }
+        }
+    }
+
+    if (bPerImage && (nImages > 0)) {
+        DRWN_LOG_MESSAGE("Waited " << 1000.0 * prefetch.waitTime() / nImages
+            << "ms per image for feature maps (prefetch depth " << prefetchDepth << ")");
     }
 
-    cout << "average: "<< summation[0]/ (float)nImages << "," << summation[1]/ (float)nImages << 
-        "," << summation[2]/ (float)nImages << summation[3]/ (float)nImages << endl;
+    if (bPerImage) {
+        cout << "average: "<< summation[0]/ (float)nImages << "," << summation[1]/ (float)nImages <<
+            "," << summation[2]/ (float)nImages << "," << summation[3]/ (float)nImages << endl;
+        for (int k = 0; k < nDimension; k++) {
+            modelWeights.push_back(summation[k] / nImages);
+        }
+    }
+
+    if (bPerImage && bVerify) {
+        reportDarwinDifference(darwinDifference);
+    }
+
+    if (bSample) {
+        DRWN_LOG_MESSAGE("Trained on " << nSampledPixels << " of " << nPixels << " pixels ("
+            << nSamples << " per image in " << 2 * nBands << " strata) in " << sampledTime << "s");
+    }
+    if (bSample && bCompare && (nImages > 0)) {
+        double averageChange = 0.0;
+        for (int k = 0; k < nDimension; k++) {
+            const double delta = (summation[k] - fullSummation[k]) / nImages;
+            averageChange += delta * delta;
+        }
+        DRWN_LOG_MESSAGE("Full-pixel training took " << fullTime << "s ("
+            << fullTime / std::max(sampledTime, 1.0e-9) << "x the sampled time)");
+        DRWN_LOG_MESSAGE("Weight change against full-pixel training: " << weightChange / nImages
+            << " mean per image, " << sqrt(averageChange) << " for the average model");
+        cout << "full average: " << fullSummation[0] / (float)nImages << "," << fullSummation[1] / (float)nImages
+             << "," << fullSummation[2] / (float)nImages << "," << fullSummation[3] / (float)nImages << endl;
+    }
+
+    if (modelFile != NULL) {
+        DRWN_ASSERT_MSG(writeSaliencyModel(modelFile, modelWeights), "could not write model " << modelFile);
+        DRWN_LOG_MESSAGE("Wrote model to " << modelFile);
+    }
+
+    if (bundleFile != NULL) {
+        const DenseCRFParameters denseParams;
+        ModelCRFConfig crfConfig;
+        memset(&crfConfig, 0, sizeof(crfConfig));
+        crfConfig.lambda0 = lambda0;
+        crfConfig.resolution = 1000.0;
+        crfConfig.backend = parseCRFBackend(crfBackendName);
+        crfConfig.connectivity = parseCRFNeighbourhood(connectivity);
+        crfConfig.denseIterations = denseParams.nIterations;
+        crfConfig.bilateralXY = denseParams.bilateralXY;
+        crfConfig.bilateralRGB = denseParams.bilateralRGB;
+        crfConfig.gaussianXY = denseParams.gaussianXY;
+        crfConfig.gaussianWeight = denseParams.gaussianWeight;
+
+        ModelBundleWriter bundle;
+        bundle.addWeights(modelWeights);
+        bundle.addFeatures(modelFeatureConfig());
+        bundle.addCRF(crfConfig);
+        bundle.addFeatureTables();
+        DRWN_ASSERT_MSG(bundle.write(bundleFile), "could not write model bundle " << bundleFile);
+        DRWN_LOG_MESSAGE("Wrote model bundle to " << bundleFile);
+    }
 
     // Clean up by freeing memory and printing profile information.
     cvDestroyAllWindows();
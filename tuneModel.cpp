@@ -0,0 +1,349 @@
+/*****************************************************************************
+** DARWIN: A FRAMEWORK FOR MACHINE LEARNING RESEARCH AND DEVELOPMENT
+** Distributed under the terms of the BSD license (see the LICENSE file)
+** Copyright (c) 2007-2013, Stephen Gould
+** All rights reserved.
+**
+******************************************************************************
+** FILENAME:    tuneModel.cpp
+** AUTHOR(S):
+**     Jimmy Lin (u5223173) - linxin@gmail.com
+**     Chris Claoue-Long (u5183532) - u5183532@anu.edu.au
+**
+** Grid search over the unary weights lambda1, lambda2, lambda3 and the
+** pairwise weight lambda0 of testModel. The images and feature maps are
+** decoded once into memory, every setting runs the CRF on them in its own
+** job on a thread pool, and the resulting rectangles are scored in-process
+** as scoreModel would score them. With -subset, all settings are first
+** scored on a subset of the images and only the best of them go on to the
+** rest.
+**
+*****************************************************************************/
+
+// c++ standard headers
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <algorithm>
+
+// eigen matrix library headers
+#include "Eigen/Core"
+
+// opencv library headers
+#include "cv.h"
+#include "cxcore.h"
+#include "highgui.h"
+
+// darwin library headers
+#include "drwnBase.h"
+#include "drwnIO.h"
+#include "drwnML.h"
+#include "drwnVision.h"
+
+#include "mexImageCRF.h"
+#include "parseLabel.h"
+#include "saliencyUtils.h"
+#include "saliencyScore.h"
+#include "featureMapStore.h"
+
+using namespace std;
+using namespace Eigen;
+
+// usage ---------------------------------------------------------------------
+
+void usage()
+{
+    cerr << DRWN_USAGE_HEADER << endl;
+    cerr << "USAGE: ./tuneModel [OPTIONS] <imgDir> <mscDir> <cshDir> <csdDir> <lblFile>\n";
+    cerr << "OPTIONS:\n"
+         << "  -l1 <list>        :: comma-separated values of lambda1 (default: 1)\n"
+         << "  -l2 <list>        :: comma-separated values of lambda2 (default: 1)\n"
+         << "  -l3 <list>        :: comma-separated values of lambda3 (default: 1)\n"
+         << "  -l0 <list>        :: comma-separated values of lambda0 (default: 1)\n"
+         << "  -crf <backend>    :: CRF inference backend, as for testModel (default: graphcut)\n"
+         << "  -connectivity <n> :: 4- or 8-connected (default) pairwise terms\n"
+         << "  -subset <n>       :: score every setting on the first n images, then only\n"
+         << "                       the best of them on the rest (default: all images)\n"
+         << "  -keep <f>         :: fraction of settings kept after -subset (default: 0.25)\n"
+         << "  -rank <score>     :: rank settings by fmeasure (default) or bde\n"
+         << "  -o <file>         :: write every setting and its scores as CSV\n"
+         << "  -fmap <dir>       :: read <dir>/<image>.fmap instead of the JPEG feature maps\n"
+         << DRWN_STANDARD_OPTIONS_USAGE
+	 << endl;
+}
+
+// TuningImage ---------------------------------------------------------------
+// One image of the dataset as held in memory for the whole search: the
+// colour image for the contrast weights and the first channel of each
+// feature map, packed into one 3-channel image.
+
+struct TuningImage {
+    string baseName;
+    cv::Mat img;
+    cv::Mat features;           // MSC, CSH and CSD
+    vector<int> truth;          // ground truth rectangle
+};
+
+// TuningJob -----------------------------------------------------------------
+// Scores one setting of the weights on a range of images, adding to the
+// scores of any earlier range.
+
+class TuningJob : public drwnThreadJob {
+ public:
+    const vector<TuningImage> *images;
+    double lambda1, lambda2, lambda3, lambda0;
+    CRFBackend backend;
+    CRFNeighbourhood neighbourhood;
+    int first, last;            // images scored by the next run
+    SaliencyScore score;
+
+ public:
+    TuningJob() : images(NULL), lambda1(1.0), lambda2(1.0), lambda3(1.0), lambda0(1.0),
+        backend(CRF_GRAPHCUT), neighbourhood(CRF_8_CONNECTED), first(0), last(0) { }
+    void operator()();
+};
+
+void TuningJob::operator()()
+{
+    CRFContext crf;
+    crf.setNeighbourhood(neighbourhood);
+    vector< cv::Mat > unary(2);
+    vector<int> result(4);
+    for (int i = first; i < last; i++) {
+        const TuningImage &image = (*images)[i];
+        computeUnary(image.features, lambda1, lambda2, lambda3, unary);
+        const cv::Rect box = salientBoundingBox(crf.infer(image.img, unary, lambda0, backend));
+
+        // the rectangle as testModel writes it to its label file
+        result[0] = box.x;
+        result[1] = box.y;
+        result[2] = box.x + box.width;
+        result[3] = box.y + box.height;
+        score.add(result, image.truth);
+    }
+}
+
+// ranks jobs by average F-measure (descending) or BDE (ascending)
+struct TuningRank {
+    const vector<TuningJob> *jobs;
+    bool bByBDE;
+
+    TuningRank(const vector<TuningJob> &j, bool b) : jobs(&j), bByBDE(b) { }
+    bool operator()(int a, int b) const {
+        const SaliencyScore &sa = (*jobs)[a].score;
+        const SaliencyScore &sb = (*jobs)[b].score;
+        return bByBDE ? (sa.averageBDE() < sb.averageBDE()) :
+            (sa.averageFMeasure() > sb.averageFMeasure());
+    }
+};
+
+// parses a comma-separated list of numbers
+vector<double> parseValues(const char *list)
+{
+    vector<double> values;
+    const char *p = list;
+    while (*p != '\0') {
+        char *end;
+        values.push_back(strtod(p, &end));
+        DRWN_ASSERT_MSG((end != p) && ((*end == ',') || (*end == '\0')),
+            "invalid list of values \"" << list << "\"");
+        p = (*end == ',') ? end + 1 : end;
+    }
+    DRWN_ASSERT_MSG(!values.empty(), "empty list of values");
+    return values;
+}
+
+// runs the given jobs on images [first, last) on a thread pool
+void runTuningJobs(vector<TuningJob> &jobs, const vector<int> &active, int first, int last)
+{
+    drwnThreadPool threadPool;
+    threadPool.start();
+    for (unsigned k = 0; k < active.size(); k++) {
+        jobs[active[k]].first = first;
+        jobs[active[k]].last = last;
+        threadPool.addJob(&jobs[active[k]]);
+    }
+    threadPool.finish();
+}
+
+// main ----------------------------------------------------------------------
+
+int main(int argc, char *argv[])
+{
+    // Set default value for optional command line arguments.
+    const char *lambda1List = "1";
+    const char *lambda2List = "1";
+    const char *lambda3List = "1";
+    const char *lambda0List = "1";
+    const char *crfBackendName = "graphcut";
+    int connectivity = 8;
+    int subsetSize = 0;
+    double keepFraction = 0.25;
+    const char *rankName = "fmeasure";
+    const char *outputFile = NULL;
+    const char *fmapDir = NULL;
+
+    DRWN_BEGIN_CMDLINE_PROCESSING(argc, argv)
+        DRWN_CMDLINE_STR_OPTION("-l1", lambda1List)
+        DRWN_CMDLINE_STR_OPTION("-l2", lambda2List)
+        DRWN_CMDLINE_STR_OPTION("-l3", lambda3List)
+        DRWN_CMDLINE_STR_OPTION("-l0", lambda0List)
+        DRWN_CMDLINE_STR_OPTION("-crf", crfBackendName)
+        DRWN_CMDLINE_INT_OPTION("-connectivity", connectivity)
+        DRWN_CMDLINE_INT_OPTION("-subset", subsetSize)
+        DRWN_CMDLINE_REAL_OPTION("-keep", keepFraction)
+        DRWN_CMDLINE_STR_OPTION("-rank", rankName)
+        DRWN_CMDLINE_STR_OPTION("-o", outputFile)
+        DRWN_CMDLINE_STR_OPTION("-fmap", fmapDir)
+    DRWN_END_CMDLINE_PROCESSING(usage());
+
+    // Check for the correct number of required arguments
+    if (DRWN_CMDLINE_ARGC != 5) {
+        usage();
+        return -1;
+    }
+
+    const CRFBackend crfBackend = parseCRFBackend(crfBackendName);
+    const CRFNeighbourhood neighbourhood = parseCRFNeighbourhood(connectivity);
+    DRWN_ASSERT_MSG(!strcmp(rankName, "fmeasure") || !strcmp(rankName, "bde"),
+        "unknown ranking \"" << rankName << "\"");
+    const bool bRankByBDE = !strcmp(rankName, "bde");
+    DRWN_ASSERT_MSG((keepFraction > 0.0) && (keepFraction <= 1.0), "-keep must be in (0, 1]");
+
+    const char *imgDir = DRWN_CMDLINE_ARGV[0]; // directory restores original images
+    const char *mscDir = DRWN_CMDLINE_ARGV[1]; // directory restores multiscale contrast feature map
+    const char *cshDir = DRWN_CMDLINE_ARGV[2]; // directory restores center surround histogram feature map
+    const char *csdDir = DRWN_CMDLINE_ARGV[3]; // directory restores color spatial distribution feature map
+    const char *lblFile = DRWN_CMDLINE_ARGV[4]; // a single text file with ground truth rectangle
+
+    DRWN_ASSERT_MSG(drwnDirExists(imgDir), "image directory " << imgDir << " does not exist");
+    if (fmapDir != NULL) {
+        DRWN_ASSERT_MSG(drwnDirExists(fmapDir), "feature map directory " << fmapDir << " does not exist");
+    } else {
+        DRWN_ASSERT_MSG(drwnDirExists(mscDir), "Multiscale Contrast directory " << mscDir << " does not exist");
+        DRWN_ASSERT_MSG(drwnDirExists(cshDir), "Centre-Surround Histogram directory " << cshDir << " does not exist");
+        DRWN_ASSERT_MSG(drwnDirExists(csdDir), "Colour Spatial Distribution directory " << csdDir << " does not exist");
+    }
+    DRWN_ASSERT_MSG(drwnFileExists(lblFile), "Labels file " << lblFile << " does not exist");
+
+    // the grid of settings
+    const vector<double> lambda1s = parseValues(lambda1List);
+    const vector<double> lambda2s = parseValues(lambda2List);
+    const vector<double> lambda3s = parseValues(lambda3List);
+    const vector<double> lambda0s = parseValues(lambda0List);
+
+    // decode every image and feature map once
+    vector<string> baseNames = drwnDirectoryListing(imgDir, ".jpg", false, false);
+    DRWN_LOG_MESSAGE("Loading " << baseNames.size() << " images and labels...");
+    map< string, vector<int> > fileLabelPairs = parseLabel(lblFile);
+    vector<TuningImage> images;
+    images.reserve(baseNames.size());
+    size_t nBytes = 0;
+    for (unsigned i = 0; i < baseNames.size(); i++) {
+        const string processedImage = baseNames[i] + ".jpg";
+        map< string, vector<int> >::const_iterator it = fileLabelPairs.find(processedImage);
+        if (it == fileLabelPairs.end()) {
+            DRWN_LOG_WARNING("no ground truth for " << processedImage);
+            continue;
+        }
+        DRWN_LOG_STATUS("...loading image " << baseNames[i]);
+
+        images.push_back(TuningImage());
+        TuningImage &image = images.back();
+        image.baseName = baseNames[i];
+        image.truth = it->second;
+        image.img = cv::imread(string(imgDir) + DRWN_DIRSEP + processedImage);
+        image.features = loadFeatureMaps(fmapDir, mscDir, cshDir, csdDir, baseNames[i]);
+        nBytes += image.img.total() * image.img.elemSize() +
+            image.features.total() * image.features.elemSize();
+    }
+    const int nImages = (int)images.size();
+    DRWN_LOG_MESSAGE("Holding " << nImages << " images in " << (nBytes >> 20) << "MB");
+
+    vector<TuningJob> jobs;
+    for (unsigned a = 0; a < lambda1s.size(); a++) {
+        for (unsigned b = 0; b < lambda2s.size(); b++) {
+            for (unsigned c = 0; c < lambda3s.size(); c++) {
+                for (unsigned d = 0; d < lambda0s.size(); d++) {
+                    jobs.push_back(TuningJob());
+                    jobs.back().images = &images;
+                    jobs.back().lambda1 = lambda1s[a];
+                    jobs.back().lambda2 = lambda2s[b];
+                    jobs.back().lambda3 = lambda3s[c];
+                    jobs.back().lambda0 = lambda0s[d];
+                    jobs.back().backend = crfBackend;
+                    jobs.back().neighbourhood = neighbourhood;
+                }
+            }
+        }
+    }
+    vector<int> active(jobs.size());
+    for (unsigned k = 0; k < jobs.size(); k++) {
+        active[k] = k;
+    }
+    const TuningRank rank(jobs, bRankByBDE);
+
+    // score every setting on the subset and drop the weakest
+    const double startTime = crfWallTime();
+    long long nInferences = 0;
+    int nScored = 0;
+    if ((subsetSize > 0) && (subsetSize < nImages) && (jobs.size() > 1)) {
+        DRWN_LOG_MESSAGE("Scoring " << jobs.size() << " settings on " << subsetSize << " images...");
+        runTuningJobs(jobs, active, 0, subsetSize);
+        nInferences += (long long)active.size() * subsetSize;
+        nScored = subsetSize;
+
+        std::stable_sort(active.begin(), active.end(), rank);
+        const int nKeep = std::max(1, (int)ceil(keepFraction * active.size()));
+        active.resize(std::min((int)active.size(), nKeep));
+    }
+
+    // and the remaining settings on the remaining images
+    DRWN_LOG_MESSAGE("Scoring " << active.size() << " settings on " << nImages - nScored << " images...");
+    runTuningJobs(jobs, active, nScored, nImages);
+    nInferences += (long long)active.size() * (nImages - nScored);
+    const double totalTime = crfWallTime() - startTime;
+    DRWN_LOG_MESSAGE("Ran " << nInferences << " inferences in " << totalTime << "s ("
+        << 1000.0 * totalTime / std::max(nInferences, 1LL) << "ms each)");
+
+    // report the settings scored on every image, best first, followed by
+    // those stopped early
+    vector<int> order(active);
+    std::stable_sort(order.begin(), order.end(), rank);
+    vector<int> stopped;
+    for (unsigned k = 0; k < jobs.size(); k++) {
+        if (std::find(active.begin(), active.end(), (int)k) == active.end()) {
+            stopped.push_back(k);
+        }
+    }
+    std::stable_sort(stopped.begin(), stopped.end(), rank);
+    order.insert(order.end(), stopped.begin(), stopped.end());
+
+    ofstream csv;
+    if (outputFile != NULL) {
+        csv.open(outputFile, ios::out | ios::trunc);
+        DRWN_ASSERT_MSG(csv.is_open(), "could not create " << outputFile);
+        csv << "lambda1,lambda2,lambda3,lambda0,images,bde,recall,precision,fmeasure\n";
+    }
+    for (unsigned k = 0; k < order.size(); k++) {
+        const TuningJob &job = jobs[order[k]];
+        cout << job.lambda1 << "," << job.lambda2 << "," << job.lambda3 << "," << job.lambda0
+             << ": F-Measure " << job.score.averageFMeasure() << ", BDE " << job.score.averageBDE()
+             << ", Recall " << job.score.averageRecall() << ", Precision " << job.score.averagePrecision()
+             << " (" << job.score.nImages << " images)" << endl;
+        if (csv.is_open()) {
+            csv << job.lambda1 << "," << job.lambda2 << "," << job.lambda3 << "," << job.lambda0 << ","
+                << job.score.nImages << "," << job.score.averageBDE() << "," << job.score.averageRecall() << ","
+                << job.score.averagePrecision() << "," << job.score.averageFMeasure() << "\n";
+        }
+    }
+    csv.close();
+
+    // Clean up by freeing memory and printing profile information.
+    cvDestroyAllWindows();
+    drwnCodeProfiler::print();
+    return 0;
+}